@@ -0,0 +1,525 @@
+/*-
+ * Copyright (c) 2009-2016 Janne Snabb. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *
+ * Software web site:
+ *   https://dist.epipe.com/downtimed/
+ *
+ */
+
+/* Include config.h in case we use autoconf. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "downtimedb.h"
+#include "archive.h"
+
+static int	archive_flush(struct archive *);
+static int	readfull(int, void *, size_t);
+static int	writefull(int, const void *, size_t);
+static int	bitsfor(uint32_t);
+static void	put16(unsigned char *, uint16_t);
+static void	put32(unsigned char *, uint32_t);
+static void	put64(unsigned char *, uint64_t);
+static uint16_t	get16(const unsigned char *);
+static uint32_t	get32(const unsigned char *);
+static uint64_t	get64(const unsigned char *);
+
+/* Return 1 if the buffer starts with the archive magic */
+
+int
+archive_ismagic(const void *p, size_t len)
+{
+
+	return (len >= ARCHIVE_MAGICLEN &&
+	    memcmp(p, ARCHIVE_MAGIC, ARCHIVE_MAGICLEN) == 0);
+}
+
+/*
+ * Start writing an archive of the given hosts to fd. Return -1 and
+ * set errno on error.
+ */
+
+int
+archive_create(struct archive *ar, int fd, char * const *hosts, int nhosts)
+{
+	unsigned char hdr[ARCHIVE_MAGICLEN + 4], len[2];
+	size_t n;
+	int i;
+
+	memset(ar, 0, sizeof(struct archive));
+	ar->fd = fd;
+	ar->nhosts = nhosts;
+	ar->hostbits = bitsfor(nhosts > 0 ? nhosts - 1 : 0);
+
+	if ((ar->buf = malloc(ARCHIVE_MAXPAYLOAD)) == NULL)
+		return (-1);
+
+	memcpy(hdr, ARCHIVE_MAGIC, ARCHIVE_MAGICLEN);
+	put32(hdr + ARCHIVE_MAGICLEN, nhosts);
+	if (writefull(fd, hdr, sizeof(hdr)) < 0)
+		return (-1);
+
+	for (i = 0; i < nhosts; i++) {
+		if ((n = strlen(hosts[i])) > UINT16_MAX) {
+			errno = ENAMETOOLONG;
+			return (-1);
+		}
+		put16(len, n);
+		if (writefull(fd, len, sizeof(len)) < 0 ||
+		    writefull(fd, hosts[i], n) < 0)
+			return (-1);
+	}
+
+	return (0);
+}
+
+/*
+ * Add a group of n records of a host. The records of a group are
+ * always stored in the same block, which is written out first if
+ * there is no room for the whole group. Records with non-zero
+ * reserved bytes can not be archived.
+ */
+
+int
+archive_add(struct archive *ar, int host, const struct downtimedb *ent,
+    int n)
+{
+	int i, j;
+
+	if (n > ARCHIVE_BLOCKRECS || host < 0 || host >= ar->nhosts) {
+		errno = EINVAL;
+		return (-1);
+	}
+
+	for (i = 0; i < n; i++)
+		for (j = 0; j < sizeof(ent[i]._padding); j++)
+			if (ent[i]._padding[j] != 0) {
+				errno = EILSEQ;
+				return (-1);
+			}
+
+	if (ar->nrec + n > ARCHIVE_BLOCKRECS && archive_flush(ar) < 0)
+		return (-1);
+
+	for (i = 0; i < n; i++) {
+		if (ar->nrec == 0 || ent[i].when < ar->tmin)
+			ar->tmin = ent[i].when;
+		if (ar->nrec == 0 || ent[i].when > ar->tmax)
+			ar->tmax = ent[i].when;
+
+		ar->when[ar->nrec] = ent[i].when;
+		ar->what[ar->nrec] = ent[i].what;
+		ar->host[ar->nrec] = host;
+		ar->aux[ar->nrec] = ent[i].aux;
+		ar->nrec++;
+	}
+
+	return (0);
+}
+
+/* Write out the last block and free the buffers */
+
+int
+archive_finish(struct archive *ar)
+{
+	int ret;
+
+	ret = archive_flush(ar);
+	archive_free(ar);
+
+	return (ret);
+}
+
+/*
+ * Start reading an archive from fd, which must be positioned at the
+ * beginning of the archive. Return -1 and set errno on error.
+ */
+
+int
+archive_open(struct archive *ar, int fd)
+{
+	unsigned char hdr[ARCHIVE_MAGICLEN + 4], len[2];
+	uint32_t nhosts;
+	size_t n;
+	int i;
+
+	memset(ar, 0, sizeof(struct archive));
+	ar->fd = fd;
+
+	if (readfull(fd, hdr, sizeof(hdr)) <= 0 ||
+	    !archive_ismagic(hdr, sizeof(hdr))) {
+		errno = EILSEQ;
+		return (-1);
+	}
+
+	if ((nhosts = get32(hdr + ARCHIVE_MAGICLEN)) > INT32_MAX) {
+		errno = EILSEQ;
+		return (-1);
+	}
+
+	ar->nhosts = nhosts;
+	ar->hostbits = bitsfor(nhosts > 0 ? nhosts - 1 : 0);
+
+	if ((ar->buf = malloc(ARCHIVE_MAXPAYLOAD)) == NULL ||
+	    (ar->hosts = calloc(nhosts + 1, sizeof(char *))) == NULL)
+		goto err;
+
+	for (i = 0; i < nhosts; i++) {
+		if (readfull(fd, len, sizeof(len)) <= 0)
+			goto eilseq;
+		n = get16(len);
+		if ((ar->hosts[i] = malloc(n + 1)) == NULL)
+			goto err;
+		if (readfull(fd, ar->hosts[i], n) <= 0)
+			goto eilseq;
+		ar->hosts[i][n] = '\0';
+	}
+
+	return (0);
+eilseq:
+	errno = EILSEQ;
+err:
+	archive_free(ar);
+	return (-1);
+}
+
+/*
+ * Read and decode the next block which may contain records between
+ * tmin and tmax inclusive; blocks entirely outside of the range are
+ * skipped without decoding. Return the number of records in the
+ * block, 0 at the end of the archive or -1 on error.
+ */
+
+int
+archive_read(struct archive *ar, int64_t tmin, int64_t tmax)
+{
+	unsigned char hdr[ARCHIVE_BLOCKHDR];
+	const unsigned char *p, *end;
+	uint64_t u;
+	uint32_t paylen, nrec;
+	int64_t t;
+	int whatbits, hostbits, flags, ret, i, shift;
+	size_t bit;
+
+	for (;;) {
+		if ((ret = readfull(ar->fd, hdr, sizeof(hdr))) <= 0) {
+			ar->nrec = 0;
+			return (ret);
+		}
+
+		nrec = get32(hdr);
+		whatbits = hdr[4];
+		hostbits = hdr[5];
+		flags = hdr[6];
+		ar->tmin = (int64_t)get64(hdr + 8);
+		ar->tmax = (int64_t)get64(hdr + 16);
+		paylen = get32(hdr + 24);
+
+		if (nrec > ARCHIVE_BLOCKRECS || paylen > ARCHIVE_MAXPAYLOAD ||
+		    whatbits > 8 || hostbits != ar->hostbits)
+			goto eilseq;
+
+		if (ar->tmax >= tmin && ar->tmin <= tmax)
+			break;
+
+		if (lseek(ar->fd, paylen, SEEK_CUR) < 0)
+			return (-1);
+	}
+
+	if (readfull(ar->fd, ar->buf, paylen) <= 0)
+		goto eilseq;
+
+	p = ar->buf;
+	end = ar->buf + paylen;
+
+	/* time column */
+	for (i = 0, t = ar->tmin; i < nrec; i++) {
+		for (u = 0, shift = 0; ; shift += 7) {
+			if (p >= end || shift > 63)
+				goto eilseq;
+			u |= (uint64_t)(*p & 0x7f) << shift;
+			if ((*p++ & 0x80) == 0)
+				break;
+		}
+		t += (int64_t)((u >> 1) ^ -(u & 1));
+		ar->when[i] = t;
+	}
+
+	/* op code and host columns */
+	if (p + (nrec * whatbits + 7) / 8 + (nrec * hostbits + 7) / 8 > end)
+		goto eilseq;
+
+	for (i = 0, bit = 0; i < nrec; i++, bit += whatbits) {
+		for (u = 0, shift = 0; shift < whatbits; shift++)
+			u |= (uint64_t)((p[(bit + shift) / 8] >>
+			    ((bit + shift) % 8)) & 1) << shift;
+		ar->what[i] = u;
+	}
+	p += (nrec * whatbits + 7) / 8;
+
+	for (i = 0, bit = 0; i < nrec; i++, bit += hostbits) {
+		for (u = 0, shift = 0; shift < hostbits; shift++)
+			u |= (uint64_t)((p[(bit + shift) / 8] >>
+			    ((bit + shift) % 8)) & 1) << shift;
+		if (u >= ar->nhosts)
+			goto eilseq;
+		ar->host[i] = u;
+	}
+	p += (nrec * hostbits + 7) / 8;
+
+	/* aux column, all zero if not present */
+	for (i = 0; i < nrec; i++) {
+		u = 0;
+		if (flags & ARCHIVE_FLAG_AUX) {
+			for (shift = 0; ; shift += 7) {
+				if (p >= end || shift > 31)
+					goto eilseq;
+				u |= (uint64_t)(*p & 0x7f) << shift;
+				if ((*p++ & 0x80) == 0)
+					break;
+			}
+		}
+		ar->aux[i] = u;
+	}
+
+	ar->nrec = nrec;
+	return (nrec);
+eilseq:
+	errno = EILSEQ;
+	return (-1);
+}
+
+void
+archive_free(struct archive *ar)
+{
+	int i;
+
+	if (ar->hosts != NULL) {
+		for (i = 0; i < ar->nhosts; i++)
+			free(ar->hosts[i]);
+		free(ar->hosts);
+		ar->hosts = NULL;
+	}
+	free(ar->buf);
+	ar->buf = NULL;
+}
+
+/* Encode and write out the current block */
+
+static int
+archive_flush(struct archive *ar)
+{
+	unsigned char hdr[ARCHIVE_BLOCKHDR], *p;
+	uint64_t u;
+	uint8_t maxwhat;
+	int64_t prev, d;
+	int whatbits, flags, i, shift;
+	size_t bit, n;
+
+	if (ar->nrec == 0)
+		return (0);
+
+	for (i = 0, maxwhat = 0, flags = 0; i < ar->nrec; i++) {
+		if (ar->what[i] > maxwhat)
+			maxwhat = ar->what[i];
+		if (ar->aux[i] != 0)
+			flags |= ARCHIVE_FLAG_AUX;
+	}
+	whatbits = bitsfor(maxwhat);
+
+	p = ar->buf;
+
+	for (i = 0, prev = ar->tmin; i < ar->nrec; i++) {
+		d = ar->when[i] - prev;
+		prev = ar->when[i];
+		u = ((uint64_t)d << 1) ^ (uint64_t)(d >> 63);
+		while (u >= 0x80) {
+			*p++ = (u & 0x7f) | 0x80;
+			u >>= 7;
+		}
+		*p++ = u;
+	}
+
+	n = (ar->nrec * whatbits + 7) / 8;
+	memset(p, 0, n);
+	for (i = 0, bit = 0; i < ar->nrec; i++, bit += whatbits)
+		for (shift = 0; shift < whatbits; shift++)
+			if (ar->what[i] & (1 << shift))
+				p[(bit + shift) / 8] |= 1 << ((bit + shift) % 8);
+	p += n;
+
+	n = (ar->nrec * ar->hostbits + 7) / 8;
+	memset(p, 0, n);
+	for (i = 0, bit = 0; i < ar->nrec; i++, bit += ar->hostbits)
+		for (shift = 0; shift < ar->hostbits; shift++)
+			if (ar->host[i] & ((uint32_t)1 << shift))
+				p[(bit + shift) / 8] |= 1 << ((bit + shift) % 8);
+	p += n;
+
+	if (flags & ARCHIVE_FLAG_AUX) {
+		for (i = 0; i < ar->nrec; i++) {
+			u = ar->aux[i];
+			while (u >= 0x80) {
+				*p++ = (u & 0x7f) | 0x80;
+				u >>= 7;
+			}
+			*p++ = u;
+		}
+	}
+
+	memset(hdr, 0, sizeof(hdr));
+	put32(hdr, ar->nrec);
+	hdr[4] = whatbits;
+	hdr[5] = ar->hostbits;
+	hdr[6] = flags;
+	put64(hdr + 8, (uint64_t)ar->tmin);
+	put64(hdr + 16, (uint64_t)ar->tmax);
+	put32(hdr + 24, p - ar->buf);
+
+	if (writefull(ar->fd, hdr, sizeof(hdr)) < 0 ||
+	    writefull(ar->fd, ar->buf, p - ar->buf) < 0)
+		return (-1);
+
+	ar->nrec = 0;
+	return (0);
+}
+
+/*
+ * Read exactly len bytes. Return 1 on success, 0 at end of file and
+ * -1 on error. A partial read is an error with errno set to EILSEQ.
+ */
+
+static int
+readfull(int fd, void *buf, size_t len)
+{
+	ssize_t ret;
+	size_t done = 0;
+
+	while (done < len) {
+		if ((ret = read(fd, (char *)buf + done, len - done)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return (-1);
+		}
+		if (ret == 0) {
+			if (done == 0)
+				return (0);
+			errno = EILSEQ;
+			return (-1);
+		}
+		done += ret;
+	}
+
+	return (1);
+}
+
+static int
+writefull(int fd, const void *buf, size_t len)
+{
+	ssize_t ret;
+	size_t done = 0;
+
+	while (done < len) {
+		if ((ret = write(fd, (const char *)buf + done,
+		    len - done)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return (-1);
+		}
+		done += ret;
+	}
+
+	return (0);
+}
+
+/* Number of bits needed to represent v */
+
+static int
+bitsfor(uint32_t v)
+{
+	int n;
+
+	for (n = 0; v != 0; n++)
+		v >>= 1;
+
+	return (n);
+}
+
+static void
+put16(unsigned char *p, uint16_t v)
+{
+
+	p[0] = v >> 8;
+	p[1] = v;
+}
+
+static void
+put32(unsigned char *p, uint32_t v)
+{
+
+	put16(p, v >> 16);
+	put16(p + 2, v);
+}
+
+static void
+put64(unsigned char *p, uint64_t v)
+{
+
+	put32(p, v >> 32);
+	put32(p + 4, v);
+}
+
+static uint16_t
+get16(const unsigned char *p)
+{
+
+	return ((uint16_t)p[0] << 8 | p[1]);
+}
+
+static uint32_t
+get32(const unsigned char *p)
+{
+
+	return ((uint32_t)get16(p) << 16 | get16(p + 2));
+}
+
+static uint64_t
+get64(const unsigned char *p)
+{
+
+	return ((uint64_t)get32(p) << 32 | get32(p + 4));
+}
+
+/* eof */
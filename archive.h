@@ -0,0 +1,104 @@
+/*-
+ * Copyright (c) 2009-2016 Janne Snabb. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *
+ * Software web site:
+ *   https://dist.epipe.com/downtimed/
+ *
+ */
+
+/*
+ * Compact columnar archive of downtime database records.
+ *
+ * An archive holds the records of any number of hosts, for example a
+ * whole fleet, in a fraction of the space the database files take.
+ * The records are stored in blocks of up to ARCHIVE_BLOCKRECS records
+ * in time order. Within a block each field is stored as a column of
+ * its own: the times as zigzag encoded varint deltas from the previous
+ * time, and the op codes and host numbers bit-packed using as few bits
+ * as the block needs. Each block header carries the smallest and the
+ * largest time in the block, so that a reader looking for a time range
+ * can skip whole blocks without decoding them.
+ *
+ * A down record and the up record following it are never split into
+ * different blocks, so that skipping a block never separates a pair.
+ *
+ * All integers are big-endian. The layout is:
+ *
+ *   file header:  magic "DTARCHV1", uint32 number of hosts,
+ *                 for each host uint16 name length and the name
+ *   block header: uint32 number of records, uint8 op code bits,
+ *                 uint8 host bits, uint8 flags, uint8 reserved,
+ *                 int64 min time, int64 max time, uint32 payload
+ *                 length, uint32 reserved
+ *   block payload: time column, op code column, host column and,
+ *                 if flag ARCHIVE_FLAG_AUX is set, the auxiliary data
+ *                 column as varints
+ */
+
+#define	ARCHIVE_MAGIC		"DTARCHV1"
+#define	ARCHIVE_MAGICLEN	8
+#define	ARCHIVE_BLOCKRECS	4096
+#define	ARCHIVE_BLOCKHDR	32
+
+/* Block header flags */
+
+#define	ARCHIVE_FLAG_AUX	0x01	/* block has aux column */
+
+/*
+ * Maximum payload size: 10 byte varints for times, 8 bit op codes,
+ * 32 bit hosts and 5 byte varints for aux data.
+ */
+
+#define	ARCHIVE_MAXPAYLOAD	(ARCHIVE_BLOCKRECS * (10 + 1 + 4 + 5))
+
+struct archive {
+	int		 fd;
+	int		 nhosts;
+	char		**hosts;	/* host names */
+	int		 hostbits;	/* bits needed for a host number */
+
+	/* records of the current block */
+	int		 nrec;
+	int64_t		 tmin;
+	int64_t		 tmax;
+	int64_t		 when[ARCHIVE_BLOCKRECS];
+	uint8_t		 what[ARCHIVE_BLOCKRECS];
+	uint32_t	 host[ARCHIVE_BLOCKRECS];
+	uint32_t	 aux[ARCHIVE_BLOCKRECS];
+
+	unsigned char	*buf;		/* encoded payload */
+};
+
+/* Function prototypes */
+
+int	archive_ismagic(const void *, size_t);
+int	archive_create(struct archive *, int, char * const *, int);
+int	archive_add(struct archive *, int, const struct downtimedb *, int);
+int	archive_finish(struct archive *);
+int	archive_open(struct archive *, int);
+int	archive_read(struct archive *, int64_t, int64_t);
+void	archive_free(struct archive *);
+
+/* eof */
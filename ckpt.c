@@ -0,0 +1,568 @@
+/*-
+ * Copyright (c) 2009-2016 Janne Snabb. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *
+ * Software web site:
+ *   https://dist.epipe.com/downtimed/
+ *
+ */
+
+/* Include config.h in case we use autoconf. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "downtimedb.h"
+#include "ckpt.h"
+
+/* from <sys/stat.h> */
+
+#ifndef DEFFILEMODE
+#define	DEFFILEMODE 0666
+#endif
+
+#define	CHUNKSIZE	(CKPT_INTERVAL * sizeof(struct downtimedb))
+#define	ENTOFF(k)	(CKPT_HDRSIZE + (off_t)((k) - 1) * CKPT_ENTSIZE)
+
+static int	findentry(int, int, off_t, int64_t, struct ckpt_state *,
+		    off_t *);
+static int	checkheader(int);
+static int	writeheader(int);
+static int	readchunk(int, off_t, unsigned char *);
+static int	readentry(int, off_t, struct ckpt_state *, uint32_t *);
+static void	encode(const struct ckpt_state *, uint32_t, unsigned char *);
+static void	put32(unsigned char *, uint32_t);
+static void	put64(unsigned char *, uint64_t);
+static uint32_t	get32(const unsigned char *);
+static uint64_t	get64(const unsigned char *);
+
+/* Return the name of the checkpoint file of a database in malloc'd memory */
+
+char *
+ckpt_path(const char *dbfile)
+{
+	char *p;
+	size_t len;
+
+	len = strlen(dbfile);
+	if ((p = malloc(len + sizeof(CKPT_SUFFIX))) == NULL)
+		return (NULL);
+
+	memcpy(p, dbfile, len);
+	memcpy(p + len, CKPT_SUFFIX, sizeof(CKPT_SUFFIX));
+
+	return (p);
+}
+
+/* Initialize the totals of an empty database */
+
+void
+ckpt_init(struct ckpt_state *st, int64_t tadjust)
+{
+
+	memset(st, 0, sizeof(struct ckpt_state));
+	downtimedb_parse_init(&st->parser, tadjust);
+}
+
+/* Add a record to the totals */
+
+void
+ckpt_add(struct ckpt_state *st, const struct downtimedb *ent)
+{
+	struct downtime dt;
+
+	if (ent->when > st->maxwhen)
+		st->maxwhen = ent->when;
+
+	if (!downtimedb_parse(&st->parser, ent, &dt) ||
+	    dt.what == DOWNTIMEDB_WHAT_STALL ||
+	    dt.down == 0 || dt.up == 0 || dt.up < dt.down)
+		return;
+
+	st->down += dt.up - dt.down;
+
+	switch (dt.what) {
+	case DOWNTIMEDB_WHAT_CRASH:
+		st->crashes++;
+		break;
+	case DOWNTIMEDB_WHAT_SUSPEND:
+		st->suspends++;
+		break;
+	default:
+		st->shutdowns++;
+		break;
+	}
+}
+
+/*
+ * Bring the checkpoint file of a database up to date, creating it if
+ * needed. Only the entries for the records added since the last entry
+ * are computed, unless rebuild is set or the last entry does not match
+ * the database, in which case the file is written from scratch.
+ * Return -1 and set errno on error.
+ */
+
+int
+ckpt_update(const char *dbfile, int rebuild)
+{
+	unsigned char chunk[CHUNKSIZE], ent[CKPT_ENTSIZE];
+	struct ckpt_state st;
+	struct downtimedb rec;
+	struct stat sb;
+	uint32_t crc;
+	off_t nent, want, k;
+	char *path;
+	int dbfd = -1, fd = -1, i, ret = -1, saved;
+
+	if ((path = ckpt_path(dbfile)) == NULL)
+		return (-1);
+
+	if ((dbfd = open(dbfile, O_RDONLY)) < 0 || fstat(dbfd, &sb) < 0)
+		goto out;
+	want = sb.st_size / sizeof(struct downtimedb) / CKPT_INTERVAL;
+
+	if ((fd = open(path, O_RDWR | O_CREAT, DEFFILEMODE)) < 0 ||
+	    fstat(fd, &sb) < 0)
+		goto out;
+	nent = sb.st_size < CKPT_HDRSIZE ?
+	    0 : (sb.st_size - CKPT_HDRSIZE) / CKPT_ENTSIZE;
+
+	/* a database which has shrunk has been replaced */
+	if (nent > want || checkheader(fd) < 0)
+		rebuild = 1;
+
+	ckpt_init(&st, 0);
+	if (!rebuild && nent > 0 &&
+	    (readentry(fd, nent, &st, &crc) < 0 ||
+	    readchunk(dbfd, nent, chunk) < 0 ||
+	    downtimedb_crc32(chunk, CHUNKSIZE) != crc))
+		rebuild = 1;
+
+	if (rebuild) {
+		if (ftruncate(fd, 0) < 0 || writeheader(fd) < 0)
+			goto out;
+		ckpt_init(&st, 0);
+		nent = 0;
+	}
+
+	for (k = nent + 1; k <= want; k++) {
+		if (readchunk(dbfd, k, chunk) < 0)
+			goto out;
+		for (i = 0; i < CKPT_INTERVAL; i++) {
+			downtimedb_decode(chunk + i * sizeof(struct downtimedb),
+			    &rec);
+			ckpt_add(&st, &rec);
+		}
+
+		encode(&st, downtimedb_crc32(chunk, CHUNKSIZE), ent);
+		if (pwrite(fd, ent, sizeof(ent), ENTOFF(k)) != sizeof(ent))
+			goto out;
+	}
+
+	ret = 0;
+out:
+	saved = errno;
+	if (fd >= 0 && close(fd) < 0 && ret == 0) {
+		saved = errno;
+		ret = -1;
+	}
+	if (dbfd >= 0)
+		close(dbfd);
+	free(path);
+	errno = saved;
+
+	return (ret);
+}
+
+/*
+ * Check the checkpoint file of a database by computing all of its
+ * entries from scratch. Return 0 if it is correct and up to date, 1 if
+ * not and -1 on error.
+ */
+
+int
+ckpt_verify(const char *dbfile)
+{
+	unsigned char chunk[CHUNKSIZE], ent[CKPT_ENTSIZE], ent2[CKPT_ENTSIZE];
+	struct ckpt_state st;
+	struct downtimedb rec;
+	struct stat sb;
+	off_t nent, want, k;
+	char *path;
+	int dbfd = -1, fd = -1, i, ret = -1, saved;
+
+	if ((path = ckpt_path(dbfile)) == NULL)
+		return (-1);
+
+	if ((dbfd = open(dbfile, O_RDONLY)) < 0 || fstat(dbfd, &sb) < 0)
+		goto out;
+	want = sb.st_size / sizeof(struct downtimedb) / CKPT_INTERVAL;
+
+	if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &sb) < 0)
+		goto out;
+	nent = sb.st_size < CKPT_HDRSIZE ?
+	    0 : (sb.st_size - CKPT_HDRSIZE) / CKPT_ENTSIZE;
+
+	ret = 1;
+	if (checkheader(fd) < 0 || nent != want ||
+	    sb.st_size != ENTOFF(nent + 1))
+		goto out;
+
+	ckpt_init(&st, 0);
+	for (k = 1; k <= want; k++) {
+		if (readchunk(dbfd, k, chunk) < 0) {
+			ret = -1;
+			goto out;
+		}
+		for (i = 0; i < CKPT_INTERVAL; i++) {
+			downtimedb_decode(chunk + i * sizeof(struct downtimedb),
+			    &rec);
+			ckpt_add(&st, &rec);
+		}
+
+		encode(&st, downtimedb_crc32(chunk, CHUNKSIZE), ent);
+		if (pread(fd, ent2, sizeof(ent2), ENTOFF(k)) != sizeof(ent2)) {
+			ret = -1;
+			goto out;
+		}
+		if (memcmp(ent, ent2, sizeof(ent)) != 0)
+			goto out;
+	}
+
+	ret = 0;
+out:
+	saved = errno;
+	if (fd >= 0)
+		close(fd);
+	if (dbfd >= 0)
+		close(dbfd);
+	free(path);
+	errno = saved;
+
+	return (ret);
+}
+
+/*
+ * Compute the totals of the downtime before time t in a database: the
+ * periods which ended before t in full and the part before t of a
+ * period which was going on at t. The difference of two such totals gives the
+ * totals within a time window.
+ *
+ * If the checkpoint file is open in ckfd, the latest entry before t is
+ * looked up with a binary search and only the records after it
+ * are read; pass -1 to read all of the database. The checkpoints are
+ * computed without a crash time adjustment, so they are not used if
+ * tadjust is nonzero. Return 0, 1 if the checkpoint did not match the
+ * database and was not used, or -1 on error.
+ */
+
+int
+ckpt_before(int dbfd, int ckfd, int64_t t, int64_t tadjust,
+    struct ckpt_state *st)
+{
+	unsigned char chunk[CHUNKSIZE];
+	struct downtimedb rec;
+	struct stat sb;
+	off_t nrec, pos;
+	ssize_t n;
+	int i, ret = 0;
+
+	ckpt_init(st, tadjust);
+	pos = 0;
+
+	if (fstat(dbfd, &sb) < 0)
+		return (-1);
+	nrec = sb.st_size / sizeof(struct downtimedb);
+
+	if (ckfd >= 0 && tadjust == 0)
+		ret = findentry(dbfd, ckfd, nrec, t, st, &pos);
+
+	for (; pos < nrec; pos += n / sizeof(struct downtimedb)) {
+		if ((n = pread(dbfd, chunk, sizeof(chunk),
+		    pos * sizeof(struct downtimedb))) < 0)
+			return (-1);
+		if (n < sizeof(struct downtimedb))
+			break;
+
+		for (i = 0; i < n / sizeof(struct downtimedb); i++) {
+			downtimedb_decode(chunk + i * sizeof(struct downtimedb),
+			    &rec);
+			if (rec.when < t) {
+				ckpt_add(st, &rec);
+				continue;
+			}
+
+			/* a period going on at t is counted up to t */
+			if (st->parser.tdown != 0 &&
+			    (rec.what == DOWNTIMEDB_WHAT_UP ||
+			    rec.what == DOWNTIMEDB_WHAT_RESUME)) {
+				rec.when = t;
+				ckpt_add(st, &rec);
+			}
+			return (ret);
+		}
+	}
+
+	return (ret);
+}
+
+/*
+ * Find the first record at or after time t in a database. All of the
+ * records before it are earlier than t, but some after it may be too
+ * if the system clock was set back. The checkpoint file open in ckfd
+ * is used as with ckpt_before(); pass -1 to read all of the database.
+ * The index of the record, or the number of records if there is none,
+ * is stored in rec. Return 0, 1 if the checkpoint did not match the
+ * database and was not used, or -1 on error.
+ */
+
+int
+ckpt_find(int dbfd, int ckfd, int64_t t, off_t *rec)
+{
+	unsigned char chunk[CHUNKSIZE];
+	struct ckpt_state st;
+	struct downtimedb ent;
+	struct stat sb;
+	off_t nrec, pos;
+	ssize_t n;
+	int i, ret = 0;
+
+	pos = 0;
+
+	if (fstat(dbfd, &sb) < 0)
+		return (-1);
+	nrec = sb.st_size / sizeof(struct downtimedb);
+
+	if (ckfd >= 0)
+		ret = findentry(dbfd, ckfd, nrec, t, &st, &pos);
+
+	for (; pos < nrec; pos += n / sizeof(struct downtimedb)) {
+		if ((n = pread(dbfd, chunk, sizeof(chunk),
+		    pos * sizeof(struct downtimedb))) < 0)
+			return (-1);
+		if (n < sizeof(struct downtimedb))
+			break;
+
+		for (i = 0; i < n / sizeof(struct downtimedb); i++) {
+			downtimedb_decode(chunk + i * sizeof(struct downtimedb),
+			    &ent);
+			if (ent.when >= t) {
+				*rec = pos + i;
+				return (ret);
+			}
+		}
+	}
+
+	*rec = nrec;
+	return (ret);
+}
+
+/*
+ * Find the last checkpoint entry with all of its records before t
+ * with a binary search and store it in st and the index of the record
+ * following it in pos. The records covered by the entry are checked
+ * against its CRC-32. Return 0, or 1 if the checkpoint did not match
+ * the database and pos is left at 0.
+ */
+
+static int
+findentry(int dbfd, int ckfd, off_t nrec, int64_t t, struct ckpt_state *st,
+    off_t *pos)
+{
+	unsigned char chunk[CHUNKSIZE];
+	struct ckpt_state tmp;
+	struct stat sb;
+	uint32_t crc;
+	off_t nent, lo, hi, mid;
+
+	*pos = 0;
+
+	if (fstat(ckfd, &sb) < 0 || checkheader(ckfd) < 0)
+		return (0);
+
+	nent = sb.st_size < CKPT_HDRSIZE ?
+	    0 : (sb.st_size - CKPT_HDRSIZE) / CKPT_ENTSIZE;
+	if (nent > nrec / CKPT_INTERVAL)
+		nent = nrec / CKPT_INTERVAL;
+
+	for (lo = 0, hi = nent; lo < hi; ) {
+		mid = (lo + hi + 1) / 2;
+		if (readentry(ckfd, mid, &tmp, &crc) < 0)
+			return (1);
+		if (tmp.maxwhen < t)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+
+	if (lo == 0)
+		return (0);
+
+	if (readentry(ckfd, lo, &tmp, &crc) < 0 ||
+	    readchunk(dbfd, lo, chunk) < 0 ||
+	    downtimedb_crc32(chunk, CHUNKSIZE) != crc)
+		return (1);
+
+	*st = tmp;
+	*pos = lo * CKPT_INTERVAL;
+
+	return (0);
+}
+
+/* Check the header of a checkpoint file, return -1 if it is not valid */
+
+static int
+checkheader(int fd)
+{
+	unsigned char hdr[CKPT_HDRSIZE];
+
+	if (pread(fd, hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+	    memcmp(hdr, CKPT_MAGIC, CKPT_MAGICLEN) != 0 ||
+	    get32(hdr + CKPT_MAGICLEN) != CKPT_INTERVAL)
+		return (-1);
+
+	return (0);
+}
+
+static int
+writeheader(int fd)
+{
+	unsigned char hdr[CKPT_HDRSIZE];
+
+	memset(hdr, 0, sizeof(hdr));
+	memcpy(hdr, CKPT_MAGIC, CKPT_MAGICLEN);
+	put32(hdr + CKPT_MAGICLEN, CKPT_INTERVAL);
+
+	if (pwrite(fd, hdr, sizeof(hdr), 0) != sizeof(hdr))
+		return (-1);
+
+	return (0);
+}
+
+/* Read the records covered by entry k of a checkpoint file */
+
+static int
+readchunk(int dbfd, off_t k, unsigned char *chunk)
+{
+
+	errno = 0;
+	if (pread(dbfd, chunk, CHUNKSIZE, (k - 1) * CHUNKSIZE) != CHUNKSIZE) {
+		if (errno == 0)
+			errno = EILSEQ;
+		return (-1);
+	}
+
+	return (0);
+}
+
+/* Read entry k of a checkpoint file, return -1 if it is not valid */
+
+static int
+readentry(int fd, off_t k, struct ckpt_state *st, uint32_t *chunkcrc)
+{
+	unsigned char buf[CKPT_ENTSIZE];
+
+	errno = 0;
+	if (pread(fd, buf, sizeof(buf), ENTOFF(k)) != sizeof(buf) ||
+	    get32(buf + 44) != downtimedb_crc32(buf, 44)) {
+		if (errno == 0)
+			errno = EILSEQ;
+		return (-1);
+	}
+
+	ckpt_init(st, 0);
+	st->maxwhen = (int64_t)get64(buf);
+	st->down = (int64_t)get64(buf + 8);
+	st->crashes = get32(buf + 16);
+	st->shutdowns = get32(buf + 20);
+	st->suspends = get32(buf + 24);
+	st->parser.what = buf[28];
+	st->parser.tdown = (int64_t)get64(buf + 32);
+	*chunkcrc = get32(buf + 40);
+
+	return (0);
+}
+
+static void
+encode(const struct ckpt_state *st, uint32_t chunkcrc, unsigned char *buf)
+{
+
+	memset(buf, 0, CKPT_ENTSIZE);
+	put64(buf, (uint64_t)st->maxwhen);
+	put64(buf + 8, (uint64_t)st->down);
+	put32(buf + 16, st->crashes);
+	put32(buf + 20, st->shutdowns);
+	put32(buf + 24, st->suspends);
+	buf[28] = (unsigned char)st->parser.what;
+	put64(buf + 32, (uint64_t)st->parser.tdown);
+	put32(buf + 40, chunkcrc);
+	put32(buf + 44, downtimedb_crc32(buf, 44));
+}
+
+static void
+put32(unsigned char *p, uint32_t v)
+{
+
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static void
+put64(unsigned char *p, uint64_t v)
+{
+
+	put32(p, (uint32_t)(v >> 32));
+	put32(p + 4, (uint32_t)v);
+}
+
+static uint32_t
+get32(const unsigned char *p)
+{
+
+	return ((uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+	    (uint32_t)p[2] << 8 | p[3]);
+}
+
+static uint64_t
+get64(const unsigned char *p)
+{
+
+	return ((uint64_t)get32(p) << 32 | get32(p + 4));
+}
+
+/* eof */
@@ -0,0 +1,90 @@
+/*-
+ * Copyright (c) 2009-2016 Janne Snabb. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *
+ * Software web site:
+ *   https://dist.epipe.com/downtimed/
+ *
+ */
+
+/*
+ * A checkpoint file kept next to a downtime database, so that the
+ * downtime within any time window can be found without reading all
+ * of the database. After every CKPT_INTERVAL records it holds the
+ * totals of all of the downtime periods up to that record:
+ *
+ *	header		CKPT_HDRSIZE bytes
+ *	    magic	8 bytes, CKPT_MAGIC
+ *	    interval	uint32, records between checkpoints
+ *	    reserved	zero
+ *	entries		CKPT_ENTSIZE bytes each, entry k after k * interval
+ *	    maxwhen	int64, latest record time so far
+ *	    down	int64, total downtime in seconds
+ *	    crashes	uint32
+ *	    shutdowns	uint32
+ *	    suspends	uint32
+ *	    what	uint8, op code of a pending down record
+ *	    reserved	3 bytes zero
+ *	    tdown	int64, time of a pending down record or 0
+ *	    chunkcrc	uint32, CRC-32 of the records since the previous
+ *	    crc		uint32, CRC-32 of the above
+ *
+ * All numbers are big-endian. The pending down record is one whose up
+ * record comes after the checkpoint; it is needed to carry on reading
+ * from the checkpoint. The CRC-32 of the records covered by an entry
+ * tells whether the checkpoint still matches the database.
+ *
+ * Only complete downtime periods are counted, the same way as by
+ * downtimes(1). Stalls are not counted as downtime.
+ */
+
+#define	CKPT_MAGIC	"DTCKPT01"
+#define	CKPT_MAGICLEN	8
+#define	CKPT_HDRSIZE	16
+#define	CKPT_ENTSIZE	48
+#define	CKPT_INTERVAL	128
+#define	CKPT_SUFFIX	".ckpt"
+
+/* Totals of the downtime periods up to some point in a database */
+
+struct ckpt_state {
+	int64_t		maxwhen;	/* latest record time seen */
+	int64_t		down;		/* total downtime in seconds */
+	uint32_t	crashes;
+	uint32_t	shutdowns;
+	uint32_t	suspends;
+	struct downtimedb_parser parser;
+};
+
+/* Function prototypes */
+
+char *	ckpt_path(const char *);
+void	ckpt_init(struct ckpt_state *, int64_t);
+void	ckpt_add(struct ckpt_state *, const struct downtimedb *);
+int	ckpt_update(const char *, int);
+int	ckpt_verify(const char *);
+int	ckpt_before(int, int, int64_t, int64_t, struct ckpt_state *);
+int	ckpt_find(int, int, int64_t, off_t *);
+
+/* eof */
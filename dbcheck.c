@@ -0,0 +1,587 @@
+/*-
+ * Copyright (c) 2009-2016 Janne Snabb. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *
+ * Software web site:
+ *   https://dist.epipe.com/downtimed/
+ *
+ */
+
+/* Include config.h in case we use autoconf. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "downtimedb.h"
+#include "dbcheck.h"
+
+#define	RECSIZE		((off_t)sizeof(struct downtimedb))
+#define	SCANRECS	4096		/* records read at a time */
+#define	COPYSIZE	(1024 * 1024)	/* bytes copied at a time */
+#define	REPAIR_SUFFIX	".repair"
+
+/* Down records and the up records they pair with */
+
+#define	ISDOWN(w)	((w) == DOWNTIMEDB_WHAT_SHUTDOWN || \
+			    (w) == DOWNTIMEDB_WHAT_CRASH || \
+			    (w) == DOWNTIMEDB_WHAT_SUSPEND)
+#define	PAIRS(d, u)	(((d) == DOWNTIMEDB_WHAT_SUSPEND) == \
+			    ((u) == DOWNTIMEDB_WHAT_RESUME))
+
+/*
+ * What is needed of a checked chunk to stitch it to its neighbours:
+ * the first down or up record, which may pair with a down record of
+ * an earlier chunk, and the down record still pending at the end.
+ */
+
+struct chunk {
+	off_t		 start;		/* first record */
+	off_t		 end;		/* one past the last record */
+	struct dbcheck_region *bad;	/* damaged regions, unordered */
+	size_t		 nbad;
+	size_t		 maxbad;
+	off_t		 head;		/* first down or up record or -1 */
+	int		 headwhat;
+	off_t		 tail;		/* pending down record or -1 */
+	int		 tailwhat;
+	off_t		 first;		/* first undamaged record or -1 */
+	int64_t		 firstwhen;
+	int64_t		 lastwhen;	/* time of last undamaged record */
+	off_t		 nback;
+	off_t		 firstback;
+	int		 error;		/* errno if reading failed */
+};
+
+/* Chunks shared by the checking threads */
+
+struct work {
+	int		 fd;
+	struct chunk	*chunks;
+	size_t		 nchunks;
+	size_t		 next;		/* next chunk to check */
+#ifdef HAVE_PTHREAD
+	pthread_mutex_t	 lock;
+#endif
+};
+
+static void *	worker(void *);
+static void	scanchunk(int, struct chunk *);
+static int	validate(const struct downtimedb *);
+static int	addbad(struct dbcheck_region **, size_t *, size_t *, off_t,
+		    int);
+static int	region_cmp(const void *, const void *);
+static int	copyrange(int, int, off_t, off_t);
+
+/*
+ * Check the database open in fd with the given number of threads,
+ * or one per processor if nthreads is not positive. The result is
+ * stored in chk. Return 0 on success and -1 on error with errno set.
+ */
+
+int
+dbcheck_run(int fd, int nthreads, struct dbcheck *chk)
+{
+	struct stat sb;
+	struct work w;
+	struct chunk *c;
+	struct dbcheck_region *bad = NULL, *r;
+	size_t i, nbad = 0, maxbad = 0;
+	off_t carry = -1;
+	int carrywhat = 0, havelast = 0, error = 0;
+	int64_t lastwhen = 0;
+#ifdef HAVE_PTHREAD
+	pthread_t *tids = NULL;
+	int nt = 0;
+#endif
+
+	memset(chk, 0, sizeof(*chk));
+	chk->firstback = -1;
+
+	if (fstat(fd, &sb) < 0)
+		return (-1);
+	chk->size = sb.st_size;
+	chk->nrec = sb.st_size / RECSIZE;
+
+	memset(&w, 0, sizeof(w));
+	w.fd = fd;
+	w.nchunks = (chk->nrec + DBCHECK_CHUNK - 1) / DBCHECK_CHUNK;
+	if ((w.chunks = calloc(w.nchunks + 1, sizeof(struct chunk))) == NULL)
+		return (-1);
+	for (i = 0; i < w.nchunks; i++) {
+		w.chunks[i].start = (off_t)i * DBCHECK_CHUNK;
+		w.chunks[i].end = w.chunks[i].start + DBCHECK_CHUNK;
+		if (w.chunks[i].end > chk->nrec)
+			w.chunks[i].end = chk->nrec;
+	}
+
+	if (nthreads <= 0)
+		nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (nthreads > (int)w.nchunks)
+		nthreads = (int)w.nchunks;
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_init(&w.lock, NULL);
+	if (nthreads > 1 &&
+	    (tids = calloc(nthreads - 1, sizeof(pthread_t))) != NULL) {
+		/* if a thread can not be started, the others do its share */
+		for (nt = 0; nt < nthreads - 1; nt++)
+			if (pthread_create(&tids[nt], NULL, worker, &w) != 0)
+				break;
+	}
+	worker(&w);
+	while (nt > 0)
+		pthread_join(tids[--nt], NULL);
+	free(tids);
+	pthread_mutex_destroy(&w.lock);
+#else
+	worker(&w);
+#endif
+
+	/*
+	 * Stitch the chunks together in file order. A down record pending
+	 * at the end of a chunk is carried to the next chunk which has
+	 * any down or up records.
+	 */
+	for (i = 0; i < w.nchunks && error == 0; i++) {
+		c = &w.chunks[i];
+		if (c->error != 0) {
+			error = c->error;
+			break;
+		}
+
+		if (c->first >= 0) {
+			if (havelast && c->firstwhen < lastwhen) {
+				chk->nback++;
+				if (chk->firstback < 0)
+					chk->firstback = c->first;
+			}
+			chk->nback += c->nback;
+			if (chk->firstback < 0)
+				chk->firstback = c->firstback;
+			lastwhen = c->lastwhen;
+			havelast = 1;
+		}
+
+		if (c->head >= 0) {
+			if (!ISDOWN(c->headwhat) && carry >= 0 &&
+			    PAIRS(carrywhat, c->headwhat))
+				carry = -1;
+			else if (!ISDOWN(c->headwhat) &&
+			    addbad(&bad, &nbad, &maxbad, c->head,
+			    DBCHECK_UNPAIRED) < 0)
+				error = errno;
+			if (carry >= 0 && addbad(&bad, &nbad, &maxbad, carry,
+			    DBCHECK_UNPAIRED) < 0)
+				error = errno;
+			carry = c->tail;
+			carrywhat = c->tailwhat;
+		}
+	}
+	if (error == 0 && carry >= 0 &&
+	    addbad(&bad, &nbad, &maxbad, carry, DBCHECK_UNPAIRED) < 0)
+		error = errno;
+	if (error == 0 && chk->size % RECSIZE != 0 &&
+	    addbad(&bad, &nbad, &maxbad, chk->nrec, DBCHECK_PARTIAL) < 0)
+		error = errno;
+
+	/* gather the regions of all chunks and merge neighbouring ones */
+	for (i = 0; i < w.nchunks && error == 0; i++) {
+		c = &w.chunks[i];
+		if (nbad + c->nbad > maxbad) {
+			if ((r = realloc(bad, (nbad + c->nbad) *
+			    sizeof(struct dbcheck_region))) == NULL) {
+				error = errno;
+				break;
+			}
+			bad = r;
+			maxbad = nbad + c->nbad;
+		}
+		if (c->nbad > 0)
+			memcpy(bad + nbad, c->bad,
+			    c->nbad * sizeof(struct dbcheck_region));
+		nbad += c->nbad;
+	}
+	for (i = 0; i < w.nchunks; i++)
+		free(w.chunks[i].bad);
+	free(w.chunks);
+
+	if (error != 0) {
+		free(bad);
+		errno = error;
+		return (-1);
+	}
+
+	if (nbad > 0)
+		qsort(bad, nbad, sizeof(struct dbcheck_region), region_cmp);
+	for (i = 0; i < nbad; i++) {
+		if (chk->nbad > 0 && bad[chk->nbad - 1].end == bad[i].start &&
+		    bad[chk->nbad - 1].reason == bad[i].reason)
+			bad[chk->nbad - 1].end = bad[i].end;
+		else
+			bad[chk->nbad++] = bad[i];
+		chk->ndamaged += bad[i].end - bad[i].start;
+	}
+	chk->bad = bad;
+
+	return (0);
+}
+
+/*
+ * Remove the damaged regions found by dbcheck_run() from the database
+ * fn open in fd. Damage at the end of the file is cut off; otherwise
+ * the undamaged records are copied to a new file which then replaces
+ * the database. Return 0 on success and -1 on error with errno set.
+ */
+
+int
+dbcheck_repair(const char *fn, int fd, const struct dbcheck *chk)
+{
+	struct stat sb;
+	char *tmp;
+	off_t pos;
+	size_t i;
+	int out, error;
+
+	if (chk->nbad == 0)
+		return (0);
+
+	/* is all of the damage in one piece at the end of the file? */
+	for (i = chk->nbad - 1; i > 0; i--)
+		if (chk->bad[i - 1].end != chk->bad[i].start)
+			break;
+	if (i == 0 && chk->bad[chk->nbad - 1].end >= chk->nrec) {
+		if (ftruncate(fd, chk->bad[0].start * RECSIZE) < 0 ||
+		    fsync(fd) < 0)
+			return (-1);
+		return (0);
+	}
+
+	if (fstat(fd, &sb) < 0)
+		return (-1);
+	if ((tmp = malloc(strlen(fn) + sizeof(REPAIR_SUFFIX))) == NULL)
+		return (-1);
+	strcpy(tmp, fn);
+	strcat(tmp, REPAIR_SUFFIX);
+
+	if ((out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC,
+	    sb.st_mode & 07777)) < 0) {
+		free(tmp);
+		return (-1);
+	}
+
+	pos = 0;
+	for (i = 0; i < chk->nbad; i++) {
+		if (copyrange(fd, out, pos, chk->bad[i].start) < 0)
+			goto fail;
+		pos = chk->bad[i].end;
+	}
+	if (pos < chk->nrec && copyrange(fd, out, pos, chk->nrec) < 0)
+		goto fail;
+
+	if (fsync(out) < 0 || close(out) < 0) {
+		out = -1;
+		goto fail;
+	}
+	out = -1;
+	if (rename(tmp, fn) < 0)
+		goto fail;
+
+	free(tmp);
+	return (0);
+
+fail:
+	error = errno;
+	if (out >= 0)
+		close(out);
+	unlink(tmp);
+	free(tmp);
+	errno = error;
+	return (-1);
+}
+
+/* Free the memory held by a check result */
+
+void
+dbcheck_free(struct dbcheck *chk)
+{
+
+	free(chk->bad);
+	chk->bad = NULL;
+	chk->nbad = 0;
+}
+
+/* Describe the reason of a damaged region */
+
+const char *
+dbcheck_reason(int reason)
+{
+
+	switch (reason) {
+	case DBCHECK_PARTIAL:
+		return ("partial record");
+	case DBCHECK_OPCODE:
+		return ("unknown op code");
+	case DBCHECK_PADDING:
+		return ("reserved bytes not zero");
+	case DBCHECK_TIME:
+		return ("invalid time");
+	case DBCHECK_UNPAIRED:
+		return ("unpaired record");
+	default:
+		return ("no damage");
+	}
+}
+
+/* Check chunks until there are none left */
+
+static void *
+worker(void *arg)
+{
+	struct work *w = arg;
+	size_t i;
+
+	for (;;) {
+#ifdef HAVE_PTHREAD
+		pthread_mutex_lock(&w->lock);
+#endif
+		i = w->next++;
+#ifdef HAVE_PTHREAD
+		pthread_mutex_unlock(&w->lock);
+#endif
+		if (i >= w->nchunks)
+			break;
+		scanchunk(w->fd, &w->chunks[i]);
+	}
+
+	return (NULL);
+}
+
+/*
+ * Check the records of one chunk. Down and up records are paired
+ * within the chunk; the first one of them and a down record left
+ * pending at the end are left for dbcheck_run() to decide.
+ */
+
+static void
+scanchunk(int fd, struct chunk *c)
+{
+	struct downtimedb ent;
+	unsigned char *buf;
+	off_t idx, n, pending = -1;
+	ssize_t len;
+	int reason, pwhat = 0, seen = 0;
+	size_t j;
+
+	c->head = c->tail = c->first = c->firstback = -1;
+
+	if ((buf = malloc(SCANRECS * RECSIZE)) == NULL) {
+		c->error = errno;
+		return;
+	}
+
+	for (idx = c->start; idx < c->end; idx += n) {
+		n = c->end - idx;
+		if (n > SCANRECS)
+			n = SCANRECS;
+		if ((len = pread(fd, buf, n * RECSIZE, idx * RECSIZE)) < 0) {
+			c->error = errno;
+			break;
+		}
+		if (len != n * RECSIZE) {
+			/* the file was truncated while reading it */
+			c->error = EIO;
+			break;
+		}
+
+		for (j = 0; j < n; j++) {
+			downtimedb_decode(buf + j * RECSIZE, &ent);
+			if ((reason = validate(&ent)) != DBCHECK_OK) {
+				if (addbad(&c->bad, &c->nbad, &c->maxbad,
+				    idx + j, reason) < 0)
+					goto nomem;
+				continue;
+			}
+
+			if (c->first < 0) {
+				c->first = idx + j;
+				c->firstwhen = ent.when;
+			} else if (ent.when < c->lastwhen) {
+				c->nback++;
+				if (c->firstback < 0)
+					c->firstback = idx + j;
+			}
+			c->lastwhen = ent.when;
+
+			if (ent.what == DOWNTIMEDB_WHAT_STALL)
+				continue;
+
+			if (!seen) {
+				c->head = idx + j;
+				c->headwhat = ent.what;
+				seen = 1;
+				if (!ISDOWN(ent.what))
+					continue;
+			} else if (!ISDOWN(ent.what) && pending >= 0 &&
+			    PAIRS(pwhat, ent.what)) {
+				pending = -1;
+				continue;
+			} else if (!ISDOWN(ent.what)) {
+				if (addbad(&c->bad, &c->nbad, &c->maxbad,
+				    idx + j, DBCHECK_UNPAIRED) < 0)
+					goto nomem;
+			}
+
+			if (pending >= 0 && addbad(&c->bad, &c->nbad,
+			    &c->maxbad, pending, DBCHECK_UNPAIRED) < 0)
+				goto nomem;
+			pending = ISDOWN(ent.what) ? idx + j : -1;
+			pwhat = ent.what;
+		}
+	}
+
+	c->tail = pending;
+	c->tailwhat = pwhat;
+	free(buf);
+	return;
+
+nomem:
+	c->error = errno;
+	free(buf);
+}
+
+/* Return the reason why a record is damaged or DBCHECK_OK */
+
+static int
+validate(const struct downtimedb *ent)
+{
+
+	if (ent->what < DOWNTIMEDB_WHAT_UP ||
+	    ent->what > DOWNTIMEDB_WHAT_RESUME)
+		return (DBCHECK_OPCODE);
+	if (ent->_padding[0] != 0 || ent->_padding[1] != 0 ||
+	    ent->_padding[2] != 0 ||
+	    (ent->aux != 0 && ent->what != DOWNTIMEDB_WHAT_STALL &&
+	    ent->what != DOWNTIMEDB_WHAT_UP &&
+	    ent->what != DOWNTIMEDB_WHAT_SHUTDOWN))
+		return (DBCHECK_PADDING);
+	if (ent->when <= 0)
+		return (DBCHECK_TIME);
+
+	return (DBCHECK_OK);
+}
+
+/* Add a damaged record to a region list, extending the last region */
+
+static int
+addbad(struct dbcheck_region **bad, size_t *nbad, size_t *maxbad, off_t idx,
+    int reason)
+{
+	struct dbcheck_region *r;
+
+	if (*nbad > 0) {
+		r = &(*bad)[*nbad - 1];
+		if (r->end == idx && r->reason == reason) {
+			r->end++;
+			return (0);
+		}
+	}
+
+	if (*nbad == *maxbad) {
+		if ((r = realloc(*bad, (*maxbad ? *maxbad * 2 : 16) *
+		    sizeof(struct dbcheck_region))) == NULL)
+			return (-1);
+		*bad = r;
+		*maxbad = *maxbad ? *maxbad * 2 : 16;
+	}
+
+	r = &(*bad)[(*nbad)++];
+	r->start = idx;
+	r->end = idx + 1;
+	r->reason = reason;
+
+	return (0);
+}
+
+/* Order damaged regions by position in the file */
+
+static int
+region_cmp(const void *a, const void *b)
+{
+	const struct dbcheck_region *ra = a, *rb = b;
+
+	if (ra->start != rb->start)
+		return (ra->start < rb->start ? -1 : 1);
+	return (0);
+}
+
+/* Copy records [from, to) of the database in fd to the end of out */
+
+static int
+copyrange(int fd, int out, off_t from, off_t to)
+{
+	unsigned char *buf;
+	off_t pos, end;
+	ssize_t len, n;
+
+	if ((buf = malloc(COPYSIZE)) == NULL)
+		return (-1);
+
+	end = to * RECSIZE;
+	for (pos = from * RECSIZE; pos < end; pos += len) {
+		len = end - pos > COPYSIZE ? COPYSIZE : end - pos;
+		if ((len = pread(fd, buf, len, pos)) <= 0) {
+			if (len == 0)
+				errno = EIO;
+			free(buf);
+			return (-1);
+		}
+		if ((n = write(out, buf, len)) != len) {
+			if (n >= 0)
+				errno = EIO;
+			free(buf);
+			return (-1);
+		}
+	}
+
+	free(buf);
+	return (0);
+}
+
+/* eof */
@@ -0,0 +1,82 @@
+/*-
+ * Copyright (c) 2009-2016 Janne Snabb. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *
+ * Software web site:
+ *   https://dist.epipe.com/downtimed/
+ *
+ */
+
+/*
+ * Integrity check of a downtime database. The file is split into
+ * chunks of DBCHECK_CHUNK records which are checked in parallel; the
+ * pairing of down and up records and the ordering of record times
+ * across chunk boundaries are settled afterwards from a short summary
+ * of each chunk, see dbcheck_run().
+ *
+ * A record is damaged if its op code is unknown, its reserved bytes
+ * are not zero, its time is not positive, or it is a down record
+ * without the up record following it or vice versa. A partial record
+ * at the end of the file is damaged too. Damaged records are gathered
+ * into regions of consecutive records. Times going backwards are only
+ * counted, since they are also caused by setting the system clock.
+ */
+
+#define	DBCHECK_CHUNK	(1024 * 1024)	/* records per chunk */
+
+#define	DBCHECK_OK		0
+#define	DBCHECK_PARTIAL		1	/* partial record at end of file */
+#define	DBCHECK_OPCODE		2	/* unknown op code */
+#define	DBCHECK_PADDING		3	/* reserved bytes not zero */
+#define	DBCHECK_TIME		4	/* time zero or negative */
+#define	DBCHECK_UNPAIRED	5	/* down without up or vice versa */
+
+/* Consecutive damaged records [start, end) of the same kind */
+
+struct dbcheck_region {
+	off_t	start;
+	off_t	end;
+	int	reason;
+};
+
+/* Result of checking a database file */
+
+struct dbcheck {
+	off_t	size;			/* file size in bytes */
+	off_t	nrec;			/* number of complete records */
+	off_t	ndamaged;		/* number of damaged records */
+	struct dbcheck_region *bad;	/* damaged regions in file order */
+	size_t	nbad;
+	off_t	nback;			/* number of times going backwards */
+	off_t	firstback;		/* first one going back or -1 */
+};
+
+/* Function prototypes */
+
+int	dbcheck_run(int, int, struct dbcheck *);
+int	dbcheck_repair(const char *, int, const struct dbcheck *);
+void	dbcheck_free(struct dbcheck *);
+const char *dbcheck_reason(int);
+
+/* eof */
@@ -0,0 +1,652 @@
+/*-
+ * Copyright (c) 2009-2016 Janne Snabb. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *
+ * Software web site:
+ *   https://dist.epipe.com/downtimed/
+ *
+ */
+
+/* Include config.h in case we use autoconf. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "downtimedb.h"
+#include "heap.h"
+#include "dbmerge.h"
+
+#define	RECSIZE		sizeof(struct downtimedb)
+#define	UNITSIZE	(2 * RECSIZE)
+#define	MINUNITS	1024		/* units sorted in memory at least */
+#define	MERGE_SUFFIX	".merge"
+#define	TMP_TEMPLATE	".XXXXXX"
+
+/* Down records and the up records they pair with */
+
+#define	ISDOWN(w)	((w) == DOWNTIMEDB_WHAT_SHUTDOWN || \
+			    (w) == DOWNTIMEDB_WHAT_CRASH || \
+			    (w) == DOWNTIMEDB_WHAT_SUSPEND)
+#define	ISUP(w)		((w) == DOWNTIMEDB_WHAT_UP || \
+			    (w) == DOWNTIMEDB_WHAT_RESUME)
+#define	PAIRS(d, u)	(((d) == DOWNTIMEDB_WHAT_SUSPEND) == \
+			    ((u) == DOWNTIMEDB_WHAT_RESUME))
+
+/*
+ * A down record and its up record, or a lone record with ent[1].what
+ * DOWNTIMEDB_WHAT_NONE. Runs on disk hold units as two records each.
+ */
+
+struct unit {
+	struct downtimedb ent[2];
+};
+
+#define	UNITRECS(u)	((u)->ent[1].what != DOWNTIMEDB_WHAT_NONE ? 2 : 1)
+#define	UNITEND(u)	((u)->ent[UNITRECS(u) - 1].when)
+
+/* Buffered output of units or records */
+
+struct wbuf {
+	int		 fd;
+	int		 runs;		/* write units, not records */
+	unsigned char	*buf;
+	size_t		 len;
+	size_t		 size;
+};
+
+/* A sorted run being merged */
+
+struct run {
+	int		 fd;
+	unsigned char	*buf;
+	size_t		 len;
+	size_t		 pos;
+	size_t		 size;
+	struct unit	 cur;		/* next unit of the run */
+};
+
+/* State of a merge */
+
+struct merger {
+	struct dbmerge	*m;
+	const char	*out;
+	struct unit	*units;		/* units being sorted in memory */
+	size_t		 nunits;
+	size_t		 maxunits;
+	size_t		 memory;
+	int		*runfd;		/* sorted runs spilled to disk */
+	int		 nrunfd;
+
+	/* what has been written, to find the duplicates */
+	int		 written;
+	struct unit	 last;
+	int64_t		 downend;	/* end of last downtime written */
+	int		 havedown;
+};
+
+static int	readinput(struct merger *, const char *);
+static int	addunit(struct merger *, const struct unit *);
+static int	spill(struct merger *);
+static int	mergeruns(struct merger *, int *, int, struct wbuf *);
+static int	run_next(struct run *);
+static int	emit(struct merger *, struct wbuf *, const struct unit *);
+static int	wbuf_put(struct wbuf *, const struct unit *);
+static int	wbuf_flush(struct wbuf *);
+static int	tmpopen(const char *);
+static int	unit_cmp(const void *, const void *);
+static int	run_cmp(const void *, const void *);
+
+/*
+ * Merge the databases in the files in[0..nin) into out, sorting at most
+ * memory bytes of records at a time. The result is stored in m. Return
+ * 0 on success and -1 on error with errno and m->errname set.
+ */
+
+int
+dbmerge_run(char **in, int nin, const char *out, size_t memory,
+    struct dbmerge *m)
+{
+	struct merger mg;
+	struct wbuf w;
+	char *fn = NULL;
+	size_t i;
+	int fd = -1, ret = -1, error;
+
+	memset(m, 0, sizeof(struct dbmerge));
+	memset(&mg, 0, sizeof(mg));
+	memset(&w, 0, sizeof(w));
+	m->errname = out;
+	mg.m = m;
+	mg.out = out;
+	mg.memory = memory;
+	if ((mg.maxunits = memory / sizeof(struct unit)) < MINUNITS)
+		mg.maxunits = MINUNITS;
+
+	if ((mg.units = malloc(mg.maxunits * sizeof(struct unit))) == NULL)
+		goto fail;
+
+	for (i = 0; i < nin; i++)
+		if (readinput(&mg, in[i]) < 0)
+			goto fail;
+
+	/* write to a new file which replaces out only when complete */
+	m->errname = out;
+	if ((fn = malloc(strlen(out) + sizeof(MERGE_SUFFIX))) == NULL)
+		goto fail;
+	strcpy(fn, out);
+	strcat(fn, MERGE_SUFFIX);
+	if ((fd = open(fn, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0)
+		goto fail;
+	w.fd = fd;
+
+	if (mg.nrunfd == 0) {
+		/* everything fitted in memory */
+		qsort(mg.units, mg.nunits, sizeof(struct unit), unit_cmp);
+		if ((w.buf = malloc(DBMERGE_BUFSIZE)) == NULL)
+			goto fail;
+		w.size = DBMERGE_BUFSIZE;
+		for (i = 0; i < mg.nunits; i++)
+			if (emit(&mg, &w, &mg.units[i]) < 0)
+				goto fail;
+		if (wbuf_flush(&w) < 0)
+			goto fail;
+	} else {
+		if (mg.nunits > 0 && spill(&mg) < 0)
+			goto fail;
+
+		/* the memory is needed for the read buffers now */
+		free(mg.units);
+		mg.units = NULL;
+
+		/* merge the runs until few enough are left for one pass */
+		while (mg.nrunfd > DBMERGE_FANIN) {
+			memset(&w, 0, sizeof(w));
+			w.runs = 1;
+			if ((w.fd = tmpopen(out)) < 0)
+				goto fail;
+			mg.runfd[mg.nrunfd++] = w.fd;
+			if (mergeruns(&mg, mg.runfd, DBMERGE_FANIN, &w) < 0)
+				goto fail;
+			for (i = 0; i < DBMERGE_FANIN; i++)
+				close(mg.runfd[i]);
+			memmove(mg.runfd, mg.runfd + DBMERGE_FANIN,
+			    (mg.nrunfd - DBMERGE_FANIN) * sizeof(int));
+			mg.nrunfd -= DBMERGE_FANIN;
+		}
+
+		memset(&w, 0, sizeof(w));
+		w.fd = fd;
+		if (mergeruns(&mg, mg.runfd, mg.nrunfd, &w) < 0)
+			goto fail;
+	}
+
+	if (fsync(fd) < 0)
+		goto fail;
+	error = close(fd);
+	fd = -1;
+	if (error < 0 || rename(fn, out) < 0)
+		goto fail;
+
+	ret = 0;
+
+fail:
+	error = errno;
+	if (fd >= 0)
+		close(fd);
+	if (ret < 0 && fn != NULL)
+		unlink(fn);
+	for (i = 0; i < mg.nrunfd; i++)
+		close(mg.runfd[i]);
+	free(mg.runfd);
+	free(mg.units);
+	free(w.buf);
+	free(fn);
+	errno = error;
+	return (ret);
+}
+
+/*
+ * Read a database file, pairing the down and up records into units.
+ * A down record at the end of the file stays alone.
+ */
+
+static int
+readinput(struct merger *mg, const char *fn)
+{
+	struct downtimedb ent, pend;
+	struct unit u;
+	struct stat sb;
+	unsigned char *buf;
+	size_t len, pos;
+	ssize_t ret;
+	int fd, havepend = 0, error;
+
+	mg->m->errname = fn;
+
+	if ((fd = open(fn, O_RDONLY)) < 0)
+		return (-1);
+	if (fstat(fd, &sb) < 0) {
+		error = errno;
+		close(fd);
+		errno = error;
+		return (-1);
+	}
+	if (sb.st_size % RECSIZE != 0) {
+		close(fd);
+		errno = EILSEQ;
+		return (-1);
+	}
+	if ((buf = malloc(DBMERGE_BUFSIZE)) == NULL) {
+		close(fd);
+		return (-1);
+	}
+
+	for (len = 0; (ret = read(fd, buf + len, DBMERGE_BUFSIZE - len))
+	    > 0; ) {
+		len += ret;
+		for (pos = 0; len - pos >= RECSIZE; pos += RECSIZE) {
+			downtimedb_decode(buf + pos, &ent);
+			mg->m->nin++;
+
+			if (havepend) {
+				havepend = 0;
+				if (ISUP(ent.what) && PAIRS(pend.what,
+				    ent.what)) {
+					u.ent[0] = pend;
+					u.ent[1] = ent;
+					if (addunit(mg, &u) < 0)
+						goto fail;
+					continue;
+				}
+				memset(&u, 0, sizeof(u));
+				u.ent[0] = pend;
+				if (addunit(mg, &u) < 0)
+					goto fail;
+			}
+
+			if (ISDOWN(ent.what)) {
+				pend = ent;
+				havepend = 1;
+				continue;
+			}
+			memset(&u, 0, sizeof(u));
+			u.ent[0] = ent;
+			if (addunit(mg, &u) < 0)
+				goto fail;
+		}
+
+		/* keep a record split between two reads */
+		memmove(buf, buf + pos, len - pos);
+		len -= pos;
+	}
+	if (ret < 0)
+		goto fail;
+
+	if (havepend) {
+		memset(&u, 0, sizeof(u));
+		u.ent[0] = pend;
+		if (addunit(mg, &u) < 0)
+			goto fail;
+	}
+
+	free(buf);
+	return (close(fd));
+
+fail:
+	error = errno;
+	free(buf);
+	close(fd);
+	errno = error;
+	return (-1);
+}
+
+/* Add a unit to be sorted, spilling a run to disk if memory is full */
+
+static int
+addunit(struct merger *mg, const struct unit *u)
+{
+
+	if (mg->nunits == mg->maxunits && spill(mg) < 0)
+		return (-1);
+
+	mg->units[mg->nunits++] = *u;
+
+	return (0);
+}
+
+/* Sort the units in memory and write them to a new run */
+
+static int
+spill(struct merger *mg)
+{
+	struct wbuf w;
+	int *p;
+	size_t i;
+	int error;
+
+	mg->m->errname = mg->out;
+
+	if ((p = realloc(mg->runfd, (mg->nrunfd + 2) * sizeof(int)))
+	    == NULL)
+		return (-1);
+	mg->runfd = p;
+
+	qsort(mg->units, mg->nunits, sizeof(struct unit), unit_cmp);
+
+	memset(&w, 0, sizeof(w));
+	w.runs = 1;
+	if ((w.fd = tmpopen(mg->out)) < 0)
+		return (-1);
+	if ((w.buf = malloc(DBMERGE_BUFSIZE)) == NULL)
+		goto fail;
+	w.size = DBMERGE_BUFSIZE;
+
+	for (i = 0; i < mg->nunits; i++)
+		if (wbuf_put(&w, &mg->units[i]) < 0)
+			goto fail;
+	if (wbuf_flush(&w) < 0)
+		goto fail;
+	free(w.buf);
+
+	mg->runfd[mg->nrunfd++] = w.fd;
+	mg->m->nruns++;
+	mg->nunits = 0;
+
+	return (0);
+
+fail:
+	error = errno;
+	free(w.buf);
+	close(w.fd);
+	errno = error;
+	return (-1);
+}
+
+/*
+ * Merge the n runs open in fd[] into w, using the memory allowed for
+ * sorting as read buffers. If w is the output, duplicates are removed.
+ */
+
+static int
+mergeruns(struct merger *mg, int *fd, int n, struct wbuf *w)
+{
+	struct run *runs, *r;
+	struct heap h;
+	size_t size;
+	int i, ret, error;
+
+	mg->m->errname = mg->out;
+
+	if ((size = mg->memory / (n + 1) / UNITSIZE * UNITSIZE) <
+	    MINUNITS * UNITSIZE)
+		size = MINUNITS * UNITSIZE;
+
+	if ((runs = calloc(n, sizeof(struct run))) == NULL)
+		return (-1);
+	if (heap_init(&h, sizeof(struct run *), n, run_cmp) < 0) {
+		free(runs);
+		return (-1);
+	}
+	if ((w->buf = malloc(size)) == NULL)
+		goto fail;
+	w->size = size;
+
+	for (i = 0; i < n; i++) {
+		r = &runs[i];
+		r->fd = fd[i];
+		r->size = size;
+		if ((r->buf = malloc(size)) == NULL ||
+		    lseek(r->fd, 0, SEEK_SET) < 0)
+			goto fail;
+		if ((ret = run_next(r)) < 0)
+			goto fail;
+		if (ret > 0 && heap_push(&h, &r) < 0)
+			goto fail;
+	}
+
+	while (h.nmemb > 0) {
+		r = *(struct run **)heap_top(&h);
+
+		if ((w->runs ? wbuf_put(w, &r->cur) : emit(mg, w, &r->cur))
+		    < 0)
+			goto fail;
+
+		if ((ret = run_next(r)) < 0)
+			goto fail;
+		if (ret > 0)
+			heap_fix_top(&h);
+		else
+			heap_pop(&h, NULL);
+	}
+
+	if (wbuf_flush(w) < 0)
+		goto fail;
+
+	ret = 0;
+	goto out;
+
+fail:
+	ret = -1;
+out:
+	error = errno;
+	heap_free(&h);
+	for (i = 0; i < n; i++)
+		free(runs[i].buf);
+	free(runs);
+	free(w->buf);
+	w->buf = NULL;
+	errno = error;
+	return (ret);
+}
+
+/* Read the next unit of a run. Return 1 if read, 0 at the end. */
+
+static int
+run_next(struct run *r)
+{
+	ssize_t ret;
+
+	if (r->len - r->pos < UNITSIZE) {
+		memmove(r->buf, r->buf + r->pos, r->len - r->pos);
+		r->len -= r->pos;
+		r->pos = 0;
+
+		while (r->len < UNITSIZE) {
+			if ((ret = read(r->fd, r->buf + r->len,
+			    r->size - r->len)) < 0)
+				return (-1);
+			if (ret == 0)
+				break;
+			r->len += ret;
+		}
+
+		if (r->len == 0)
+			return (0);
+		if (r->len < UNITSIZE) {
+			errno = EILSEQ;
+			return (-1);
+		}
+	}
+
+	downtimedb_decode(r->buf + r->pos, &r->cur.ent[0]);
+	downtimedb_decode(r->buf + r->pos + RECSIZE, &r->cur.ent[1]);
+	r->pos += UNITSIZE;
+
+	return (1);
+}
+
+/*
+ * Write a unit to the output unless it is a duplicate. The units
+ * arrive in unit_cmp() order, so identical units are next to each
+ * other and a unit overlapping a downtime follows it.
+ */
+
+static int
+emit(struct merger *mg, struct wbuf *w, const struct unit *u)
+{
+	int64_t t = u->ent[0].when;
+	int n = UNITRECS(u);
+
+	if (mg->written && unit_cmp(u, &mg->last) == 0) {
+		mg->m->ndup += n;
+		return (0);
+	}
+
+	/* an up record may end a downtime already written, too */
+	if (mg->havedown && (t < mg->downend ||
+	    (t == mg->downend && n == 1 && ISUP(u->ent[0].what)))) {
+		mg->m->noverlap += n;
+		return (0);
+	}
+
+	if (wbuf_put(w, u) < 0)
+		return (-1);
+
+	mg->m->nout += n;
+	mg->written = 1;
+	mg->last = *u;
+	if (n == 2 && (!mg->havedown || UNITEND(u) > mg->downend)) {
+		mg->downend = UNITEND(u);
+		mg->havedown = 1;
+	}
+
+	return (0);
+}
+
+/* Buffer a unit for writing, as a unit to a run or as records */
+
+static int
+wbuf_put(struct wbuf *w, const struct unit *u)
+{
+	int i, n;
+
+	n = w->runs ? 2 : UNITRECS(u);
+	if (w->size - w->len < n * RECSIZE && wbuf_flush(w) < 0)
+		return (-1);
+
+	for (i = 0; i < n; i++) {
+		downtimedb_encode(&u->ent[i], w->buf + w->len);
+		w->len += RECSIZE;
+	}
+
+	return (0);
+}
+
+/* Write out the buffered data */
+
+static int
+wbuf_flush(struct wbuf *w)
+{
+	unsigned char *p = w->buf;
+	ssize_t ret;
+
+	while (w->len > 0) {
+		if ((ret = write(w->fd, p, w->len)) < 0)
+			return (-1);
+		p += ret;
+		w->len -= ret;
+	}
+
+	return (0);
+}
+
+/*
+ * Create a temporary file next to out for a run. It is removed right
+ * away, so that nothing is left behind even if we are killed.
+ */
+
+static int
+tmpopen(const char *out)
+{
+	char *fn;
+	int fd, error;
+
+	if ((fn = malloc(strlen(out) + sizeof(TMP_TEMPLATE))) == NULL)
+		return (-1);
+	strcpy(fn, out);
+	strcat(fn, TMP_TEMPLATE);
+
+	if ((fd = mkstemp(fn)) >= 0)
+		unlink(fn);
+
+	error = errno;
+	free(fn);
+	errno = error;
+	return (fd);
+}
+
+/*
+ * Order units by start time. Of units starting at the same time, a
+ * pair comes before a lone record so that the lone one is found to
+ * overlap it. The rest of the fields only make the order total.
+ */
+
+static int
+unit_cmp(const void *a, const void *b)
+{
+	const struct unit *ua = a;
+	const struct unit *ub = b;
+	int i;
+
+	if (ua->ent[0].when != ub->ent[0].when)
+		return (ua->ent[0].when < ub->ent[0].when ? -1 : 1);
+	if (UNITRECS(ua) != UNITRECS(ub))
+		return (UNITRECS(ub) - UNITRECS(ua));
+	if (UNITEND(ua) != UNITEND(ub))
+		return (UNITEND(ua) < UNITEND(ub) ? -1 : 1);
+
+	for (i = 0; i < 2; i++) {
+		if (ua->ent[i].what != ub->ent[i].what)
+			return (ua->ent[i].what - ub->ent[i].what);
+		if (ua->ent[i].aux != ub->ent[i].aux)
+			return (ua->ent[i].aux < ub->ent[i].aux ? -1 : 1);
+	}
+
+	return (0);
+}
+
+/* Order runs by their next unit */
+
+static int
+run_cmp(const void *a, const void *b)
+{
+
+	return (unit_cmp(&(*(struct run * const *)a)->cur,
+	    &(*(struct run * const *)b)->cur));
+}
+
+/* eof */
@@ -0,0 +1,67 @@
+/*-
+ * Copyright (c) 2009-2016 Janne Snabb. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *
+ * Software web site:
+ *   https://dist.epipe.com/downtimed/
+ *
+ */
+
+/*
+ * Merging downtime databases which overlap, for example copies of the
+ * database of the same host restored from backups at different times.
+ * The records of all the files are sorted by time and duplicates are
+ * removed, giving a single database.
+ *
+ * The records are sorted in units: a down record together with the up
+ * record pairing with it, or a lone record. Inputs larger than the
+ * memory given are sorted in runs which are spilled to temporary files
+ * next to the output and then merged, DBMERGE_FANIN runs at a time.
+ *
+ * A unit identical to another one is an exact duplicate. A unit which
+ * starts within a downtime period already written is an overlapping
+ * duplicate: a host can not go down while it is down, so it must be
+ * the same downtime as recorded by another copy of the database. Of
+ * overlapping units the one which starts first is kept.
+ */
+
+#define	DBMERGE_FANIN	64		/* runs merged at a time */
+#define	DBMERGE_BUFSIZE	(1024 * 1024)	/* bytes per file buffer */
+
+/* Result of merging */
+
+struct dbmerge {
+	off_t	nin;		/* records read */
+	off_t	nout;		/* records written */
+	off_t	ndup;		/* exact duplicates removed */
+	off_t	noverlap;	/* overlapping duplicates removed */
+	int	nruns;		/* sorted runs spilled to disk */
+	const char *errname;	/* file which failed if -1 returned */
+};
+
+/* Function prototypes */
+
+int	dbmerge_run(char **, int, const char *, size_t, struct dbmerge *);
+
+/* eof */
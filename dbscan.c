@@ -0,0 +1,329 @@
+/*-
+ * Copyright (c) 2009-2016 Janne Snabb. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *
+ * Software web site:
+ *   https://dist.epipe.com/downtimed/
+ *
+ */
+
+/* Include config.h in case we use autoconf. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+
+#include <errno.h>
+#include <inttypes.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "downtimedb.h"
+#include "dbscan.h"
+
+#define	RECSIZE		((off_t)sizeof(struct downtimedb))
+#define	SCANRECS	4096		/* records read at a time */
+
+#define	ISDOWN(w)	((w) == DOWNTIMEDB_WHAT_SHUTDOWN || \
+			    (w) == DOWNTIMEDB_WHAT_CRASH || \
+			    (w) == DOWNTIMEDB_WHAT_SUSPEND)
+
+/*
+ * A decoded chunk: the records up to and including its first down
+ * record, the periods found after it and the parser state at the end
+ * of the chunk.
+ */
+
+struct dbscan_chunk {
+	off_t		 start;		/* first record */
+	off_t		 end;		/* one past the last record */
+	struct downtimedb *head;	/* records up to the first down */
+	size_t		 nhead;
+	size_t		 headpos;	/* next record of head to stitch */
+	int		 hasdown;	/* a down record was seen */
+	struct downtimedb_parser state;	/* parser state if hasdown */
+	struct downtime	*dt;		/* periods from the first down on */
+	size_t		 ndt;
+	size_t		 dtpos;		/* next period to return */
+	int		 error;		/* errno if reading failed */
+};
+
+/* Chunks shared by the reading threads */
+
+struct work {
+	struct dbscan	*scan;
+	size_t		 next;		/* next chunk to read */
+#ifdef HAVE_PTHREAD
+	pthread_mutex_t	 lock;
+#endif
+};
+
+static int	readwindow(struct dbscan *);
+static void *	worker(void *);
+static void	scanchunk(struct dbscan *, struct dbscan_chunk *);
+
+/*
+ * Prepare to read records [start, end) of the database open in fd
+ * with the given number of threads, or one per processor if nthreads
+ * is not positive. Crash times are adjusted by tadjust as with
+ * downtimedb_parse_init(). Return 0 on success and -1 on error with
+ * errno set.
+ */
+
+int
+dbscan_open(struct dbscan *s, int fd, off_t start, off_t end, int nthreads,
+    int64_t tadjust)
+{
+	off_t n;
+
+	memset(s, 0, sizeof(*s));
+	s->fd = fd;
+	s->next = start;
+	s->end = end;
+	s->tadjust = tadjust;
+
+	if (nthreads <= 0)
+		nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	n = (end - start + DBSCAN_CHUNK - 1) / DBSCAN_CHUNK;
+	if (nthreads > n)
+		nthreads = (int)n;
+	if (nthreads < 1)
+		nthreads = 1;
+	s->nthreads = nthreads;
+
+	if ((s->chunks = calloc(nthreads, sizeof(struct dbscan_chunk)))
+	    == NULL)
+		return (-1);
+
+	return (0);
+}
+
+/*
+ * Return the next downtime period in dt, parsing the records which
+ * depend on the earlier ones with p. The parser is left in the state
+ * it would have after parsing all of the records read so far, so that
+ * downtimedb_parse_end() can be called with it at the end. Return 1 if
+ * a period was found, 0 at the end of the records and -1 on error with
+ * errno set.
+ */
+
+int
+dbscan_next(struct dbscan *s, struct downtimedb_parser *p,
+    struct downtime *dt)
+{
+	struct dbscan_chunk *c;
+
+	for (;;) {
+		if (s->cur == s->nchunks) {
+			if (s->next >= s->end)
+				return (0);
+			if (readwindow(s) < 0)
+				return (-1);
+		}
+		c = &s->chunks[s->cur];
+
+		while (c->headpos < c->nhead)
+			if (downtimedb_parse(p, &c->head[c->headpos++], dt))
+				return (1);
+
+		if (c->dtpos < c->ndt) {
+			*dt = c->dt[c->dtpos++];
+			return (1);
+		}
+
+		if (c->hasdown)
+			*p = c->state;
+		s->cur++;
+	}
+}
+
+/* Free the memory held for reading */
+
+void
+dbscan_close(struct dbscan *s)
+{
+	int i;
+
+	for (i = 0; i < s->nthreads && s->chunks != NULL; i++) {
+		free(s->chunks[i].head);
+		free(s->chunks[i].dt);
+	}
+	free(s->chunks);
+	s->chunks = NULL;
+}
+
+/* Read and decode the next window of chunks in parallel */
+
+static int
+readwindow(struct dbscan *s)
+{
+	struct work w;
+	struct dbscan_chunk *c;
+	size_t i;
+#ifdef HAVE_PTHREAD
+	pthread_t *tids = NULL;
+	int nt = 0;
+#endif
+
+	for (i = 0; i < (size_t)s->nthreads && s->next < s->end; i++) {
+		c = &s->chunks[i];
+		c->start = s->next;
+		c->end = c->start + DBSCAN_CHUNK;
+		if (c->end > s->end)
+			c->end = s->end;
+		s->next = c->end;
+	}
+	s->nchunks = i;
+	s->cur = 0;
+
+	memset(&w, 0, sizeof(w));
+	w.scan = s;
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_init(&w.lock, NULL);
+	if (s->nchunks > 1 &&
+	    (tids = calloc(s->nchunks - 1, sizeof(pthread_t))) != NULL) {
+		/* if a thread can not be started, the others do its share */
+		for (nt = 0; nt < (int)s->nchunks - 1; nt++)
+			if (pthread_create(&tids[nt], NULL, worker, &w) != 0)
+				break;
+	}
+	worker(&w);
+	while (nt > 0)
+		pthread_join(tids[--nt], NULL);
+	free(tids);
+	pthread_mutex_destroy(&w.lock);
+#else
+	worker(&w);
+#endif
+
+	for (i = 0; i < s->nchunks; i++)
+		if (s->chunks[i].error != 0) {
+			errno = s->chunks[i].error;
+			return (-1);
+		}
+
+	return (0);
+}
+
+/* Decode chunks until there are none left */
+
+static void *
+worker(void *arg)
+{
+	struct work *w = arg;
+	size_t i;
+
+	for (;;) {
+#ifdef HAVE_PTHREAD
+		pthread_mutex_lock(&w->lock);
+#endif
+		i = w->next++;
+#ifdef HAVE_PTHREAD
+		pthread_mutex_unlock(&w->lock);
+#endif
+		if (i >= w->scan->nchunks)
+			break;
+		scanchunk(w->scan, &w->scan->chunks[i]);
+	}
+
+	return (NULL);
+}
+
+/*
+ * Decode the records of one chunk. The records up to the first down
+ * record are kept for dbscan_next(), as whether the down record ends
+ * a period depends on the earlier chunks too; the rest are parsed
+ * starting from the state set by the first down record.
+ */
+
+static void
+scanchunk(struct dbscan *s, struct dbscan_chunk *c)
+{
+	struct downtimedb ent;
+	struct downtime dummy;
+	unsigned char *buf;
+	off_t idx, n;
+	ssize_t len;
+	size_t j;
+
+	c->nhead = c->headpos = c->ndt = c->dtpos = 0;
+	c->hasdown = 0;
+	c->error = 0;
+
+	/* the buffers are kept for the following windows */
+	if ((c->head == NULL && (c->head = malloc(DBSCAN_CHUNK *
+	    sizeof(struct downtimedb))) == NULL) ||
+	    (c->dt == NULL && (c->dt = malloc(DBSCAN_CHUNK *
+	    sizeof(struct downtime))) == NULL)) {
+		c->error = errno;
+		return;
+	}
+
+	if ((buf = malloc(SCANRECS * RECSIZE)) == NULL) {
+		c->error = errno;
+		return;
+	}
+
+	for (idx = c->start; idx < c->end; idx += n) {
+		n = c->end - idx;
+		if (n > SCANRECS)
+			n = SCANRECS;
+		if ((len = pread(s->fd, buf, n * RECSIZE, idx * RECSIZE)) < 0) {
+			c->error = errno;
+			break;
+		}
+		if (len != n * RECSIZE) {
+			/* the file was truncated while reading it */
+			c->error = EIO;
+			break;
+		}
+
+		for (j = 0; j < n; j++) {
+			downtimedb_decode(buf + j * RECSIZE, &ent);
+			if (c->hasdown) {
+				if (downtimedb_parse(&c->state, &ent,
+				    &c->dt[c->ndt]))
+					c->ndt++;
+			} else {
+				c->head[c->nhead++] = ent;
+				if (!ISDOWN(ent.what))
+					continue;
+				downtimedb_parse_init(&c->state, s->tadjust);
+				downtimedb_parse(&c->state, &ent, &dummy);
+				c->hasdown = 1;
+			}
+		}
+	}
+
+	free(buf);
+}
+
+/* eof */
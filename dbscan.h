@@ -0,0 +1,67 @@
+/*-
+ * Copyright (c) 2009-2016 Janne Snabb. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *
+ * Software web site:
+ *   https://dist.epipe.com/downtimed/
+ *
+ */
+
+/*
+ * Parallel reading of a downtime database. The records are split into
+ * chunks of DBSCAN_CHUNK records which are decoded and paired into
+ * downtime periods by worker threads, a window of one chunk per thread
+ * at a time. A chunk is parsed on its own after its first down record,
+ * since a down record sets all of the parser state. The records up to
+ * and including it depend on the state left by the earlier chunks;
+ * they are kept as they are and fed to the caller's parser when the
+ * chunks are stitched together in order, so the periods come out
+ * exactly as if the file had been parsed record by record.
+ */
+
+#define	DBSCAN_CHUNK	16384		/* records per chunk */
+
+struct dbscan_chunk;
+
+/* State of reading a database */
+
+struct dbscan {
+	int		 fd;
+	off_t		 next;		/* next record to read */
+	off_t		 end;		/* one past the last record */
+	int		 nthreads;
+	int64_t		 tadjust;	/* crash time adjustment */
+	struct dbscan_chunk *chunks;	/* the window, nthreads chunks */
+	size_t		 nchunks;	/* number of chunks read */
+	size_t		 cur;		/* chunk being stitched */
+};
+
+/* Function prototypes */
+
+int	dbscan_open(struct dbscan *, int, off_t, off_t, int, int64_t);
+int	dbscan_next(struct dbscan *, struct downtimedb_parser *,
+	    struct downtime *);
+void	dbscan_close(struct dbscan *);
+
+/* eof */
@@ -61,6 +61,10 @@
 /* Standard includes that we need */
 
 #include <sys/file.h>
+#ifdef HAVE_SYS_PRCTL_H
+#include <sys/prctl.h>
+#endif
+#include <sys/socket.h>
 #include <sys/stat.h>
 #ifdef HAVE_SYS_PARAM_H
 #include <sys/param.h>
@@ -70,6 +74,8 @@
 #endif
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 
 #include <err.h>
 #include <errno.h>
@@ -80,6 +86,7 @@
 #endif
 #include <signal.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -92,6 +99,14 @@
 #include <syslog.h>
 
 #include "downtimedb.h"
+#include "ckpt.h"
+#include "hbtable.h"
+#include "metrics.h"
+#include "pressure.h"
+#include "push.h"
+#include "sim.h"
+#include "status.h"
+#include "wheel.h"
 
 /* Some global defines */
 
@@ -124,12 +139,69 @@
 
 /* Function prototypes */
 
+struct target;
+
 int		main(int, char *[]);
 static time_t	getboottime(void);
-static void	updatedowntimedb(time_t, int, time_t);
-static void	report(void);
+static void	readtargets(const char *);
+static void	addtarget(const char *, long, const char *);
+static int	targetboot(struct target *);
+static int	targetup(struct target *);
+static void	updatedowntimedb(struct target *, time_t, int, time_t,
+		    uint32_t, uint32_t);
+static void	appenddowntimedb(struct target *, const struct downtimedb *,
+		    int);
+static void	checkstall(int64_t);
+static int64_t	suspendtime(void);
+static void	checksuspend(void);
+static void	readstamps(struct target *);
+static void	report(struct target *);
+static void	pressureinit(void);
+static void	pressurereport(const struct target *);
+static void	pressureline(const struct target *, const char *,
+		    const double *, uint16_t);
+static time_t	tally(struct ckpt_state *, const struct downtimedb *);
+static void	metricsinit(void);
+static void	metricstotals(struct target *);
+static void	metricsupdate(int64_t);
+static void	metricspublish(void);
+static int	firststamps(void);
+static void	pushinit(void);
+static void	pushflush(int64_t);
+static void	pushreap(int64_t);
+static void	pushretry(int64_t);
+static void	statusinit(void);
+static void	statusupdate(uint32_t, int);
+static int64_t	realtime(void);
+static time_t	walltime(void);
+static int64_t	monotime(void);
+static void	sleepuntil(int64_t);
+static void	simulate(const char *);
+static void	simsleep(int64_t);
+static void	simtorn(void);
+static void	lowwakeinit(void);
+static int64_t	nexttick(int64_t, long);
+static double	wakeuprate(void);
+static void	phase(const char *);
+static void	logphases(void);
 static void	sighandler(int);
-static void	touch(const char *, time_t);
+static void	linger(void);
+static int	restarted(void);
+static int	touch(const char *, time_t, int);
+static int	stamp(struct target *, int, time_t, int);
+static int	syncdue(int64_t);
+static long	syncwindow(void);
+static int	syncfile(int, int);
+static long	crashbound(const struct target *);
+static void	hbinit(void);
+#ifdef HAVE_FUTIMES
+static int	stampopen(const char *, time_t);
+static int	stampsync(struct target **, int);
+static int	devcmp(const void *, const void *);
+#endif
+static int	tick(struct target **, int);
+static void	notifyinit(void);
+static void	notify(const char *);
 static void	loginit(void);
 static void	logdeinit(void);
 static void	logwr(int, const char *, ...);
@@ -154,8 +226,20 @@ static long	cf_sleep = 15;        /* update time stamp every 15 seconds */
 static int	cf_fsync = 1;  /* set to fsync() stamp files after touching */
 #endif
 static int	cf_downtimedb = 1;            /* if true, update downtimedb */
-static char *	cf_downtimedbfile = PATH_DOWNTIMEDBFILE;
+static char *	cf_targets = NULL;     /* file listing data directories */
+static char *	cf_hbtable = NULL;   /* shared heartbeat table instead of stamps */
+static long	cf_hbslot = -1;          /* our slot in the heartbeat table */
 static char *	cf_timefmt = FMT_DATETIME;
+static long	cf_stall = 60;    /* record stalls longer than 60 seconds */
+static char *	cf_metrics = NULL;       /* metrics file to publish, if any */
+static long	cf_metricsint = 60;   /* publish metrics every 60 seconds */
+static char *	cf_status = NULL;  /* shared memory status page, if any */
+static long	cf_slack = -1;  /* timer slack in ms, -1 unless low-wakeup */
+static long	cf_window = 0;  /* seconds a run-time stamp may go unsynced,
+				   -1 to adapt to fsync latency */
+static char *	cf_push = NULL;    /* collector to push new records to */
+static long	cf_linger = 0;  /* seconds to go on stamping after a signal */
+static char *	cf_simulate = NULL;  /* scenario to replay, for testing */
 
 /* Logging destination, determined from cf_log */
 
@@ -164,16 +248,204 @@ static int	cf_logfd	= -1;
 
 /* Global variables */
 
-static char *	ts_stamp	= NULL;
-static char *	ts_shutdown	= NULL;
-static char *	ts_boot		= NULL;
 static time_t	boottime	= 0;
 static time_t	starttime	= 0;
 
+/*
+ * A monitored data directory. Normally there is just one, given with
+ * -d, but with -T a single daemon can look after many of them, for
+ * example one for each container on the host.
+ */
+
+struct target {
+	char *		datadir;
+	char *		prefix;		/* for log messages, "" if one */
+	long		sleep;		/* seconds between time stamps */
+	char *		bootsrc;	/* file giving boot time or NULL */
+	time_t		boottime;
+	int		up;		/* boot time source exists */
+	char *		ts_stamp;
+	char *		ts_shutdown;
+	char *		ts_boot;
+	char *		ts_pressure;
+	char *		dbfile;
+	time_t		started;	/* when readstamps() was called */
+	int64_t		startmono;	/* the same in monotime() */
+	int64_t		stamped;	/* monotime() when stamps were on disk */
+
+	/* time stamps left by the previous run, see readstamps() */
+	time_t		t_stamp, t_shutdown, t_oldboot;
+	int		have_stamp, have_shutdown, have_oldboot;
+
+	struct wheel_entry we;		/* next tick */
+	int		fd;		/* stamp waiting for fsync */
+	dev_t		dev;		/* file system of the stamp */
+	int64_t		synced;		/* monotime() of the last fsync */
+
+	/* downtime totals and metric fields if cf_metrics is set */
+	struct ckpt_state totals;
+	time_t		lastdown;	/* length of the latest downtime */
+	long		mf[5];		/* see MF_BOOT etc. */
+
+	/* ring of pressure samples, see pressureinit() */
+	int		pfd;
+	uint32_t	pseq;		/* number of the next sample */
+
+	/* records waiting to be pushed if cf_push is set */
+	char *		spool;
+	char *		pushname;	/* name given to the collector */
+};
+
+static struct target *	targets		= NULL;
+static int		ntargets	= 0;
+static struct wheel	wheel;
+
+/* Time stamps of a target, see stamp() */
+
+#define	STAMP_RUN	0
+#define	STAMP_SHUTDOWN	1
+#define	STAMP_BOOT	2
+
+/* The heartbeat table holding the time stamps if cf_hbtable is set */
+
+static int		hb_fd		= -1;
+static struct hbslot	hb_slot;
+static int64_t		hb_synced	= 0;	/* monotime() of last fsync */
+
+/*
+ * With -W auto the run-time stamp is synced so that fsync() takes about
+ * 1/SYNC_BUDGET of the time, but at least every SYNC_MAXWINDOW seconds.
+ */
+
+#define	SYNC_BUDGET	100
+#define	SYNC_MAXWINDOW	60
+
+static int64_t		synctime	= 0;	/* average fsync() time, us */
+
+/* targets due on a tick and their stamps to be synced, see tick() */
+
+static struct target **	due		= NULL;
+static struct target **	syncq		= NULL;
+
+/* Startup phase timing in microseconds, see phase() */
+
+#define	MAXPHASES	8
+
+static struct {
+	const char	*name;
+	int64_t		 usec;
+} phases[MAXPHASES];
+static int	nphases		= 0;
+static int64_t	phasemark	= 0;
+static int64_t	startmark	= 0;
+
+static int64_t	suspended	= -1;	/* suspendtime() at previous tick */
+
+/*
+ * In low-wakeup mode the ticks fall on multiples of the sleep time on
+ * the wall clock, which are tickphase microseconds past a second of
+ * monotime(), see nexttick().
+ */
+
+static int64_t	tickphase	= 0;
+static uint64_t	wakeups		= 0;	/* times the main loop woke up */
+
+/* Metrics published to cf_metrics, see metricsinit() */
+
+#define	METRICS_TAILRECS	64	/* records read for the last downtime */
+
+#define	MF_BOOT		0	/* metric fields of a target */
+#define	MF_UPTIME	1
+#define	MF_LASTDOWN	2
+#define	MF_CRASHES	3
+#define	MF_SHUTDOWNS	4
+
+static struct metrics	metrics;
+static struct wheel_entry metrics_we;	/* next time to publish */
+static long		mf_latency	= -1;
+static long		mf_wakeups	= -1;
+
+/*
+ * Records are pushed to cf_push shortly after they are added to the
+ * spool. If the collector can not be reached, pushing is retried after
+ * a delay doubling from PUSH_MINDELAY up to PUSH_MAXDELAY seconds.
+ *
+ * Talking to the collector may take several PUSH_TIMEOUTs per target,
+ * so it is done by a child process while we go on updating the time
+ * stamps. The child reports through a pipe what the collector took,
+ * and we remove that from the spools, as we are the one appending to
+ * them. A child taking longer than PUSH_MAXTIME seconds is killed.
+ */
+
+#define	PUSH_MINDELAY	5
+#define	PUSH_MAXDELAY	3600
+#define	PUSH_MAXTIME	300
+
+struct pushresult {
+	off_t		acked;		/* records the collector took */
+	int		left;		/* as returned by push_send() */
+	int		error;		/* errno if left is -1 */
+};
+
+static struct wheel_entry push_we;	/* next time to push */
+static int		push_scheduled	= 0;
+static int		push_wanted	= 0;	/* records added to spool */
+static long		push_delay	= PUSH_MINDELAY;
+static pid_t		push_pid	= 0;	/* child pushing records */
+static int		push_fd		= -1;	/* results from the child */
+static int64_t		push_started;
+
+/*
+ * Pressure samples taken on each tick if there is something to sample,
+ * see pressureinit(). After a crash, the samples of the last
+ * PRESSURE_WINDOW seconds are summarised and pressure above
+ * PRESSURE_HIGH percent is pointed out.
+ */
+
+#define	PRESSURE_WINDOW	300
+#define	PRESSURE_HIGH	20
+
+static struct pressure_sources psrc;
+static int		psrc_n		= 0;	/* source files open */
+
+/*
+ * The virtual clock used instead of the system clocks while replaying
+ * the scenario cf_simulate, see simulate(). It moves only when we
+ * sleep. SIM_EPOCH is the time of a first boot given no time.
+ */
+
+#define	SIM_EPOCH	1500000000
+
+static struct sim_scenario sim;
+static size_t		sim_pc		= 0;	/* next event to replay */
+static int64_t		sim_real	= 0;	/* realtime() */
+static int64_t		sim_mono	= 0;	/* monotime() */
+static int64_t		sim_suspended	= 0;	/* suspendtime() */
+static int64_t		sim_end		= 0;	/* end of the event */
+static int		sim_poweroff	= 0;	/* the system is off then */
+static time_t		sim_boot	= 0;	/* getboottime() */
+
+/* Seconds between shutdown stamp updates while lingering, see linger() */
+
+#define	LINGER_TICK	1
+
+/* Status page for local readers if cf_status is set, see statusinit() */
+
+static struct status_page *status_page	= NULL;
+static struct status	status;
+
+/* Service manager notification socket, see notifyinit() */
+
+static int		notify_fd	= -1;
+static struct sockaddr_un notify_addr;
+static socklen_t	notify_addrlen	= 0;
+static long		notify_watchdog	= 0;	/* watchdog interval, s */
+
 /* The following are set by the signal handler */
 
-static volatile sig_atomic_t	exiting	  = 0;
+static volatile sig_atomic_t	exiting	  = 0;	/* 2 after a second signal */
 static volatile sig_atomic_t	reopenlog = 0;
+static volatile time_t		exittime  = 0;	/* when the signal arrived */
 
 /*
  * downtimed: system downtime monitoring and reporting daemon.
@@ -189,10 +461,14 @@ static volatile sig_atomic_t	reopenlog = 0;
 int
 main(int argc, char *argv[])
 {
-	struct stat sb;
+	struct wheel_entry *e;
+	struct target *t;
 	time_t uptime;
+	int64_t now, next;
+	int i, n, ret, ready, publish, push;
 
 	/* record daemon startup time for later use */
+	startmark = phasemark = monotime();
 	starttime = time((time_t *)NULL);
 
 	/* parse command line arguments */
@@ -207,21 +483,34 @@ main(int argc, char *argv[])
 	/* find out system boot time */
 	boottime = getboottime();
 
-	/* check if datadir exists */
-	if (stat(cf_datadir, &sb) < 0 || !S_ISDIR(sb.st_mode)) {
-		logwr(LOG_CRIT, "data directory %s does not exist", cf_datadir);
-		errx(EX_CANTCREAT, "data directory %s does not exist",
-		    cf_datadir);
-	}
+	/* find out if we are run by systemd(1) with Type=notify */
+	notifyinit();
 
-	/* set time stamp file names */
-	if (asprintf(&ts_stamp, "%s/downtimed.stamp", cf_datadir) < 0 ||
-	    asprintf(&ts_shutdown, "%s/downtimed.shutdown", cf_datadir) < 0
-	    || asprintf(&ts_boot, "%s/downtimed.boot", cf_datadir) < 0) {
-		logwr(LOG_CRIT, "asprintf failed, out of memory?");
-		errx(EX_OSERR, "asprintf failed, out of memory?");
+	/* set the timer slack if in low-wakeup mode */
+	lowwakeinit();
+
+	/* set up the data directories to monitor */
+	if (cf_targets != NULL)
+		readtargets(cf_targets);
+	else
+		addtarget(cf_datadir, cf_sleep, NULL);
+
+	/* replay a scenario instead, each boot returning in a child */
+	if (cf_simulate != NULL)
+		simulate(cf_simulate);
+
+	/* open the heartbeat table and claim our slot */
+	if (cf_hbtable != NULL)
+		hbinit();
+
+	if ((due = calloc(ntargets, sizeof(struct target *))) == NULL ||
+	    (syncq = calloc(ntargets, sizeof(struct target *))) == NULL) {
+		logwr(LOG_CRIT, "calloc failed, out of memory?");
+		errx(EX_OSERR, "calloc failed, out of memory?");
 	}
 
+	phase("init");
+
 	if (cf_fork) {
 		/* run as daemon (fork and detach from controlling tty) */
 		if (daemon(0, 0) < 0) {
@@ -236,42 +525,191 @@ main(int argc, char *argv[])
 		exit(EX_UNAVAILABLE);
 	}
 
-	/* check & log startup status */
-	report();
+	statusinit();
+
+	phase("pidfile");
 
 	/* set up the signal handlers */
 	signal(SIGHUP, sighandler);
 	signal(SIGINT, sighandler);
 	signal(SIGTERM, sighandler);
+	signal(SIGPIPE, SIG_IGN);
+
+	/*
+	 * The system boot is waiting for us to get going, so do only what
+	 * is needed to get the first time stamp on the disk: pick up the
+	 * time stamps of the previous run before they get overwritten,
+	 * then touch system boot time and the run-time stamp. Reporting
+	 * and updating the downtime database are done only after that.
+	 */
+	for (i = 0; i < ntargets; i++)
+		if (targetboot(&targets[i]))
+			readstamps(&targets[i]);
+	phase("stamps");
+
+	ready = firststamps() == 0;
+	phase("heartbeat");
+
+	/*
+	 * The boot may proceed once the first time stamps are safely on
+	 * the disk. If they are not, they are tried again on each tick;
+	 * meanwhile the start timeout of the service manager catches a
+	 * storage which does not recover.
+	 */
+	if (ready) {
+		statusupdate(STATUS_RUNNING, 1);
+		notify("READY=1");
+	} else
+		notify("STATUS=Can not store the time stamps, retrying");
+	checksuspend();
+
+	/* check & log startup status */
+	for (i = 0; i < ntargets; i++)
+		if (targets[i].up)
+			report(&targets[i]);
+	phase("report");
 
-	/* touch system boot time */
-	touch(ts_boot, boottime);
+	pressureinit();
+
+	logphases();
+
+	if (cf_metrics != NULL) {
+		metricsinit();
+		metricsupdate(0);
+		metricspublish();
+	}
+
+	/* schedule the first tick of each target */
+	now = monotime();
+	wheel_init(&wheel, now / 1000000);
+	for (i = 0; i < ntargets; i++) {
+		targets[i].we.data = &targets[i];
+		wheel_add(&wheel, &targets[i].we,
+		    nexttick(now, targets[i].sleep));
+	}
+	if (cf_metrics != NULL)
+		wheel_add(&wheel, &metrics_we, nexttick(now, cf_metricsint));
+	if (cf_push != NULL)
+		pushinit();
 
 	/*
 	 * main loop: run until we receive a signal or system dies,
-         * touching the time stamp file regularly
+	 * touching the time stamp files of the targets as they fall due
 	 */
-	while (exiting == 0) {
-		touch(ts_stamp, 0);
-		sleep(cf_sleep);
+	for (;;) {
+		next = wheel_next(&wheel) * 1000000 + tickphase;
+		sleepuntil(next);
+		wakeups++;
 
 		if (reopenlog) {
 			reopenlog = 0;
 			logdeinit();
 			loginit();
 		}
+
+		if (exiting)
+			break;
+
+		/* the sleep may have been interrupted by a signal */
+		if ((now = monotime()) < next)
+			continue;
+
+		checksuspend();
+		checkstall(now - next);
+		if (cf_metrics != NULL)
+			metricsupdate(now - next);
+
+		/* collect the due targets before rescheduling any of them */
+		publish = push = 0;
+		for (n = 0, e = wheel_expire(&wheel, now / 1000000);
+		    e != NULL; e = e->next) {
+			if (e == &metrics_we)
+				publish = 1;
+			else if (e == &push_we)
+				push = 1;
+			else
+				due[n++] = e->data;
+		}
+
+		ret = n > 0 ? tick(due, n) : 0;
+
+		for (i = 0; i < n; i++)
+			wheel_add(&wheel, &due[i]->we,
+			    nexttick(now, due[i]->sleep));
+
+		if (publish) {
+			metricspublish();
+			wheel_add(&wheel, &metrics_we,
+			    nexttick(now, cf_metricsint));
+		}
+
+		/* push after the time stamps are safely on the disk */
+		if (push)
+			pushflush(now);
+		if (push_pid > 0)
+			pushreap(now);
+		if (push_wanted && !push_scheduled && push_pid == 0) {
+			wheel_add(&wheel, &push_we, now / 1000000 + 1);
+			push_scheduled = 1;
+		}
+
+		/* the first time stamps failed at startup, try them again */
+		if (!ready && n > 0 && ret == 0 && firststamps() == 0) {
+			logwr(LOG_INFO, "time stamps stored, ready");
+			notify("READY=1");
+			ready = 1;
+		}
+
+		/*
+		 * Keep the service manager watchdog happy only as long
+		 * as we manage to update the time stamps. If the storage
+		 * stalls or fails, the service manager will notice.
+		 * Wakeups for the metrics or the push alone do not count,
+		 * or they would hide a failed stamp; the stamps are due
+		 * at least once per watchdog interval, see addtarget().
+		 */
+		if (ready && n > 0 && ret == 0) {
+			if (notify_watchdog > 0)
+				notify("WATCHDOG=1");
+			statusupdate(STATUS_RUNNING, 1);
+		}
 	}
 
+	/* records sent but not yet removed are pushed again next time */
+	if (push_pid > 0)
+		kill(push_pid, SIGTERM);
+
+	notify("STOPPING=1");
+
+	logwr(LOG_INFO, "woke up %llu times, %.1f times per hour",
+	    (unsigned long long)wakeups, wakeuprate());
+
 	/*
-	 * Record normal shutdown. If using syslog for logging, this
-	 * might fail because syslogd may have exited already.
+	 * Record normal shutdown: the run-time stamp gets the time the
+	 * signal arrived and the shutdown stamp the time we were last
+	 * seen running, which linger() keeps moving if cf_linger is set.
+	 * If using syslog for logging, this might fail because syslogd
+	 * may have exited already.
 	 */
-	uptime = time((time_t *)NULL) - boottime;
-	logwr(LOG_NOTICE, "shutting down, uptime %s (%d seconds)",
-	    timestr_int(uptime), uptime);
+	if (exittime == 0)
+		exittime = walltime();
+	for (i = 0; i < ntargets; i++) {
+		t = &targets[i];
+		if (!t->up)
+			continue;
+
+		uptime = walltime() - t->boottime;
+		logwr(LOG_NOTICE, "%sshutting down, uptime %s (%d seconds)",
+		    t->prefix, timestr_int(uptime), uptime);
+
+		stamp(t, STAMP_RUN, exittime, 1);
+		stamp(t, STAMP_SHUTDOWN, 0, 1);
+	}
+
+	if (cf_linger > 0)
+		linger();
 
-	touch(ts_stamp, 0);
-	touch(ts_shutdown, 0);
+	statusupdate(STATUS_STOPPED, 0);
 
 	/* We could write the downtime database shutdown record here
 	 * in case of graceful shutdown, but we have chosen to update
@@ -289,6 +727,8 @@ main(int argc, char *argv[])
 static time_t
 getboottime()
 {
+	if (cf_simulate != NULL)
+		return (sim_boot);
 #if defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__) \
     || defined(__DragonFly__) || defined(__APPLE__) \
     || defined(__FreeBSD_kernel__)
@@ -358,205 +798,2064 @@ getboottime()
 	return (starttime);	/* give up */
 }
 
-/* Update downtime database */
+/*
+ * Read the list of data directories to monitor. Each line gives a data
+ * directory, optionally followed by the sleep time and the file whose
+ * modification time is the boot time of the target. A "-" stands for
+ * the default. Everything after a # is a comment.
+ */
 
-void
-updatedowntimedb(time_t up, int crashed, time_t down)
+static void
+readtargets(const char *fn)
 {
-	struct downtimedb dbent;
-	int fd;
+	char str[1024], *datadir, *sleep, *boot, *p;
+	FILE *fp;
+	long sl;
+	int line = 0;
 
-	if ((fd = open(cf_downtimedbfile, O_WRONLY | O_CREAT | O_APPEND,
-	    DEFFILEMODE)) < 0) {
-		logwr(LOG_ERR, "can not open %s: %s", cf_downtimedbfile,
-		    strerror(errno));
-		return;
+	if ((fp = fopen(fn, "r")) == NULL) {
+		logwr(LOG_CRIT, "can not open %s: %s", fn, strerror(errno));
+		err(EX_NOINPUT, "can not open %s", fn);
 	}
 
-	/* ensure that padding bytes are zero */
-	memset(&dbent, 0, sizeof(struct downtimedb));
+	while (fgets(str, sizeof(str), fp) != NULL) {
+		line++;
+		if ((p = strchr(str, '#')) != NULL)
+			*p = '\0';
 
-	dbent.what = crashed ?
-	    DOWNTIMEDB_WHAT_CRASH : DOWNTIMEDB_WHAT_SHUTDOWN;
-	dbent.when = (uint64_t) down;
+		if ((datadir = strtok(str, " \t\n")) == NULL)
+			continue;
+		sleep = strtok(NULL, " \t\n");
+		boot = strtok(NULL, " \t\n");
 
-	if (downtimedb_write(fd, &dbent) < 0)
-		logwr(LOG_ERR, "can not write to %s: %s", cf_downtimedbfile,
-		    strerror(errno));
+		sl = cf_sleep;
+		if (sleep != NULL && strcmp(sleep, "-") != 0) {
+			p = NULL;
+			errno = 0;
+			sl = strtol(sleep, &p, 10);
+			if ((p != NULL && *p != '\0') || errno != 0 ||
+			    sl <= 0) {
+				logwr(LOG_CRIT, "%s:%d: invalid sleep %s", fn,
+				    line, sleep);
+				errx(EX_CONFIG, "%s:%d: invalid sleep %s", fn,
+				    line, sleep);
+			}
+		}
 
-	/* not really needed, but ensure again that padding bytes are zero */
-	memset(&dbent, 0, sizeof(struct downtimedb));
+		if (boot != NULL && strcmp(boot, "-") == 0)
+			boot = NULL;
 
-	dbent.what = DOWNTIMEDB_WHAT_UP;
-	dbent.when = (uint64_t) up;
+		addtarget(datadir, sl, boot);
+	}
 
-	if (downtimedb_write(fd, &dbent) < 0)
-		logwr(LOG_ERR, "can not write to %s: %s", cf_downtimedbfile,
-		    strerror(errno));
+	fclose(fp);
 
-	close(fd);
+	if (ntargets == 0) {
+		logwr(LOG_CRIT, "no data directories in %s", fn);
+		errx(EX_CONFIG, "no data directories in %s", fn);
+	}
 }
 
-/* Report the downtime and shutdown reason when starting up */
+/* Add a data directory to monitor */
 
 static void
-report()
+addtarget(const char *datadir, long sleep, const char *bootsrc)
 {
-	struct stat sb_stamp, sb_shutdown, sb_oldboot;
-	int have_stamp = 0, have_shutdown = 0, have_oldboot = 0;
-	time_t olduptime, downtime;
-
-	if (stat(ts_stamp, &sb_stamp) == 0)
-		have_stamp = 1;
-
-	if (stat(ts_shutdown, &sb_shutdown) == 0)
-		have_shutdown = 1;
-
-	if (stat(ts_boot, &sb_oldboot) == 0)
-		have_oldboot = 1;
+	struct target *t;
+	struct stat sb;
 
-	if (!have_stamp && !have_shutdown && !have_oldboot) {
-		logwr(LOG_NOTICE, "starting up first time, "
-		    "no knowledge of downtime");
-		return;
+	/* check if datadir exists */
+	if (stat(datadir, &sb) < 0 || !S_ISDIR(sb.st_mode)) {
+		logwr(LOG_CRIT, "data directory %s does not exist", datadir);
+		errx(EX_CANTCREAT, "data directory %s does not exist",
+		    datadir);
 	}
-	if (!have_stamp) {
-		logwr(LOG_ERR, "no old run-time stamp (%s)", ts_stamp);
-		return;
+
+	if ((targets = realloc(targets,
+	    (ntargets + 1) * sizeof(struct target))) == NULL) {
+		logwr(LOG_CRIT, "realloc failed, out of memory?");
+		errx(EX_OSERR, "realloc failed, out of memory?");
 	}
-	if (!have_oldboot) {
-		logwr(LOG_ERR, "no old boot-time stamp (%s)", ts_boot);
-		return;
+	t = &targets[ntargets++];
+	memset(t, 0, sizeof(struct target));
+
+	/* set time stamp file names */
+	if ((t->datadir = strdup(datadir)) == NULL ||
+	    (bootsrc != NULL && (t->bootsrc = strdup(bootsrc)) == NULL) ||
+	    asprintf(&t->prefix, "%s: ", datadir) < 0 ||
+	    asprintf(&t->ts_stamp, "%s/downtimed.stamp", datadir) < 0 ||
+	    asprintf(&t->ts_shutdown, "%s/downtimed.shutdown", datadir) < 0
+	    || asprintf(&t->ts_boot, "%s/downtimed.boot", datadir) < 0 ||
+	    asprintf(&t->ts_pressure, "%s/downtimed.pressure", datadir) < 0 ||
+	    asprintf(&t->dbfile, "%s/downtimedb", datadir) < 0 ||
+	    asprintf(&t->spool, "%s/downtimed.spool", datadir) < 0) {
+		logwr(LOG_CRIT, "asprintf failed, out of memory?");
+		errx(EX_OSERR, "asprintf failed, out of memory?");
 	}
-	if (have_stamp && have_shutdown &&
-	    sb_shutdown.st_mtime < sb_stamp.st_mtime)
-		have_shutdown = 0;
 
-	olduptime =
-	    (have_shutdown ? sb_shutdown.st_mtime : sb_stamp.st_mtime) -
-	    sb_oldboot.st_mtime;
+	/* with a single target the messages are as they always were */
+	if (cf_targets == NULL)
+		t->prefix[0] = '\0';
 
-	downtime = boottime -
-	    (have_shutdown ? sb_shutdown.st_mtime : sb_stamp.st_mtime);
+	/* the watchdog must be notified often enough */
+	if (notify_watchdog > 0 && sleep > notify_watchdog)
+		sleep = notify_watchdog;
 
-	if (downtime < 0) {
-		/*
-		 * This happens if we quit and re-start the process (we
-		 * normally only exit when system goes down.
-		 */
-		logwr(LOG_NOTICE, "restarted, system was not down");
-		return;
-	}
+	t->sleep = sleep;
+	t->fd = -1;
+	t->pfd = -1;
+}
 
-	logwr(LOG_NOTICE, "started %d seconds after boot",
-	    starttime - boottime);
+/*
+ * Find out the boot time of a target at startup. Return 1 if it is
+ * up. A target whose boot time source file does not exist is down.
+ */
 
-	if (cf_downtimedb)
-		updatedowntimedb(boottime, !have_shutdown,
-		    (have_shutdown ?
-		    sb_shutdown.st_mtime : sb_stamp.st_mtime));
+static int
+targetboot(struct target *t)
+{
+	struct stat sb;
 
-	if (have_shutdown) {
-		logwr(LOG_NOTICE, "system shutdown at %s",
-		    timestr_abs(sb_shutdown.st_mtime, cf_timefmt, 0));
+	if (t->bootsrc == NULL) {
+		t->boottime = boottime;
+		t->up = 1;
+	} else if (stat(t->bootsrc, &sb) == 0) {
+		t->boottime = sb.st_mtime;
+		t->up = 1;
 	} else {
-		logwr(LOG_NOTICE, "system crashed at %s",
-		    timestr_abs(sb_stamp.st_mtime, cf_timefmt, 0));
+		logwr(LOG_NOTICE, "%sboot time source %s does not exist, "
+		    "target is down", t->prefix, t->bootsrc);
+		t->up = 0;
+	}
+
+	return (t->up);
+}
+
+/*
+ * Check the boot time source of a target before touching its time
+ * stamp. Return 1 if the stamp should be touched. While the boot time
+ * source file does not exist, the target is down and its stamp is left
+ * alone. When the file appears or its modification time changes, the
+ * target has started again: its downtime is reported and the stamps
+ * touched right here, the same way as at the startup of the daemon.
+ */
+
+static int
+targetup(struct target *t)
+{
+	struct stat sb;
+
+	if (t->bootsrc == NULL)
+		return (1);
+
+	if (stat(t->bootsrc, &sb) < 0) {
+		if (t->up) {
+			logwr(LOG_NOTICE, "%sboot time source %s is gone, "
+			    "target is down", t->prefix, t->bootsrc);
+			t->up = 0;
+		}
+		return (0);
 	}
 
-	logwr(LOG_NOTICE, "previous uptime was %s (%d seconds)",
-	    timestr_int(olduptime), olduptime);
+	if (t->up && sb.st_mtime == t->boottime)
+		return (1);
 
-	logwr(LOG_NOTICE, "downtime was %s (%d seconds)",
-	    timestr_int(downtime), downtime);
+	t->boottime = sb.st_mtime;
+	t->up = 1;
+
+	readstamps(t);
+	stamp(t, STAMP_BOOT, t->boottime, 1);
+	stamp(t, STAMP_RUN, 0, 1);
+	t->stamped = monotime();
+	report(t);
+
+	return (0);
 }
 
-/* Handle signals */
+/*
+ * Update downtime database. The aux data of the down and up records
+ * tell how long the shutdown and the boot took.
+ */
 
-static void
-sighandler(int signum)
+void
+updatedowntimedb(struct target *t, time_t up, int crashed, time_t down,
+    uint32_t downaux, uint32_t bootaux)
 {
+	struct downtimedb dbent[2];
 
-	if (signum == SIGINT || signum == SIGTERM)
-		exiting = 1;
+	/* ensure that padding bytes are zero */
+	memset(dbent, 0, sizeof(dbent));
 
-	if (signum == SIGHUP)
-		reopenlog = 1;
+	dbent[0].what = crashed ?
+	    DOWNTIMEDB_WHAT_CRASH : DOWNTIMEDB_WHAT_SHUTDOWN;
+	dbent[0].when = (uint64_t) down;
+	dbent[0].aux = downaux;
+
+	dbent[1].what = DOWNTIMEDB_WHAT_UP;
+	dbent[1].when = (uint64_t) up;
+	dbent[1].aux = bootaux;
+
+	appenddowntimedb(t, dbent, 2);
 }
 
-/* Update time-stamp of file */
+/* Append records to the downtime database of a target */
 
 static void
-touch(const char *fn, time_t t)
+appenddowntimedb(struct target *t, const struct downtimedb *dbent, int n)
 {
+	struct downtimedb ent;
 	struct stat sb;
-	struct timeval tv[2];
-	int fd;
+	time_t down;
+	off_t part;
+	int fd, i;
 
-	if (t != 0) {
-		tv[0].tv_sec = t;
-		tv[0].tv_usec = 0;
-		tv[1].tv_sec = t;
-		tv[1].tv_usec = 0;
+	if ((fd = open(t->dbfile, O_WRONLY | O_CREAT | O_APPEND,
+	    DEFFILEMODE)) < 0) {
+		logwr(LOG_ERR, "can not open %s: %s", t->dbfile,
+		    strerror(errno));
+		return;
 	}
 
-#ifdef HAVE_FUTIMES
-	if (cf_fsync) {
-		/* we need to open the file so that we can do fsync() to it */
-		if ((fd = open(fn, O_WRONLY | O_CREAT | O_TRUNC,
-		    DEFFILEMODE)) < 0) {
-			logwr(LOG_ERR, "%s: %s", fn, strerror(errno));
-			return;
-		}
-		if (futimes(fd, t == 0 ? (struct timeval *)NULL : tv) < 0) {
-			logwr(LOG_ERR, "%s: %s", fn, strerror(errno));
-		} else
-			fsync(fd);
+	/*
+	 * A crash while writing may have left a partial record at the
+	 * end. Appending after it would make the rest of the file
+	 * unreadable.
+	 */
+	if (fstat(fd, &sb) == 0 &&
+	    (part = sb.st_size % sizeof(struct downtimedb)) != 0) {
+		logwr(LOG_WARNING, "removing a partial record at the end "
+		    "of %s", t->dbfile);
+		if (ftruncate(fd, sb.st_size - part) < 0)
+			logwr(LOG_ERR, "can not truncate %s: %s", t->dbfile,
+			    strerror(errno));
+	}
 
-		if (close(fd) < 0)
-			logwr(LOG_ERR, "%s: %s", fn, strerror(errno));
-	} else {
-#endif /* HAVE_FUTIMES */
-		/* create the file in case it is missing */
-		if (stat(fn, &sb) < 0) {
-			if ((fd = open(fn, O_WRONLY | O_CREAT | O_TRUNC,
-			    DEFFILEMODE)) < 0) {
-				logwr(LOG_ERR, "%s: %s", fn, strerror(errno));
-				return;
-			}
-			if (close(fd) < 0)
-				logwr(LOG_ERR, "%s: %s", fn, strerror(errno));
-		}
-		if (utimes(fn, t == 0 ? (struct timeval *)NULL : tv) < 0)
-			logwr(LOG_ERR, "%s: %s", fn, strerror(errno));
-#ifdef HAVE_FUTIMES
+	/* downtimedb_write() converts the record in place */
+	for (i = 0; i < n; i++) {
+		ent = dbent[i];
+		if (downtimedb_write(fd, &ent) < 0)
+			logwr(LOG_ERR, "can not write to %s: %s",
+			    t->dbfile, strerror(errno));
 	}
-#endif /* HAVE_FUTIMES */
+
+	close(fd);
+
+	if (cf_metrics != NULL)
+		for (i = 0; i < n; i++)
+			if ((down = tally(&t->totals, &dbent[i])) >= 0)
+				t->lastdown = down;
+
+	if (cf_push != NULL) {
+		if (push_spool(t->spool, dbent, n) < 0)
+			logwr(LOG_ERR, "can not write to %s: %s", t->spool,
+			    strerror(errno));
+		push_wanted = 1;
+	}
+
+	/* keep the window totals used by downtimes(1) up to date */
+	if (ckpt_update(t->dbfile, 0) < 0)
+		logwr(LOG_ERR, "can not update checkpoint of %s: %s",
+		    t->dbfile, strerror(errno));
 }
 
-/* Compatibility for systems without facilitynames in <syslog.h> */
+/*
+ * Check if a tick was late by more than cf_stall seconds. This happens
+ * when the system freezes under load or when a virtual machine is
+ * paused by the hypervisor. The monotonic clock is used, so changes of
+ * the system time do not affect this. The stall is recorded for all
+ * of the targets which are up.
+ */
 
-#ifndef HAVE_SYSLOG_FACILITYNAMES
+static void
+checkstall(int64_t usec)
+{
+	struct downtimedb dbent;
+	time_t stall;
+	int i;
 
-static const struct {
-	const char	*c_name;
-	const int	c_val;
-} facilitynames[] = {
-#ifdef LOG_KERN
-	{ "kern",	LOG_KERN	},
-#endif
-#ifdef LOG_USER
-	{ "user",	LOG_USER	},
-#endif
-#ifdef LOG_MAIL
-	{ "mail",	LOG_MAIL	},
-#endif
-#ifdef LOG_DAEMON
-	{ "daemon",	LOG_DAEMON	},
-#endif
-#ifdef LOG_AUTH
-	{ "auth",	LOG_AUTH	},
-#endif
+	if (cf_stall <= 0)
+		return;
+
+	stall = usec / 1000000;
+	if (stall < cf_stall)
+		return;
+
+	logwr(LOG_WARNING, "system stalled for %s (%ld seconds)",
+	    timestr_int(stall), (long) stall);
+
+	if (!cf_downtimedb)
+		return;
+
+	memset(&dbent, 0, sizeof(struct downtimedb));
+	dbent.what = DOWNTIMEDB_WHAT_STALL;
+	dbent.aux = (uint32_t) stall;
+	dbent.when = (uint64_t) (walltime() - stall);
+
+	for (i = 0; i < ntargets; i++)
+		if (targets[i].up)
+			appenddowntimedb(&targets[i], &dbent, 1);
+}
+
+/*
+ * Return how much longer the system has been running than the
+ * monotonic clock has advanced, in microseconds. On systems where the
+ * monotonic clock stops while the system is suspended, this is the
+ * total time spent suspended since boot. Return -1 if not supported.
+ */
+
+static int64_t
+suspendtime(void)
+{
+#if defined(CLOCK_BOOTTIME) && defined(CLOCK_MONOTONIC)
+	struct timespec tb, tm;
+#endif
+
+	if (cf_simulate != NULL)
+		return (sim_suspended);
+
+#if defined(CLOCK_BOOTTIME) && defined(CLOCK_MONOTONIC)
+	if (clock_gettime(CLOCK_MONOTONIC, &tm) == 0 &&
+	    clock_gettime(CLOCK_BOOTTIME, &tb) == 0)
+		return ((int64_t)(tb.tv_sec - tm.tv_sec) * 1000000 +
+		    (tb.tv_nsec - tm.tv_nsec) / 1000);
+#endif
+
+	return (-1);
+}
+
+/*
+ * Check if the system was suspended since the previous tick. The
+ * daemon keeps running across a suspend, so without this the time
+ * spent suspended would be counted as uptime. The length is exact, but
+ * the resume is noticed only when the sleep ends, so the recorded
+ * times may be late by up to the sleep time.
+ */
+
+static void
+checksuspend(void)
+{
+	struct downtimedb dbent[2];
+	int64_t prev;
+	time_t len, t;
+	int i;
+
+	prev = suspended;
+	if ((suspended = suspendtime()) < 0 || prev < 0)
+		return;
+
+	if ((len = (suspended - prev) / 1000000) < 1)
+		return;
+
+	logwr(LOG_NOTICE, "system was suspended for %s (%ld seconds)",
+	    timestr_int(len), (long) len);
+
+	if (!cf_downtimedb)
+		return;
+
+	t = walltime();
+
+	memset(dbent, 0, sizeof(dbent));
+	dbent[0].what = DOWNTIMEDB_WHAT_SUSPEND;
+	dbent[0].when = (uint64_t) (t - len);
+	dbent[1].what = DOWNTIMEDB_WHAT_RESUME;
+	dbent[1].when = (uint64_t) t;
+
+	for (i = 0; i < ntargets; i++)
+		if (targets[i].up)
+			appenddowntimedb(&targets[i], dbent, 2);
+}
+
+/*
+ * Pick up the time stamps left by the previous run. This must be done
+ * before the time stamps are touched for the first time.
+ */
+
+static void
+readstamps(struct target *t)
+{
+	struct stat sb;
+
+	t->started = walltime();
+	t->startmono = monotime();
+
+	if (hb_fd >= 0) {
+		/* read by hbinit() already, a zero time is not set */
+		t->t_stamp = hb_slot.stamp;
+		t->t_shutdown = hb_slot.shutdown;
+		t->t_oldboot = hb_slot.boot;
+		t->have_stamp = (t->t_stamp != 0);
+		t->have_shutdown = (t->t_shutdown != 0);
+		t->have_oldboot = (t->t_oldboot != 0);
+		return;
+	}
+
+	if ((t->have_stamp = (stat(t->ts_stamp, &sb) == 0)))
+		t->t_stamp = sb.st_mtime;
+	if ((t->have_shutdown = (stat(t->ts_shutdown, &sb) == 0)))
+		t->t_shutdown = sb.st_mtime;
+	if ((t->have_oldboot = (stat(t->ts_boot, &sb) == 0)))
+		t->t_oldboot = sb.st_mtime;
+}
+
+/*
+ * Report the downtime and shutdown reason when starting up, based on
+ * the time stamps picked up by readstamps().
+ */
+
+static void
+report(struct target *t)
+{
+	time_t olduptime, downtime;
+	int64_t start, ms, stop;
+	uint32_t downaux;
+	long bound;
+
+	if (!t->have_stamp && !t->have_shutdown && !t->have_oldboot) {
+		logwr(LOG_NOTICE, "%sstarting up first time, "
+		    "no knowledge of downtime", t->prefix);
+		return;
+	}
+	if (!t->have_stamp) {
+		logwr(LOG_ERR, "%sno old run-time stamp (%s)", t->prefix,
+		    t->ts_stamp);
+		return;
+	}
+	if (!t->have_oldboot) {
+		logwr(LOG_ERR, "%sno old boot-time stamp (%s)", t->prefix,
+		    t->ts_boot);
+		return;
+	}
+	/*
+	 * On shutdown the run-time stamp was left at the time of the
+	 * signal and the shutdown stamp at the time we were last seen. A
+	 * shutdown stamp older than the run-time stamp is left over from
+	 * an earlier run.
+	 */
+	if (t->have_stamp && t->have_shutdown &&
+	    t->t_shutdown < t->t_stamp)
+		t->have_shutdown = 0;
+
+	olduptime = (t->have_shutdown ?
+	    t->t_shutdown : t->t_stamp) -
+	    t->t_oldboot;
+
+	downtime = t->boottime - (t->have_shutdown ?
+	    t->t_shutdown : t->t_stamp);
+
+	if (downtime < 0) {
+		/*
+		 * This happens if we quit and re-start the process (we
+		 * normally only exit when system goes down.
+		 */
+		logwr(LOG_NOTICE, "%srestarted, system was not down",
+		    t->prefix);
+		return;
+	}
+
+	logwr(LOG_NOTICE, "%sstarted %d seconds after boot", t->prefix,
+	    t->started - t->boottime);
+
+	/* keep the boot duration instead of just logging it */
+	start = t->started - t->boottime;
+	ms = (t->stamped - t->startmono) / 1000;
+	if (start < 0)
+		start = 0;
+	if (start > DOWNTIMEDB_BOOT_MAXSTART)
+		start = DOWNTIMEDB_BOOT_MAXSTART;
+	if (ms > DOWNTIMEDB_BOOT_MAXSTAMP)
+		ms = DOWNTIMEDB_BOOT_MAXSTAMP;
+
+	/* and how long it took to shut down */
+	stop = t->have_shutdown ? t->t_shutdown - t->t_stamp : 0;
+	if (stop > DOWNTIMEDB_STOP_MAX)
+		stop = DOWNTIMEDB_STOP_MAX;
+	downaux = t->have_shutdown ?
+	    DOWNTIMEDB_STOP_KNOWN | (uint32_t)stop : 0;
+
+	if (cf_downtimedb)
+		updatedowntimedb(t, t->boottime, !t->have_shutdown,
+		    (t->have_shutdown ?
+		    t->t_shutdown : t->t_stamp), downaux,
+		    DOWNTIMEDB_BOOT_KNOWN |
+		    (uint32_t)start << 16 | (uint32_t)ms);
+
+	if (t->have_shutdown) {
+		logwr(LOG_NOTICE, "%ssystem shutdown at %s", t->prefix,
+		    timestr_abs(t->t_shutdown, cf_timefmt, 0));
+		logwr(LOG_NOTICE, "%sshutdown took %s (%ld seconds) since "
+		    "downtimed was signalled", t->prefix,
+		    timestr_int((time_t)stop), (long)stop);
+	} else {
+		logwr(LOG_NOTICE, "%ssystem crashed at %s", t->prefix,
+		    timestr_abs(t->t_stamp, cf_timefmt, 0));
+		if ((bound = crashbound(t)) >= 0)
+			logwr(LOG_NOTICE, "%scrash time is accurate to %ld "
+			    "seconds", t->prefix, bound);
+		else
+			logwr(LOG_NOTICE, "%scrash time may be more than %ld "
+			    "seconds early, time stamps are not synced",
+			    t->prefix, t->sleep);
+		pressurereport(t);
+	}
+
+	logwr(LOG_NOTICE, "%sprevious uptime was %s (%d seconds)",
+	    t->prefix, timestr_int(olduptime), olduptime);
+
+	logwr(LOG_NOTICE, "%sdowntime was %s (%d seconds)",
+	    t->prefix, timestr_int(downtime), downtime);
+}
+
+/*
+ * Set up the pressure samples. The ring file of each target is kept
+ * open, and numbering goes on from the samples of the previous run,
+ * which report() has read by now, so that the oldest are overwritten
+ * first. A simulation has nothing real to sample.
+ */
+
+static void
+pressureinit()
+{
+	struct pressure_sample s[PRESSURE_SLOTS];
+	struct target *t;
+	int i, n;
+
+	if (cf_simulate != NULL ||
+	    (psrc_n = pressure_open(&psrc)) == 0)
+		return;
+
+	for (i = 0; i < ntargets; i++) {
+		t = &targets[i];
+		if ((t->pfd = open(t->ts_pressure, O_RDWR | O_CREAT,
+		    DEFFILEMODE)) < 0) {
+			logwr(LOG_ERR, "%s: %s", t->ts_pressure,
+			    strerror(errno));
+			continue;
+		}
+		fcntl(t->pfd, F_SETFD, FD_CLOEXEC);
+
+		if ((n = pressure_read(t->pfd, s)) > 0)
+			t->pseq = s[n - 1].seq + 1;
+	}
+
+	/* the steal time is known from the second sample on */
+	pressure_take(&psrc, &s[0]);
+}
+
+/*
+ * Summarise the pressure samples of the last PRESSURE_WINDOW seconds
+ * of the previous run of a target which crashed.
+ */
+
+static void
+pressurereport(const struct target *t)
+{
+	struct pressure_sample s[PRESSURE_SLOTS];
+	double mean[PRESSURE_NVALUES], max[PRESSURE_NVALUES], v;
+	int count[PRESSURE_NVALUES];
+	char high[32];
+	uint16_t valid = 0;
+	int64_t last = 0;
+	int fd, i, j, n, m = 0;
+
+	/* nothing was sampled on this system or by this version */
+	if ((fd = open(t->ts_pressure, O_RDONLY)) < 0)
+		return;
+	n = pressure_read(fd, s);
+	close(fd);
+	if (n < 0) {
+		logwr(LOG_ERR, "%s: %s", t->ts_pressure, strerror(errno));
+		return;
+	}
+
+	/* samples may reach the disk later than the last time stamp */
+	for (i = 0; i < n; i++)
+		if (s[i].when >= t->t_oldboot && s[i].when < t->boottime &&
+		    s[i].when > last)
+			last = s[i].when;
+
+	memset(mean, 0, sizeof(mean));
+	memset(max, 0, sizeof(max));
+	memset(count, 0, sizeof(count));
+	for (i = 0; i < n; i++) {
+		if (s[i].when < t->t_oldboot || s[i].when > last ||
+		    s[i].when <= last - PRESSURE_WINDOW)
+			continue;
+		m++;
+		for (j = 0; j < PRESSURE_NVALUES; j++) {
+			if (!(s[i].valid & (1 << j)))
+				continue;
+			v = s[i].value[j] / 100.0;
+			mean[j] += v;
+			if (v > max[j])
+				max[j] = v;
+			count[j]++;
+		}
+	}
+
+	if (m == 0) {
+		logwr(LOG_NOTICE, "%sno pressure samples before the crash",
+		    t->prefix);
+		return;
+	}
+
+	for (j = 0; j < PRESSURE_NVALUES; j++) {
+		if (count[j] == 0)
+			continue;
+		mean[j] /= count[j];
+		valid |= 1 << j;
+	}
+
+	logwr(LOG_NOTICE, "%s%d pressure samples in the last %d seconds "
+	    "before the crash", t->prefix, m, PRESSURE_WINDOW);
+	pressureline(t, "mean", mean, valid);
+	pressureline(t, "max", max, valid);
+
+	high[0] = '\0';
+	if ((valid & (1 << PRESSURE_CPU)) && max[PRESSURE_CPU] >= PRESSURE_HIGH)
+		strcat(high, " cpu");
+	if ((valid & (1 << PRESSURE_MEM)) && max[PRESSURE_MEM] >= PRESSURE_HIGH)
+		strcat(high, " memory");
+	if ((valid & (1 << PRESSURE_IO)) && max[PRESSURE_IO] >= PRESSURE_HIGH)
+		strcat(high, " io");
+	if (high[0] != '\0')
+		logwr(LOG_NOTICE, "%shigh pressure before the crash:%s",
+		    t->prefix, high);
+}
+
+/* Log the values of a pressure summary which are known */
+
+static void
+pressureline(const struct target *t, const char *label, const double *v,
+    uint16_t valid)
+{
+	/* in the order of PRESSURE_CPU etc. */
+	static const char *fmt[PRESSURE_NVALUES] = {
+		" cpu %.1f%%",
+		" memory %.1f%%",
+		" (full %.1f%%)",
+		" io %.1f%%",
+		" (full %.1f%%)",
+		" load %.2f",
+		" steal %.1f%%",
+	};
+	char buf[256];
+	size_t len = 0;
+	int j;
+
+	buf[0] = '\0';
+	for (j = 0; j < PRESSURE_NVALUES; j++)
+		if (valid & (1 << j))
+			len += snprintf(buf + len, sizeof(buf) - len, fmt[j],
+			    v[j]);
+
+	logwr(LOG_NOTICE, "%s%s:%s", t->prefix, label, buf);
+}
+
+/*
+ * Add a record to downtime totals. Return the length of the downtime
+ * period it completes, or -1 if it does not complete one.
+ */
+
+static time_t
+tally(struct ckpt_state *st, const struct downtimedb *ent)
+{
+	uint32_t count;
+	int64_t down;
+
+	count = st->crashes + st->shutdowns + st->suspends;
+	down = st->down;
+
+	ckpt_add(st, ent);
+
+	if (st->crashes + st->shutdowns + st->suspends == count)
+		return (-1);
+	return ((time_t)(st->down - down));
+}
+
+/*
+ * Lay out the metrics buffer. Each target has a sample of each family,
+ * labeled with its data directory if there are several of them. The
+ * values are set by metricsupdate() and the buffer is published as it
+ * is by metricspublish().
+ */
+
+static void
+metricsinit()
+{
+	/*
+	 * In the order of MF_BOOT etc. The samples of counters are named
+	 * with "_total" after the family as OpenMetrics requires.
+	 */
+	static const struct {
+		const char	*name;
+		const char	*type;
+		const char	*sample;
+		const char	*help;
+	} fam[] = {
+		{ "downtimed_boot_time_seconds", "gauge",
+		    "downtimed_boot_time_seconds",
+		    "Boot time in seconds since the epoch." },
+		{ "downtimed_uptime_seconds", "gauge",
+		    "downtimed_uptime_seconds",
+		    "Time since boot, zero while the target is down." },
+		{ "downtimed_last_downtime_seconds", "gauge",
+		    "downtimed_last_downtime_seconds",
+		    "Length of the latest downtime in the database." },
+		{ "downtimed_crashes", "counter",
+		    "downtimed_crashes_total",
+		    "Number of crashes in the database." },
+		{ "downtimed_shutdowns", "counter",
+		    "downtimed_shutdowns_total",
+		    "Number of shutdowns in the database." },
+	};
+	const char *label;
+	int i, j, bad = 0;
+
+	label = cf_targets != NULL ? "datadir" : NULL;
+
+	metrics_init(&metrics);
+	for (i = 0; i < sizeof(fam) / sizeof(fam[0]); i++) {
+		bad |= metrics_family(&metrics, fam[i].name, fam[i].type,
+		    fam[i].help) < 0;
+		for (j = 0; j < ntargets; j++) {
+			targets[j].mf[i] = metrics_sample(&metrics,
+			    fam[i].sample, label, targets[j].datadir);
+			bad |= targets[j].mf[i] < 0;
+		}
+	}
+	bad |= metrics_family(&metrics, "downtimed_tick_latency_seconds",
+	    "gauge", "How late the latest tick was.") < 0;
+	mf_latency = metrics_sample(&metrics,
+	    "downtimed_tick_latency_seconds", NULL, NULL);
+	bad |= mf_latency < 0;
+	bad |= metrics_family(&metrics, "downtimed_wakeups_per_hour",
+	    "gauge", "How often the daemon wakes up.") < 0;
+	mf_wakeups = metrics_sample(&metrics, "downtimed_wakeups_per_hour",
+	    NULL, NULL);
+	bad |= mf_wakeups < 0 || metrics_finish(&metrics) < 0;
+
+	if (bad) {
+		logwr(LOG_CRIT, "malloc failed, out of memory?");
+		errx(EX_OSERR, "malloc failed, out of memory?");
+	}
+
+	for (j = 0; j < ntargets; j++)
+		metricstotals(&targets[j]);
+}
+
+/*
+ * Count the downtimes of a target in its database, using the checkpoint
+ * file to skip most of it, and find the length of the latest one from
+ * the last few records. Later records are added by appenddowntimedb().
+ */
+
+static void
+metricstotals(struct target *t)
+{
+	unsigned char buf[METRICS_TAILRECS * sizeof(struct downtimedb)];
+	struct ckpt_state tail;
+	struct downtimedb ent;
+	struct stat sb;
+	char *ck;
+	off_t nrec, from;
+	ssize_t len;
+	time_t down;
+	int fd, ckfd = -1, i;
+
+	ckpt_init(&t->totals, 0);
+	t->lastdown = 0;
+
+	if ((fd = open(t->dbfile, O_RDONLY)) < 0) {
+		if (errno != ENOENT)
+			logwr(LOG_ERR, "can not open %s: %s", t->dbfile,
+			    strerror(errno));
+		return;
+	}
+	if ((ck = ckpt_path(t->dbfile)) != NULL) {
+		ckfd = open(ck, O_RDONLY);
+		free(ck);
+	}
+
+	if (ckpt_before(fd, ckfd, INT64_MAX, 0, &t->totals) < 0) {
+		logwr(LOG_ERR, "can not read %s: %s", t->dbfile,
+		    strerror(errno));
+		ckpt_init(&t->totals, 0);
+	} else if (fstat(fd, &sb) == 0) {
+		nrec = sb.st_size / sizeof(struct downtimedb);
+		from = nrec > METRICS_TAILRECS ? nrec - METRICS_TAILRECS : 0;
+		if ((len = pread(fd, buf, (nrec - from) *
+		    sizeof(struct downtimedb),
+		    from * sizeof(struct downtimedb))) > 0) {
+			ckpt_init(&tail, 0);
+			for (i = 0; i < len / sizeof(struct downtimedb); i++) {
+				downtimedb_decode(buf +
+				    i * sizeof(struct downtimedb), &ent);
+				if ((down = tally(&tail, &ent)) >= 0)
+					t->lastdown = down;
+			}
+		}
+	}
+
+	if (ckfd >= 0)
+		close(ckfd);
+	close(fd);
+}
+
+/* Set the metric values, given how late this tick was */
+
+static void
+metricsupdate(int64_t late)
+{
+	struct target *t;
+	time_t now;
+	int i;
+
+	now = walltime();
+
+	for (i = 0; i < ntargets; i++) {
+		t = &targets[i];
+		metrics_set(&metrics, t->mf[MF_BOOT], (double)t->boottime, 0);
+		metrics_set(&metrics, t->mf[MF_UPTIME],
+		    t->up ? (double)(now - t->boottime) : 0, 0);
+		metrics_set(&metrics, t->mf[MF_LASTDOWN], (double)t->lastdown,
+		    0);
+		metrics_set(&metrics, t->mf[MF_CRASHES],
+		    (double)t->totals.crashes, 0);
+		metrics_set(&metrics, t->mf[MF_SHUTDOWNS],
+		    (double)t->totals.shutdowns, 0);
+	}
+
+	metrics_set(&metrics, mf_latency, late > 0 ? late / 1e6 : 0, 6);
+	metrics_set(&metrics, mf_wakeups, wakeuprate(), 1);
+}
+
+/* Write the metrics file */
+
+static void
+metricspublish()
+{
+
+	if (metrics_publish(&metrics, cf_metrics) < 0)
+		logwr(LOG_ERR, "can not write metrics to %s: %s", cf_metrics,
+		    strerror(errno));
+}
+
+/*
+ * Set up pushing to the collector: the records are sent in the name of
+ * the host, and of the data directory too if there are many. Records
+ * left in the spool by the previous run are pushed right away.
+ */
+
+static void
+pushinit()
+{
+	char host[256];
+	struct target *t;
+	int i, ret;
+
+	memset(host, 0, sizeof(host));
+	if (gethostname(host, sizeof(host) - 1) < 0)
+		strncpy(host, "localhost", sizeof(host) - 1);
+
+	for (i = 0; i < ntargets; i++) {
+		t = &targets[i];
+		if (cf_targets == NULL)
+			ret = asprintf(&t->pushname, "%s", host);
+		else
+			ret = asprintf(&t->pushname, "%s:%s", host,
+			    t->datadir);
+		if (ret < 0) {
+			logwr(LOG_CRIT, "asprintf failed, out of memory?");
+			errx(EX_OSERR, "asprintf failed, out of memory?");
+		}
+
+		if ((ret = push_pending(t->spool)) < 0)
+			logwr(LOG_ERR, "can not stat %s: %s", t->spool,
+			    strerror(errno));
+		else if (ret > 0) {
+			logwr(LOG_INFO, "%s%d records waiting to be pushed "
+			    "to %s", t->prefix, ret, cf_push);
+			push_wanted = 1;
+		}
+	}
+}
+
+/*
+ * Start a child pushing the spooled records of all targets, stopping
+ * at the first one which fails. pushreap() collects the results.
+ */
+
+static void
+pushflush(int64_t now)
+{
+	struct pushresult res;
+	int fds[2], i;
+
+	push_scheduled = push_wanted = 0;
+
+	if (pipe(fds) < 0) {
+		logwr(LOG_ERR, "can not push to %s, pipe failed: %s, "
+		    "retrying in %ld seconds", cf_push, strerror(errno),
+		    push_delay);
+		pushretry(now);
+		return;
+	}
+	if ((push_pid = fork()) < 0) {
+		logwr(LOG_ERR, "can not push to %s, fork failed: %s, "
+		    "retrying in %ld seconds", cf_push, strerror(errno),
+		    push_delay);
+		close(fds[0]);
+		close(fds[1]);
+		push_pid = 0;
+		pushretry(now);
+		return;
+	}
+
+	if (push_pid == 0) {
+		signal(SIGHUP, SIG_DFL);
+		signal(SIGINT, SIG_DFL);
+		signal(SIGTERM, SIG_DFL);
+		close(fds[0]);
+
+		/* the results are small enough not to fill the pipe */
+		for (i = 0; i < ntargets; i++) {
+			res.left = push_send(targets[i].spool, cf_push,
+			    targets[i].pushname, &res.acked);
+			res.error = errno;
+			if (write(fds[1], &res, sizeof(res)) != sizeof(res))
+				_exit(EX_IOERR);
+			if (res.left != 0)
+				break;
+		}
+		_exit(EX_OK);
+	}
+
+	close(fds[1]);
+	push_fd = fds[0];
+	push_started = now;
+}
+
+/*
+ * Collect the results of the push child if it has finished, removing
+ * from the spools what the collector took. If the collector could not
+ * be reached, or did not take all of the records, try again later.
+ */
+
+static void
+pushreap(int64_t now)
+{
+	struct pushresult res;
+	struct target *t;
+	int i, status, killed = 0, failed = 0;
+
+	if (waitpid(push_pid, &status, WNOHANG) == 0) {
+		if (now - push_started < (int64_t)PUSH_MAXTIME * 1000000)
+			return;
+		kill(push_pid, SIGKILL);
+		waitpid(push_pid, &status, 0);
+		killed = 1;
+	}
+	push_pid = 0;
+
+	for (i = 0; !failed && i < ntargets; i++) {
+		if (read(push_fd, &res, sizeof(res)) != sizeof(res))
+			break;
+		t = &targets[i];
+
+		if (push_drop(t->spool, res.acked) < 0)
+			logwr(LOG_ERR, "%scan not remove pushed records "
+			    "from %s: %s", t->prefix, t->spool,
+			    strerror(errno));
+		if (res.left < 0) {
+			logwr(LOG_WARNING, "%scan not push to %s: %s, "
+			    "retrying in %ld seconds", t->prefix, cf_push,
+			    strerror(res.error), push_delay);
+			failed = 1;
+		} else if (res.left > 0) {
+			logwr(LOG_WARNING, "%s%s did not take %d records, "
+			    "retrying in %ld seconds", t->prefix, cf_push,
+			    res.left, push_delay);
+			failed = 1;
+		}
+	}
+	close(push_fd);
+	push_fd = -1;
+
+	if (!failed && i < ntargets) {
+		if (killed)
+			logwr(LOG_WARNING, "pushing to %s did not finish in "
+			    "%d seconds, retrying in %ld seconds", cf_push,
+			    PUSH_MAXTIME, push_delay);
+		else
+			logwr(LOG_ERR, "pushing to %s failed, retrying in "
+			    "%ld seconds", cf_push, push_delay);
+		failed = 1;
+	}
+
+	if (!failed) {
+		if (push_delay > PUSH_MINDELAY)
+			logwr(LOG_INFO, "pushed the backlog to %s", cf_push);
+		push_delay = PUSH_MINDELAY;
+		return;
+	}
+
+	pushretry(now);
+}
+
+/* Schedule the next push after the current delay and back off */
+
+static void
+pushretry(int64_t now)
+{
+
+	wheel_add(&wheel, &push_we, now / 1000000 + push_delay);
+	push_scheduled = 1;
+	if ((push_delay *= 2) > PUSH_MAXDELAY)
+		push_delay = PUSH_MAXDELAY;
+}
+
+/*
+ * Map the status page read by local health checkers. Failing to do so
+ * is logged but not fatal, like failing to write the metrics.
+ */
+
+static void
+statusinit()
+{
+
+	if (cf_status == NULL)
+		return;
+
+	if ((status_page = status_create(cf_status)) == NULL) {
+		logwr(LOG_ERR, "can not map status page %s: %s", cf_status,
+		    strerror(errno));
+		return;
+	}
+
+	memset(&status, 0, sizeof(status));
+	status.pid = (int64_t)getpid();
+	status.boottime = (int64_t)boottime;
+	statusupdate(STATUS_STARTING, 0);
+}
+
+/* Update the status page, with a new tick if ticked is set */
+
+static void
+statusupdate(uint32_t state, int ticked)
+{
+	struct timeval tv;
+
+	if (status_page == NULL)
+		return;
+
+	status.state = state;
+	if (ticked) {
+		gettimeofday(&tv, NULL);
+		status.tick_real = (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+		status.tick_mono = status_clock();
+		status.ticks++;
+	}
+
+	status_write(status_page, &status);
+}
+
+/* Return the wall clock time in microseconds */
+
+static int64_t
+realtime()
+{
+	struct timeval tv;
+
+	if (cf_simulate != NULL)
+		return (sim_real);
+
+	gettimeofday(&tv, NULL);
+
+	return ((int64_t)tv.tv_sec * 1000000 + tv.tv_usec);
+}
+
+/* Return the wall clock time in seconds, like time(3) */
+
+static time_t
+walltime()
+{
+
+	return ((time_t)(realtime() / 1000000));
+}
+
+/* Return the time in microseconds from an arbitrary starting point */
+
+static int64_t
+monotime()
+{
+	struct timeval tv;
+#ifdef CLOCK_MONOTONIC
+	struct timespec ts;
+#endif
+
+	if (cf_simulate != NULL)
+		return (sim_mono);
+
+#ifdef CLOCK_MONOTONIC
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+		return ((int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+#endif
+
+	gettimeofday(&tv, NULL);
+
+	return ((int64_t)tv.tv_sec * 1000000 + tv.tv_usec);
+}
+
+/* Sleep until monotime() reaches the given time or a signal arrives */
+
+static void
+sleepuntil(int64_t usec)
+{
+	struct timespec ts;
+	int64_t d;
+
+	if (cf_simulate != NULL) {
+		simsleep(usec);
+		return;
+	}
+
+	if ((d = usec - monotime()) <= 0)
+		return;
+
+	ts.tv_sec = d / 1000000;
+	ts.tv_nsec = (d % 1000000) * 1000;
+
+	nanosleep(&ts, (struct timespec *)NULL);
+}
+
+/*
+ * Replay the scenario in the file fn on the virtual clock, see sim.h.
+ * Each boot of the simulated system is run by a child process, which
+ * returns from here to start up, run and shut down the daemon in the
+ * usual way, while simsleep() replays the events of its lifetime. The
+ * parent waits for it to end, follows the clock to the end of the
+ * lifetime and goes on with the next boot. The parent does not return.
+ */
+
+static void
+simulate(const char *fn)
+{
+	struct sim_event *e;
+	struct timeval t0, t1;
+	int64_t first = 0;
+	pid_t pid;
+	int status, boots = 0;
+
+	if (sim_load(fn, &sim) < 0) {
+		if (sim.errline > 0) {
+			logwr(LOG_CRIT, "%s: line %d: %s", fn, sim.errline,
+			    sim.errmsg);
+			errx(EX_DATAERR, "%s: line %d: %s", fn, sim.errline,
+			    sim.errmsg);
+		}
+		logwr(LOG_CRIT, "can not read %s: %s", fn, strerror(errno));
+		err(EX_NOINPUT, "can not read %s", fn);
+	}
+
+	/* the simulated daemons run in the foreground, unknown to all */
+	cf_fork = 0;
+	cf_pidfile = "none";
+	notify_addrlen = 0;
+	notify_watchdog = 0;
+
+	gettimeofday(&t0, NULL);
+	sim_real = (int64_t)SIM_EPOCH * 1000000;
+
+	while (sim_pc < sim.n) {
+		e = &sim.ev[sim_pc++];
+		if (e->what == SIM_STEP) {
+			sim_real += e->arg;
+			continue;
+		}
+		if (e->what == SIM_TORN) {
+			simtorn();
+			continue;
+		}
+
+		/* sim_load() has checked that this is a boot */
+		sim_real = e->what == SIM_BOOTAT ? e->arg : sim_real + e->arg;
+		if (boots++ == 0)
+			first = sim_real;
+
+		fflush(NULL);
+		if ((pid = fork()) < 0) {
+			logwr(LOG_CRIT, "fork failed: %s", strerror(errno));
+			err(EX_OSERR, "fork failed");
+		}
+		if (pid == 0) {
+			sim_boot = boottime = (time_t)(sim_real / 1000000);
+			sim_mono = sim_end = 1000000;
+			startmark = phasemark = monotime();
+			starttime = walltime();
+			return;
+		}
+
+		if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+		    WEXITSTATUS(status) != EX_OK) {
+			logwr(LOG_CRIT, "%s: line %d: simulated boot failed",
+			    fn, e->line);
+			errx(EX_SOFTWARE, "%s: line %d: simulated boot failed",
+			    fn, e->line);
+		}
+
+		/* the lifetime ends with a crash or a power off */
+		while (sim_pc < sim.n) {
+			e = &sim.ev[sim_pc++];
+			sim_real += e->arg;
+			if (e->what == SIM_CRASH || e->what == SIM_SHUTDOWN)
+				break;
+		}
+	}
+
+	gettimeofday(&t1, NULL);
+	logwr(LOG_INFO, "simulated %d boots in %s in %.3f seconds", boots,
+	    timestr_int((time_t)((sim_real - first) / 1000000)),
+	    (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec) / 1e6);
+
+	sim_free(&sim);
+	exit(EX_OK);
+}
+
+/*
+ * Sleep on the virtual clock until monotime() reaches usec, replaying
+ * the events of the scenario which fall due meanwhile. A shutdown ends
+ * the sleep early, as the signal would. When the system crashes or
+ * powers off, so do we, leaving things as they are.
+ */
+
+static void
+simsleep(int64_t usec)
+{
+	struct sim_event *e;
+	int64_t d;
+
+	while (sim_mono < usec) {
+		if (sim_mono < sim_end) {
+			d = (usec < sim_end ? usec : sim_end) - sim_mono;
+			sim_mono += d;
+			sim_real += d;
+			continue;
+		}
+
+		if (sim_poweroff || sim_pc >= sim.n)
+			_exit(EX_OK);
+
+		e = &sim.ev[sim_pc++];
+		switch (e->what) {
+		case SIM_RUN:
+			sim_end = sim_mono + e->arg;
+			break;
+		case SIM_FREEZE:
+			/* we do not get to run meanwhile */
+			sim_mono += e->arg;
+			sim_real += e->arg;
+			sim_end = sim_mono;
+			break;
+		case SIM_SUSPEND:
+			sim_real += e->arg;
+			sim_suspended += e->arg;
+			break;
+		case SIM_STEP:
+			sim_real += e->arg;
+			break;
+		case SIM_SHUTDOWN:
+			exittime = walltime();
+			exiting = 1;
+			sim_end = sim_mono + e->arg;
+			sim_poweroff = 1;
+			return;
+		case SIM_CRASH:
+		default:
+			_exit(EX_OK);
+		}
+	}
+}
+
+/*
+ * Leave the first half of a crash record at the end of the downtime
+ * databases, as a crash in the middle of writing one would.
+ */
+
+static void
+simtorn()
+{
+	unsigned char buf[sizeof(struct downtimedb)];
+	struct downtimedb ent;
+	int fd, i;
+
+	memset(&ent, 0, sizeof(ent));
+	ent.what = DOWNTIMEDB_WHAT_CRASH;
+	ent.when = (int64_t)walltime();
+	downtimedb_encode(&ent, buf);
+
+	for (i = 0; i < ntargets; i++) {
+		if ((fd = open(targets[i].dbfile, O_WRONLY | O_CREAT |
+		    O_APPEND, DEFFILEMODE)) < 0) {
+			logwr(LOG_ERR, "can not open %s: %s",
+			    targets[i].dbfile, strerror(errno));
+			continue;
+		}
+		if (write(fd, buf, sizeof(buf) / 2) < 0)
+			logwr(LOG_ERR, "can not write to %s: %s",
+			    targets[i].dbfile, strerror(errno));
+		close(fd);
+	}
+}
+
+/*
+ * Set up low-wakeup mode. A timer slack lets the kernel delay the end
+ * of our sleep by up to cf_slack milliseconds to batch it with other
+ * timers. A slack of zero leaves the default of the system.
+ */
+
+static void
+lowwakeinit()
+{
+
+	if (cf_slack <= 0)
+		return;
+
+#if defined(HAVE_SYS_PRCTL_H) && defined(PR_SET_TIMERSLACK)
+	if (prctl(PR_SET_TIMERSLACK, (unsigned long)cf_slack * 1000000UL,
+	    0, 0, 0) < 0)
+		logwr(LOG_WARNING, "can not set timer slack: %s",
+		    strerror(errno));
+#else
+	logwr(LOG_WARNING, "timer slack is not supported on this system");
+#endif
+}
+
+/*
+ * Return the monotime() second of the next tick of something done
+ * every period seconds, given the current monotime() in microseconds.
+ * In low-wakeup mode the tick is moved to the next multiple of period
+ * on the wall clock, so that the daemons of all of the virtual machines
+ * on a host wake up together, and tickphase is set to match.
+ */
+
+static int64_t
+nexttick(int64_t now, long period)
+{
+	int64_t real, p, guard, next;
+
+	if (cf_slack < 0)
+		return (now / 1000000 + period);
+
+	real = realtime();
+	p = (int64_t)period * 1000000;
+
+	/* do not tick again if woken up a little before the boundary */
+	guard = p / 2 < 1000000 ? p / 2 : 1000000;
+	next = (real + guard) / p * p + p;
+
+	/* the same moment on the monotonic clock */
+	next -= real - now;
+	tickphase = (next % 1000000 + 1000000) % 1000000;
+
+	return ((next - tickphase) / 1000000);
+}
+
+/* Return the number of wakeups of the main loop per hour so far */
+
+static double
+wakeuprate()
+{
+	int64_t elapsed;
+
+	if ((elapsed = monotime() - startmark) <= 0)
+		return (0);
+	return ((double)wakeups * 3600000000.0 / elapsed);
+}
+
+/* Record how long the startup phase which just ended took */
+
+static void
+phase(const char *name)
+{
+	int64_t now;
+
+	now = monotime();
+
+	if (nphases < MAXPHASES) {
+		phases[nphases].name = name;
+		phases[nphases].usec = now - phasemark;
+		nphases++;
+	}
+
+	phasemark = now;
+}
+
+/* Log the startup phase timing collected by phase() */
+
+static void
+logphases()
+{
+	char str[256];
+	size_t len;
+	int i;
+
+	for (i = 0, len = 0; i < nphases && len < sizeof(str); i++)
+		len += snprintf(str + len, sizeof(str) - len, "%s%s %.3f ms",
+		    i == 0 ? "" : ", ", phases[i].name,
+		    phases[i].usec / 1000.0);
+
+	logwr(LOG_INFO, "startup took %.3f ms: %s",
+	    (phasemark - startmark) / 1000.0, str);
+}
+
+/*
+ * Keep updating the shutdown stamps every LINGER_TICK seconds for up to
+ * cf_linger seconds after the signal to stop, so that the last one left
+ * on the disk tells when the system really went down. This is done by
+ * a detached child, so that we exit at once and do not hold up the very
+ * shutdown being measured; the child is ended by the final kill of the
+ * remaining processes, see KillMode in downtimed.service. It stops if
+ * a new daemon is started meanwhile. When simulating, the virtual clock
+ * holds nothing up, so no child is needed.
+ */
+
+static void
+linger()
+{
+	int64_t next, end;
+	pid_t pid;
+	int i;
+
+	logwr(LOG_INFO, "updating the shutdown time for up to %ld seconds",
+	    cf_linger);
+
+	if (cf_simulate == NULL) {
+		if ((pid = fork()) < 0) {
+			logwr(LOG_ERR, "can not update the shutdown time, "
+			    "fork failed: %s", strerror(errno));
+			return;
+		}
+		if (pid > 0)
+			return;
+
+		setsid();
+		signal(SIGHUP, SIG_IGN);
+		signal(SIGINT, SIG_DFL);
+		signal(SIGTERM, SIG_DFL);
+	}
+
+	next = monotime();
+	end = next + (int64_t)cf_linger * 1000000;
+	while ((next += LINGER_TICK * 1000000) <= end) {
+		sleepuntil(next);
+		if (exiting > 1 || restarted())
+			break;
+		for (i = 0; i < ntargets; i++)
+			if (targets[i].up)
+				stamp(&targets[i], STAMP_SHUTDOWN, 0, 1);
+	}
+
+	if (cf_simulate == NULL)
+		_exit(EX_OK);
+}
+
+/*
+ * Return 1 if another daemon has updated the time stamps since we
+ * stopped, so that linger() must leave them alone.
+ */
+
+static int
+restarted()
+{
+	struct hbslot sl;
+	struct stat sb;
+	int i;
+
+	if (hb_fd >= 0)
+		return (hbtable_read(hb_fd, cf_hbslot, &sl) == 1 &&
+		    sl.seq != hb_slot.seq);
+
+	for (i = 0; i < ntargets; i++)
+		if (targets[i].up && stat(targets[i].ts_stamp, &sb) == 0 &&
+		    sb.st_mtime != exittime)
+			return (1);
+
+	return (0);
+}
+
+/* Handle signals */
+
+static void
+sighandler(int signum)
+{
+
+	if (signum == SIGINT || signum == SIGTERM) {
+		if (exiting == 0)
+			exittime = time((time_t *)NULL);
+		exiting = (exiting == 0) ? 1 : 2;
+	}
+
+	if (signum == SIGHUP)
+		reopenlog = 1;
+}
+
+/*
+ * Update time-stamp of file, return -1 on error. It is synced to the
+ * disk if cf_fsync and sync are set.
+ */
+
+static int
+touch(const char *fn, time_t t, int sync)
+{
+	struct stat sb;
+	struct timeval tv[2];
+	int fd, ret = 0;
+
+	/* the file system does not know about the virtual clock */
+	if (t == 0 && cf_simulate != NULL)
+		t = walltime();
+
+	if (t != 0) {
+		tv[0].tv_sec = t;
+		tv[0].tv_usec = 0;
+		tv[1].tv_sec = t;
+		tv[1].tv_usec = 0;
+	}
+
+#ifdef HAVE_FUTIMES
+	if (cf_fsync && sync) {
+		/* we need to open the file so that we can do fsync() to it */
+		if ((fd = stampopen(fn, t)) < 0)
+			return (-1);
+
+		if (syncfile(fd, 0) < 0) {
+			logwr(LOG_ERR, "%s: %s", fn, strerror(errno));
+			ret = -1;
+		}
+
+		if (close(fd) < 0) {
+			logwr(LOG_ERR, "%s: %s", fn, strerror(errno));
+			ret = -1;
+		}
+	} else {
+#endif /* HAVE_FUTIMES */
+		/* create the file in case it is missing */
+		if (stat(fn, &sb) < 0) {
+			if ((fd = open(fn, O_WRONLY | O_CREAT | O_TRUNC,
+			    DEFFILEMODE)) < 0) {
+				logwr(LOG_ERR, "%s: %s", fn, strerror(errno));
+				return (-1);
+			}
+			if (close(fd) < 0)
+				logwr(LOG_ERR, "%s: %s", fn, strerror(errno));
+		}
+		if (utimes(fn, t == 0 ? (struct timeval *)NULL : tv) < 0) {
+			logwr(LOG_ERR, "%s: %s", fn, strerror(errno));
+			ret = -1;
+		}
+#ifdef HAVE_FUTIMES
+	}
+#endif /* HAVE_FUTIMES */
+
+	return (ret);
+}
+
+/*
+ * Store the boot time and the run-time stamp of the targets which are
+ * up, syncing them to the disk. Return -1 if any of them failed.
+ */
+
+static int
+firststamps()
+{
+	struct target *t;
+	int i, ret = 0;
+
+	for (i = 0; i < ntargets; i++) {
+		t = &targets[i];
+		if (!t->up)
+			continue;
+		if (stamp(t, STAMP_BOOT, t->boottime, 1) < 0)
+			ret = -1;
+		if (stamp(t, STAMP_RUN, 0, 1) < 0)
+			ret = -1;
+		t->stamped = monotime();
+	}
+
+	return (ret);
+}
+
+/*
+ * Update a time stamp of a target to the given time, or to the current
+ * time if zero, syncing it as touch() does. Return -1 on error. With a
+ * heartbeat table all of the time stamps are kept in the slot of the
+ * host, which is written as a whole each time.
+ */
+
+static int
+stamp(struct target *t, int which, time_t when, int sync)
+{
+
+	if (hb_fd < 0) {
+		switch (which) {
+		case STAMP_BOOT:
+			return (touch(t->ts_boot, when, sync));
+		case STAMP_SHUTDOWN:
+			return (touch(t->ts_shutdown, when, sync));
+		default:
+			return (touch(t->ts_stamp, when, sync));
+		}
+	}
+
+	if (when == 0)
+		when = walltime();
+
+	switch (which) {
+	case STAMP_BOOT:
+		hb_slot.boot = when;
+		hb_slot.shutdown = 0;
+		break;
+	case STAMP_SHUTDOWN:
+		hb_slot.shutdown = when;
+		break;
+	default:
+		hb_slot.stamp = when;
+		break;
+	}
+	hb_slot.seq++;
+
+	if (hbtable_write(hb_fd, cf_hbslot, &hb_slot) < 0) {
+		logwr(LOG_ERR, "can not write to %s: %s", cf_hbtable,
+		    strerror(errno));
+		return (-1);
+	}
+
+#ifdef HAVE_FUTIMES
+	if (cf_fsync && sync) {
+		if (syncfile(hb_fd, 0) < 0) {
+			logwr(LOG_ERR, "%s: %s", cf_hbtable, strerror(errno));
+			return (-1);
+		}
+		hb_synced = monotime();
+	}
+#endif
+
+	return (0);
+}
+
+/*
+ * Return 1 if a run-time stamp last synced at the given time should be
+ * synced again. Within cf_window seconds of the previous sync only the
+ * time stamp has changed, so losing it in a crash just makes the crash
+ * time look earlier, by at most cf_window plus the sleep time.
+ */
+
+static int
+syncdue(int64_t synced)
+{
+	long window;
+
+	window = syncwindow();
+
+	return (window <= 0 || synced == 0 ||
+	    monotime() - synced >= (int64_t)window * 1000000);
+}
+
+/* Return the current number of seconds between syncs of the stamps */
+
+static long
+syncwindow()
+{
+	int64_t window;
+
+	if (cf_window >= 0)
+		return (cf_window);
+
+	window = synctime * SYNC_BUDGET / 1000000;
+	return (window > SYNC_MAXWINDOW ? SYNC_MAXWINDOW : (long)window);
+}
+
+/*
+ * Sync a file, or all of its file system if whole is set, and keep a
+ * moving average of how long it takes. Return -1 on error.
+ */
+
+static int
+syncfile(int fd, int whole)
+{
+	int64_t start, d;
+	int ret;
+
+	start = monotime();
+#ifdef HAVE_SYNCFS
+	if (whole)
+		ret = syncfs(fd);
+	else
+#endif
+	ret = fsync(fd);
+	if (ret < 0)
+		return (ret);
+
+	d = monotime() - start;
+	synctime = synctime == 0 ? d : (synctime * 7 + d) / 8;
+
+	return (0);
+}
+
+/*
+ * Return how much later than recorded a crash of a target may have
+ * happened at most, or -1 if not known because the stamps are not
+ * synced. This assumes the previous run was set up like this one.
+ */
+
+static long
+crashbound(const struct target *t)
+{
+
+#ifdef HAVE_FUTIMES
+	if (cf_fsync)
+		return (t->sleep +
+		    (cf_window < 0 ? SYNC_MAXWINDOW : cf_window));
+#endif
+	return (-1);
+}
+
+/*
+ * Open the heartbeat table, creating it if needed, and pick up the
+ * time stamps left in our slot by the previous run. A slot claimed by
+ * another host is never overwritten.
+ */
+
+static void
+hbinit()
+{
+	char name[HBTABLE_NAMELEN];
+	uint32_t nslots;
+	int ret;
+
+	if ((hb_fd = hbtable_open(cf_hbtable, 1, &nslots)) < 0) {
+		logwr(LOG_CRIT, "can not open heartbeat table %s: %s",
+		    cf_hbtable, strerror(errno));
+		errx(EX_CANTCREAT, "can not open heartbeat table %s",
+		    cf_hbtable);
+	}
+	fcntl(hb_fd, F_SETFD, FD_CLOEXEC);
+
+	if (cf_hbslot < 0 || cf_hbslot >= nslots) {
+		logwr(LOG_CRIT, "slot %ld is not in heartbeat table %s "
+		    "of %lu slots", cf_hbslot, cf_hbtable,
+		    (unsigned long)nslots);
+		errx(EX_CONFIG, "slot %ld is not in heartbeat table %s "
+		    "of %lu slots", cf_hbslot, cf_hbtable,
+		    (unsigned long)nslots);
+	}
+
+	memset(name, 0, sizeof(name));
+	if (gethostname(name, sizeof(name) - 1) < 0)
+		strncpy(name, "localhost", sizeof(name) - 1);
+
+	/* a damaged slot is taken over, losing the previous stamps */
+	if ((ret = hbtable_read(hb_fd, cf_hbslot, &hb_slot)) == -2) {
+		logwr(LOG_CRIT, "can not read heartbeat table %s: %s",
+		    cf_hbtable, strerror(errno));
+		errx(EX_IOERR, "can not read heartbeat table %s", cf_hbtable);
+	} else if (ret < 0) {
+		logwr(LOG_ERR, "slot %ld of heartbeat table %s is corrupted",
+		    cf_hbslot, cf_hbtable);
+		memset(&hb_slot, 0, sizeof(hb_slot));
+	} else if (ret > 0 && strncmp(hb_slot.name, name,
+	    HBTABLE_NAMELEN - 1) != 0) {
+		logwr(LOG_CRIT, "slot %ld of heartbeat table %s belongs to "
+		    "%s", cf_hbslot, cf_hbtable, hb_slot.name);
+		errx(EX_CONFIG, "slot %ld of heartbeat table %s belongs to "
+		    "%s", cf_hbslot, cf_hbtable, hb_slot.name);
+	}
+
+	memcpy(hb_slot.name, name, HBTABLE_NAMELEN);
+}
+
+#ifdef HAVE_FUTIMES
+
+/*
+ * Open a time stamp file and update its time without syncing it to the
+ * disk. Return the open file descriptor or -1 on error.
+ */
+
+static int
+stampopen(const char *fn, time_t t)
+{
+	struct timeval tv[2];
+	int fd;
+
+	if (t == 0 && cf_simulate != NULL)
+		t = walltime();
+
+	if (t != 0) {
+		tv[0].tv_sec = t;
+		tv[0].tv_usec = 0;
+		tv[1].tv_sec = t;
+		tv[1].tv_usec = 0;
+	}
+
+	if ((fd = open(fn, O_WRONLY | O_CREAT | O_TRUNC, DEFFILEMODE)) < 0) {
+		logwr(LOG_ERR, "%s: %s", fn, strerror(errno));
+		return (-1);
+	}
+
+	if (futimes(fd, t == 0 ? (struct timeval *)NULL : tv) < 0) {
+		logwr(LOG_ERR, "%s: %s", fn, strerror(errno));
+		close(fd);
+		return (-1);
+	}
+
+	return (fd);
+}
+
+/*
+ * Sync the time stamps opened by tick(), and the pressure samples
+ * written next to them, to the disk and close the stamps.
+ * All of the stamps are on the same file system, so where syncfs(2) is
+ * available, a single call does it for all of them.
+ */
+
+static int
+stampsync(struct target **ts, int n)
+{
+	int i, ret = 0;
+
+	for (i = 0; i < n; i++) {
+#ifdef HAVE_SYNCFS
+		if (n > 1) {
+			if (i == 0 && syncfile(ts[0]->fd, 1) < 0) {
+				logwr(LOG_ERR, "%s: %s", ts[0]->ts_stamp,
+				    strerror(errno));
+				ret = -1;
+			}
+		} else
+#endif
+		{
+			if (syncfile(ts[i]->fd, 0) < 0) {
+				logwr(LOG_ERR, "%s: %s", ts[i]->ts_stamp,
+				    strerror(errno));
+				ret = -1;
+			}
+			if (ts[i]->pfd >= 0)
+				syncfile(ts[i]->pfd, 0);
+		}
+
+		if (close(ts[i]->fd) < 0) {
+			logwr(LOG_ERR, "%s: %s", ts[i]->ts_stamp,
+			    strerror(errno));
+			ret = -1;
+		}
+		ts[i]->fd = -1;
+	}
+
+	return (ret);
+}
+
+/* Order targets by the file system of their time stamp */
+
+static int
+devcmp(const void *a, const void *b)
+{
+	const struct target *ta = *(struct target * const *)a;
+	const struct target *tb = *(struct target * const *)b;
+
+	if (ta->dev != tb->dev)
+		return (ta->dev < tb->dev ? -1 : 1);
+
+	return (0);
+}
+
+#endif /* HAVE_FUTIMES */
+
+/*
+ * Touch the time stamps of the targets which are due. The stamps are
+ * all updated first and then synced to the disk one file system at a
+ * time, so that a few hundred targets do not mean a few hundred
+ * fsync(2) calls in a row. Return -1 if any of them failed.
+ */
+
+static int
+tick(struct target **ts, int n)
+{
+	struct pressure_sample smp;
+	struct target *t;
+	int i, sync, ret = 0;
+#ifdef HAVE_FUTIMES
+	struct stat sb;
+	int j, k;
+
+	j = 0;
+#endif
+
+	/* one sample serves all of the targets */
+	if (psrc_n > 0)
+		pressure_take(&psrc, &smp);
+
+	for (i = 0; i < n; i++) {
+		t = ts[i];
+		if (!targetup(t))
+			continue;
+
+		/* written first, to be synced along with the stamp */
+		if (psrc_n > 0 && t->pfd >= 0) {
+			smp.seq = t->pseq++;
+			if (pressure_write(t->pfd, &smp) < 0) {
+				logwr(LOG_ERR, "%s: %s", t->ts_pressure,
+				    strerror(errno));
+				close(t->pfd);
+				t->pfd = -1;
+			}
+		}
+
+		if (hb_fd >= 0) {
+			sync = syncdue(hb_synced);
+			if (stamp(t, STAMP_RUN, 0, sync) < 0)
+				ret = -1;
+			if (sync && t->pfd >= 0)
+				syncfile(t->pfd, 0);
+			continue;
+		}
+
+#ifdef HAVE_FUTIMES
+		if (cf_fsync && syncdue(t->synced)) {
+			if ((t->fd = stampopen(t->ts_stamp, 0)) < 0) {
+				ret = -1;
+				continue;
+			}
+			t->dev = fstat(t->fd, &sb) == 0 ? sb.st_dev : 0;
+			syncq[j++] = t;
+			continue;
+		}
+#endif
+		if (touch(t->ts_stamp, 0, 0) < 0)
+			ret = -1;
+	}
+
+#ifdef HAVE_FUTIMES
+	qsort(syncq, j, sizeof(struct target *), devcmp);
+
+	for (i = 0; i < j; i = k) {
+		for (k = i + 1; k < j && syncq[k]->dev == syncq[i]->dev; k++)
+			;
+		if (stampsync(&syncq[i], k - i) < 0) {
+			ret = -1;
+			continue;
+		}
+		while (i < k)
+			syncq[i++]->synced = monotime();
+	}
+#endif
+
+	return (ret);
+}
+
+/*
+ * Set up notifications to the service manager if we were started by
+ * systemd(1) with Type=notify. The sd_notify(3) protocol is simple
+ * enough to be implemented here without linking to libsystemd: just
+ * send datagrams to the socket named in $NOTIFY_SOCKET.
+ *
+ * If the service manager watchdog is enabled, make sure that the time
+ * stamp is touched, and the watchdog notified, at least twice within
+ * the watchdog interval.
+ */
+
+static void
+notifyinit()
+{
+	const char *path, *str;
+	char *p;
+	long long usec;
+
+	if ((path = getenv("NOTIFY_SOCKET")) == NULL ||
+	    (path[0] != '/' && path[0] != '@') ||
+	    strlen(path) >= sizeof(notify_addr.sun_path))
+		return;
+
+	memset(&notify_addr, 0, sizeof(notify_addr));
+	notify_addr.sun_family = AF_UNIX;
+	strncpy(notify_addr.sun_path, path, sizeof(notify_addr.sun_path) - 1);
+	notify_addrlen = offsetof(struct sockaddr_un, sun_path) +
+	    strlen(path);
+
+	/* a Linux abstract socket name begins with NUL instead of @ */
+	if (path[0] == '@')
+		notify_addr.sun_path[0] = '\0';
+
+	if ((notify_fd = socket(AF_UNIX, SOCK_DGRAM, 0)) < 0) {
+		logwr(LOG_ERR, "can not create notify socket: %s",
+		    strerror(errno));
+		return;
+	}
+	fcntl(notify_fd, F_SETFD, FD_CLOEXEC);
+
+	if ((str = getenv("WATCHDOG_USEC")) == NULL)
+		return;
+
+	/* the watchdog may be meant for some other process */
+	if (getenv("WATCHDOG_PID") != NULL &&
+	    atol(getenv("WATCHDOG_PID")) != (long)getpid())
+		return;
+
+	p = NULL;
+	errno = 0;
+	usec = strtoll(str, &p, 10);
+	if ((p != NULL && *p != '\0') || errno != 0 || usec <= 0) {
+		logwr(LOG_ERR, "invalid WATCHDOG_USEC %s", str);
+		return;
+	}
+
+	if ((notify_watchdog = usec / 2000000) < 1)
+		notify_watchdog = 1;
+
+	if (cf_sleep > notify_watchdog) {
+		logwr(LOG_NOTICE, "watchdog enabled, sleep reduced to %ld "
+		    "seconds", notify_watchdog);
+		cf_sleep = notify_watchdog;
+	}
+}
+
+/* Send a notification to the service manager, if there is one */
+
+static void
+notify(const char *msg)
+{
+
+	if (notify_fd < 0)
+		return;
+
+	if (sendto(notify_fd, msg, strlen(msg), 0,
+	    (struct sockaddr *)&notify_addr, notify_addrlen) < 0)
+		logwr(LOG_ERR, "can not notify service manager: %s",
+		    strerror(errno));
+}
+
+/* Compatibility for systems without facilitynames in <syslog.h> */
+
+#ifndef HAVE_SYSLOG_FACILITYNAMES
+
+static const struct {
+	const char	*c_name;
+	const int	c_val;
+} facilitynames[] = {
+#ifdef LOG_KERN
+	{ "kern",	LOG_KERN	},
+#endif
+#ifdef LOG_USER
+	{ "user",	LOG_USER	},
+#endif
+#ifdef LOG_MAIL
+	{ "mail",	LOG_MAIL	},
+#endif
+#ifdef LOG_DAEMON
+	{ "daemon",	LOG_DAEMON	},
+#endif
+#ifdef LOG_AUTH
+	{ "auth",	LOG_AUTH	},
+#endif
 #ifdef LOG_SYSLOG
 	{ "syslog",	LOG_SYSLOG	},
 #endif
@@ -662,7 +2961,7 @@ logwr(int pri, const char *fmt, ...)
 			goto err;
 
 		if (asprintf(&str2, "%s: %s\n",
-		    timestr_abs(time((time_t *) NULL), cf_timefmt, 0), str)
+		    timestr_abs(walltime(), cf_timefmt, 0), str)
 		    < 0) {
 			free(str);
 			goto err;
@@ -693,7 +2992,11 @@ usage()
 {
 
 	fputs("usage: " PROGNAME " [-DFvS] [-d datadir] [-f timefmt] "
-	    "[-l log] [-p pidfile] [-s sleep]\n", stderr);
+	    "[-l log] [-p pidfile] [-s sleep]\n\t[-H table -i slot] "
+	    "[-k linger] [-L slack] [-m metricsfile [-M interval]]\n"
+	    "\t[-P statusfile] [-R collector] [-T targets] [-t stall]\n"
+	    "\t[-W window|auto] [-X scenario]\n",
+	    stderr);
 	exit(EX_USAGE);
 }
 
@@ -702,6 +3005,7 @@ usage()
 static void
 version()
 {
+	size_t len;
 
 	puts(PROGNAME " " PROGVERSION " - system downtime reporting daemon\n");
 
@@ -716,12 +3020,20 @@ version()
 	printf("  log = %s\n", cf_log);
 	printf("  pidfile = %s\n", cf_pidfile);
 	printf("  datadir = %s\n", cf_datadir);
-	printf("  downtimedbfile = %s\n", cf_downtimedbfile);
+	/* the database is found in the data directory, see addtarget() */
+	len = strlen(cf_datadir);
+	while (len > 1 && cf_datadir[len - 1] == '/')
+		len--;
+	printf("  downtimedbfile = %.*s/downtimedb\n", (int)len, cf_datadir);
 	printf("  sleep = %ld\n", cf_sleep);
 #ifdef HAVE_FUTIMES
 	printf("  fsync = %d\n", cf_fsync);
 #endif
 	printf("  timefmt = %s\n", cf_timefmt);
+	printf("  stall = %ld\n", cf_stall);
+	printf("  interval = %ld\n", cf_metricsint);
+	printf("  window = %ld\n", cf_window);
+	printf("  linger = %ld\n", cf_linger);
 
 #ifdef PACKAGE_URL
 	puts("\nSee the following web site for more information and updates:");
@@ -735,16 +3047,18 @@ version()
 static void
 parseargs(int argc, char *argv[])
 {
-	int c;
+	int c, dflag = 0, mflag = 0;
 	char *p;
 
-	while ((c = getopt(argc, argv, "Dd:Ff:l:p:s:Svh?")) != -1) {
+	while ((c = getopt(argc, argv,
+	    "Dd:Ff:H:i:k:L:l:M:m:P:p:R:s:ST:t:W:X:vh?")) != -1) {
 		switch (c) {
 		case 'D':
 			cf_downtimedb = 0;
 			break;
 		case 'd':
 			cf_datadir = optarg;
+			dflag = 1;
 			break;
 		case 'F':
 			cf_fork = 0;
@@ -752,17 +3066,63 @@ parseargs(int argc, char *argv[])
 		case 'f':
 			cf_timefmt = optarg;
 			break;
+		case 'H':
+			cf_hbtable = optarg;
+			break;
+		case 'i':
+			p = NULL;
+			errno = 0;
+			cf_hbslot = strtol(optarg, &p, 10);
+			if ((p != NULL && *p != '\0') || errno != 0 ||
+			    cf_hbslot < 0)
+				errx(EX_USAGE, "-i argument is not a number");
+			break;
+		case 'k':
+			p = NULL;
+			errno = 0;
+			cf_linger = strtol(optarg, &p, 10);
+			if ((p != NULL && *p != '\0') || errno != 0 ||
+			    cf_linger < 0)
+				errx(EX_USAGE, "-k argument is not a number");
+			break;
+		case 'L':
+			p = NULL;
+			errno = 0;
+			cf_slack = strtol(optarg, &p, 10);
+			if ((p != NULL && *p != '\0') || errno != 0 ||
+			    cf_slack < 0)
+				errx(EX_USAGE, "-L argument is not a number");
+			break;
 		case 'l':
 			cf_log = optarg;
 			break;
+		case 'M':
+			p = NULL;
+			errno = 0;
+			cf_metricsint = strtol(optarg, &p, 10);
+			if ((p != NULL && *p != '\0') || errno != 0 ||
+			    cf_metricsint < 1)
+				errx(EX_USAGE, "-M argument is not a number");
+			mflag = 1;
+			break;
+		case 'm':
+			cf_metrics = optarg;
+			break;
+		case 'P':
+			cf_status = optarg;
+			break;
 		case 'p':
 			cf_pidfile = optarg;
 			break;
+		case 'R':
+			cf_push = optarg;
+			break;
 		case 's':
 			p = NULL;
 			errno = 0;
 			cf_sleep = strtol(optarg, &p, 10);
-			if ((p != NULL && *p != '\0') || errno != 0)
+			if ((p != NULL && *p != '\0') || errno != 0 ||
+			    cf_sleep < 1)
 				errx(EX_USAGE, "-s argument is not a number");
 			break;
 		case 'S':
@@ -770,6 +3130,32 @@ parseargs(int argc, char *argv[])
 			cf_fsync = 0;
 #endif
 			break;
+		case 'T':
+			cf_targets = optarg;
+			break;
+		case 't':
+			p = NULL;
+			errno = 0;
+			cf_stall = strtol(optarg, &p, 10);
+			if ((p != NULL && *p != '\0') || errno != 0)
+				errx(EX_USAGE, "-t argument is not a number");
+			break;
+		case 'W':
+			p = NULL;
+			errno = 0;
+			if (strcmp(optarg, "auto") == 0) {
+				cf_window = -1;
+				break;
+			}
+			cf_window = strtol(optarg, &p, 10);
+			if ((p != NULL && *p != '\0') || errno != 0 ||
+			    cf_window < 0)
+				errx(EX_USAGE,
+				    "-W argument is not a number or auto");
+			break;
+		case 'X':
+			cf_simulate = optarg;
+			break;
 		case 'v':
 			version();
 			/* NOTREACHED */
@@ -784,6 +3170,19 @@ parseargs(int argc, char *argv[])
 	}
 	if (argc != optind)
 		usage();
+	if (dflag && cf_targets != NULL)
+		errx(EX_USAGE, "-d and -T are mutually exclusive");
+	if (cf_hbtable != NULL && cf_targets != NULL)
+		errx(EX_USAGE, "-H and -T are mutually exclusive");
+	if ((cf_hbtable != NULL) != (cf_hbslot >= 0))
+		errx(EX_USAGE, "-H and -i must be given together");
+	if (mflag && cf_metrics == NULL)
+		errx(EX_USAGE, "-M can only be used with -m");
+	if (cf_push != NULL && !cf_downtimedb)
+		errx(EX_USAGE, "-D and -R are mutually exclusive");
+	if (cf_simulate != NULL &&
+	    (cf_metrics != NULL || cf_status != NULL || cf_push != NULL))
+		errx(EX_USAGE, "-X can not be used with -m, -P or -R");
 }
 
 /*
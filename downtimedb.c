@@ -44,6 +44,7 @@
 #endif
 
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -69,6 +70,12 @@
  */
 
 #ifndef WORDS_BIGENDIAN
+#define MY_BSWAP32(n)			\
+	(((n) << 24)			\
+	| (((n) & 0xff00) << 8)		\
+	| (((n) >> 8) & 0xff00)		\
+	| ((n) >> 24))
+
 #define MY_BSWAP64(n)			\
 	(((n) << 56)			\
 	| (((n) & 0xff00) << 40)	\
@@ -104,6 +111,7 @@ downtimedb_read(int fd, struct downtimedb *buf)
 	}
 
 #ifndef WORDS_BIGENDIAN
+	buf->aux = MY_BSWAP32(buf->aux);
 	buf->when = (int64_t) MY_BSWAP64((uint64_t) buf->when);
 #endif
 
@@ -119,6 +127,7 @@ int
 downtimedb_write(int fd, struct downtimedb *buf)
 {
 #ifndef WORDS_BIGENDIAN
+	buf->aux = MY_BSWAP32(buf->aux);
 	buf->when = (int64_t) MY_BSWAP64((uint64_t) buf->when);
 #endif
 
@@ -130,6 +139,160 @@ downtimedb_write(int fd, struct downtimedb *buf)
 	return (0);
 }
 
+/*
+ * Decode one record from a memory buffer holding the raw database
+ * contents. The buffer does not need to be aligned.
+ */
+
+void
+downtimedb_decode(const void *p, struct downtimedb *buf)
+{
+
+	memcpy(buf, p, sizeof(struct downtimedb));
+
+#ifndef WORDS_BIGENDIAN
+	buf->aux = MY_BSWAP32(buf->aux);
+	buf->when = (int64_t) MY_BSWAP64((uint64_t) buf->when);
+#endif
+}
+
+/*
+ * Encode one record into the raw database format in a memory buffer,
+ * which does not need to be aligned. The record is left intact.
+ */
+
+void
+downtimedb_encode(const struct downtimedb *ent, void *p)
+{
+	struct downtimedb buf;
+
+	buf = *ent;
+#ifndef WORDS_BIGENDIAN
+	buf.aux = MY_BSWAP32(buf.aux);
+	buf.when = (int64_t) MY_BSWAP64((uint64_t) buf.when);
+#endif
+
+	memcpy(p, &buf, sizeof(struct downtimedb));
+}
+
+/*
+ * Functions for pairing the down and up records into downtime periods.
+ *
+ * Feed the records one at a time to downtimedb_parse(). It returns 1
+ * and fills in the struct downtime when a period can be reported,
+ * otherwise 0. At the end of input call downtimedb_parse_end() to flush
+ * a period for which the up record has not been seen (yet).
+ */
+
+void
+downtimedb_parse_init(struct downtimedb_parser *p, int64_t tadjust)
+{
+
+	p->tdown = 0;
+	p->what = DOWNTIMEDB_WHAT_SHUTDOWN;
+	p->aux = 0;
+	p->tadjust = tadjust;
+}
+
+int
+downtimedb_parse(struct downtimedb_parser *p, const struct downtimedb *ent,
+    struct downtime *dt)
+{
+	int ret = 0;
+
+	switch (ent->what) {
+	case DOWNTIMEDB_WHAT_SHUTDOWN:
+	case DOWNTIMEDB_WHAT_SUSPEND:
+		if (p->tdown != 0) {
+			dt->what = ent->what;
+			dt->down = ent->when;
+			dt->up = 0;
+			dt->boot = 0;
+			dt->stop = ent->aux;
+			ret = 1;
+		}
+		p->tdown = ent->when;
+		p->what = ent->what;
+		p->aux = ent->aux;
+		break;
+	case DOWNTIMEDB_WHAT_CRASH:
+		if (p->tdown != 0) {
+			dt->what = DOWNTIMEDB_WHAT_CRASH;
+			dt->down = ent->when + p->tadjust;
+			dt->up = 0;
+			dt->boot = 0;
+			dt->stop = 0;
+			ret = 1;
+		}
+		p->tdown = ent->when;
+		p->what = DOWNTIMEDB_WHAT_CRASH;
+		p->aux = 0;
+		break;
+	case DOWNTIMEDB_WHAT_UP:
+	case DOWNTIMEDB_WHAT_RESUME:
+		dt->what = p->what;
+		dt->down = p->what == DOWNTIMEDB_WHAT_CRASH ?
+		    p->tdown + p->tadjust : p->tdown;
+		dt->up = ent->when;
+		dt->boot = ent->what == DOWNTIMEDB_WHAT_UP ? ent->aux : 0;
+		dt->stop = p->aux;
+		p->tdown = 0;
+		p->aux = 0;
+		ret = 1;
+		break;
+	case DOWNTIMEDB_WHAT_STALL:
+		/* does not affect the pairing of the other records */
+		dt->what = DOWNTIMEDB_WHAT_STALL;
+		dt->down = ent->when;
+		dt->up = ent->when + ent->aux;
+		dt->boot = 0;
+		dt->stop = 0;
+		ret = 1;
+		break;
+	case DOWNTIMEDB_WHAT_NONE:
+	default:
+		break;
+	}
+
+	return (ret);
+}
+
+int
+downtimedb_parse_end(struct downtimedb_parser *p, struct downtime *dt)
+{
+
+	if (p->tdown == 0)
+		return (0);
+
+	dt->what = p->what;
+	dt->down = p->tdown;
+	dt->up = 0;
+	dt->boot = 0;
+	dt->stop = p->aux;
+	p->tdown = 0;
+	p->aux = 0;
+
+	return (1);
+}
+
+/* CRC-32 as used by zlib and Ethernet, computed bit by bit */
+
+uint32_t
+downtimedb_crc32(const void *buf, size_t len)
+{
+	const unsigned char *p = buf;
+	uint32_t crc = 0xffffffff;
+	int i;
+
+	while (len-- > 0) {
+		crc ^= *p++;
+		for (i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+	}
+
+	return (~crc);
+}
+
 /*
  * Return time string of absolute time in static buffer.
  * Certainly not thread-safe.
@@ -46,7 +46,8 @@
 
 struct downtimedb {
 	uint8_t	what;		/* Op code of the recorded event  */
-	uint8_t	_padding[7];	/* Reserved for future extensions */
+	uint8_t	_padding[3];	/* Reserved for future extensions */
+	uint32_t aux;		/* Event specific data, big-endian */
 	int64_t	when;		/* UNIX time in big-endian format */
 };
 
@@ -54,6 +55,61 @@ struct downtimedb {
 #define	DOWNTIMEDB_WHAT_UP		1
 #define	DOWNTIMEDB_WHAT_SHUTDOWN	2
 #define	DOWNTIMEDB_WHAT_CRASH		3
+#define	DOWNTIMEDB_WHAT_STALL		4	/* aux: duration in seconds */
+#define	DOWNTIMEDB_WHAT_SUSPEND		5
+#define	DOWNTIMEDB_WHAT_RESUME		6
+
+/*
+ * An up record written by downtimed(8) at boot tells in its aux data
+ * how long the boot took: the seconds from boot until downtimed was
+ * started, and the milliseconds from then on until its first time
+ * stamp was on the disk. Older records have no aux data.
+ */
+
+#define	DOWNTIMEDB_BOOT_KNOWN		0x80000000
+#define	DOWNTIMEDB_BOOT_MAXSTART	0x7fff
+#define	DOWNTIMEDB_BOOT_MAXSTAMP	0xffff
+#define	DOWNTIMEDB_BOOT_START(aux)	\
+	(((aux) >> 16) & DOWNTIMEDB_BOOT_MAXSTART)
+#define	DOWNTIMEDB_BOOT_STAMP(aux)	((aux) & DOWNTIMEDB_BOOT_MAXSTAMP)
+
+/*
+ * A shutdown record is written with the time downtimed(8) was last
+ * seen running. Its aux data tells how many seconds earlier the
+ * shutdown began, that is, when downtimed got the signal to stop.
+ * Older records have no aux data.
+ */
+#define	DOWNTIMEDB_STOP_KNOWN		0x80000000
+#define	DOWNTIMEDB_STOP_MAX		0x7fffffff
+#define	DOWNTIMEDB_STOP_SECS(aux)	((aux) & DOWNTIMEDB_STOP_MAX)
+
+/*
+ * A downtime period as decoded from a sequence of database records
+ * by downtimedb_parse(). Times which are not known are zero. A stall
+ * of the running system is reported as a period of its own. A suspend
+ * is paired with the following resume like a shutdown with an up.
+ */
+
+struct downtime {
+	int	what;		/* SHUTDOWN, CRASH, STALL or SUSPEND */
+	int64_t	down;		/* when the system went down */
+	int64_t	up;		/* when the system came up again */
+	uint32_t boot;		/* aux data of the up record, see above */
+	uint32_t stop;		/* aux data of the shutdown record */
+};
+
+/*
+ * State carried from one record to the next while pairing the down
+ * and up records. The caller may feed records in arbitrarily sized
+ * batches; a pair split between two batches is handled correctly.
+ */
+
+struct downtimedb_parser {
+	int64_t	tdown;		/* pending down time, 0 if none */
+	int	what;		/* op code of the pending down record */
+	uint32_t aux;		/* aux data of the pending down record */
+	int64_t	tadjust;	/* crash time adjustment in seconds */
+};
 
 #if defined(__linux__) || \
 	(defined(__FreeBSD_kernel__) && !defined(__FreeBSD__)) \
@@ -73,6 +129,13 @@ struct downtimedb {
 
 int	downtimedb_read(int, struct downtimedb *);
 int	downtimedb_write(int, struct downtimedb *);
+void	downtimedb_decode(const void *, struct downtimedb *);
+void	downtimedb_encode(const struct downtimedb *, void *);
+void	downtimedb_parse_init(struct downtimedb_parser *, int64_t);
+int	downtimedb_parse(struct downtimedb_parser *,
+	    const struct downtimedb *, struct downtime *);
+int	downtimedb_parse_end(struct downtimedb_parser *, struct downtime *);
+uint32_t downtimedb_crc32(const void *, size_t);
 char *	timestr_abs(time_t, const char *, int);
 char *	timestr_int(time_t);
 
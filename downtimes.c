@@ -34,153 +34,2085 @@
 #include "config.h"
 #endif
 
+/*
+ * _GNU_SOURCE is required to enable strptime() in <time.h>
+ * on GNU/Linux.
+ */
+
+#if defined(__linux__) || defined(__GLIBC__) || defined(__GNU__)
+/* GNU/Linux, GNU/kFreeBSD, and GNU/Hurd */
+#define	_GNU_SOURCE
+/* the following is needed to silence _BSD_SOURCE deprecation warning in modern glibc: */
+#define _DEFAULT_SOURCE
+#endif
+
 /* Standard includes that we need */
 
-#include <sys/file.h>
-#include <sys/stat.h>
-#include <sys/time.h>
-#include <sys/types.h>
+#include <sys/file.h>
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
+#if defined(HAVE_SYS_SENDFILE_H) && defined(__linux__)
+#include <sys/sendfile.h>
+#endif
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <libgen.h>
+
+#ifdef HAVE_PATHS_H
+#include <paths.h>
+#endif
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "downtimedb.h"
+#include "heap.h"
+#include "archive.h"
+#include "ckpt.h"
+#include "dbcheck.h"
+#include "dbmerge.h"
+#include "dbscan.h"
+#include "hbtable.h"
+#include "push.h"
+#include "sketch.h"
+#include "status.h"
+
+/* Some global defines */
+
+#define	PROGNAME "downtimes"
+
+/* PACKAGE_VERSION is defined by autoconf, if used. */
+#ifdef PACKAGE_VERSION
+#define	PROGVERSION PACKAGE_VERSION
+#else
+#define	PROGVERSION "0.0undef"
+#endif
+
+/* Bytes copied at a time with -r when sendfile(2) can not be used */
+
+#define	RAW_COPYSIZE	(1024 * 1024)
+
+/* How often to check for new records in follow mode without inotify */
+
+#define	FOLLOW_POLL	1
+
+/*
+ * Read buffer size per database file. Kept small so that hundreds of
+ * files can be merged with modest memory use.
+ */
+
+#define	SOURCE_BUFSIZE	(256 * sizeof(struct downtimedb))
+
+/*
+ * A host whose heartbeat is older than this many times the sleep time
+ * of downtimed(8) is considered silent, see liveness()
+ */
+
+#define	LIVENESS_FACTOR		2
+#define	LIVENESS_DEFSLEEP	15
+
+/* Overlap computation modes */
+
+#define	OVERLAP_NONE	0
+#define	OVERLAP_ANY	1
+#define	OVERLAP_ALL	2
+
+/* Duration statistics of one host, see account() */
+
+struct stats {
+	struct sketch	down;
+	struct sketch	up;
+	struct sketch	stall;
+	struct sketch	stop;		/* from the signal to last seen */
+};
+
+/*
+ * Boot durations of one host in milliseconds, see boot(). The latest
+ * BOOT_RECENT totals are kept apart to be compared with the earlier
+ * ones; a median BOOT_SLOWER times the earlier one is reported.
+ */
+
+#define	BOOT_RECENT	10
+#define	BOOT_SLOWER	1.5
+
+struct boots {
+	struct sketch	start;		/* from boot to downtimed start */
+	struct sketch	stamp;		/* from then to first time stamp */
+	struct sketch	total;
+	struct sketch	earlier;	/* totals before the recent ones */
+	int64_t		recent[BOOT_RECENT];	/* a ring of totals */
+	long		n;		/* boots with known duration */
+	long		unknown;	/* boots recorded by older versions */
+	int64_t		first;		/* time of the first boot */
+	double		sx, sy, sxx, sxy;	/* for the trend */
+};
+
+/*
+ * A host whose records are being read. A database file holds the
+ * records of a single host, an archive may hold many hosts.
+ */
+
+struct host {
+	const char	*name;
+	int		 idx;		/* index in hosts[] */
+	struct downtimedb_parser parser;
+	int64_t		 lastup;	/* up time of the previous period */
+	int64_t		 prevup;	/* same for -U, whether shown or not */
+	struct stats	*stats;		/* duration statistics if cf_stats */
+	struct boots	*boots;		/* boot durations if cf_boots */
+};
+
+/*
+ * Records which are kept together when writing an archive: a down
+ * record and the up record following it, or a lone record.
+ */
+
+struct unit {
+	struct host	*host;
+	int		 n;
+	struct downtimedb ent[2];
+};
+
+/* A downtime period kept for the list of the longest ones */
+
+struct longest {
+	int64_t			 duration;
+	struct downtime		 dt;
+	const struct host	*host;
+};
+
+/* One input file and the state of reading it */
+
+struct source {
+	const char	*name;
+	int		 idx;
+	int		 fd;
+	struct host	*hosts;		/* hosts of the file */
+	int		 nhosts;
+	struct downtime	 dt;		/* next downtime period to output */
+	struct host	*dthost;	/* host of dt */
+	int		 flushed;	/* number of hosts flushed at eof */
+	struct unit	 unit;		/* next unit when writing archive */
+	struct downtimedb ahead;	/* record read ahead by source_unit() */
+	struct host	*aheadhost;	/* host of ahead, NULL if none */
+	struct archive	*ar;		/* set if the file is an archive */
+	struct dbscan	*scan;		/* set if read in parallel */
+	int		 arpos;		/* read position in the archive block */
+	size_t		 len;		/* amount of data in buf */
+	size_t		 pos;		/* read position in buf */
+	unsigned char	 buf[SOURCE_BUFSIZE];
+};
+
+/* End time of a downtime period being tracked by overlap() */
+
+struct overlapend {
+	int64_t	when;
+	int	idx;
+};
+
+/* Function prototypes */
+
+int		main(int, char *[]);
+static void	source_open(struct source *, const char *, int);
+static void	source_scan(struct source *);
+static struct host *
+		source_addhost(struct source *, const char *);
+static int	source_record(struct source *, struct downtimedb *,
+		    struct host **);
+static int	source_next(struct source *, int);
+static int	source_unit(struct source *);
+static int	source_cmp(const void *, const void *);
+static int	unit_cmp(const void *, const void *);
+static void	merge(struct source *, int);
+static void	writearchive(struct source *, int);
+static void	follow(struct source *);
+static int	reopen(struct source *);
+static int	inrange(const struct downtime *);
+static int	match(struct host *, const struct downtime *);
+static void	overlap(const struct source *);
+static void	overlap_advance(int64_t);
+static int	overlapend_cmp(const void *, const void *);
+static void	account(const struct source *);
+static int	longest_cmp(const void *, const void *);
+static void	summary(void);
+static void	summary_line(const char *, const char *, const struct sketch *);
+static void	boot(const struct source *);
+static void	bootsummary(void);
+static void	bootsummary_line(const char *, const char *,
+		    const struct sketch *);
+static int	int64_cmp(const void *, const void *);
+static void	longest(void);
+static void	report(const struct host *, const struct downtime *);
+static void	period(const char *, int64_t, int64_t);
+static void	liveness(void);
+static void	showstatus(void);
+static void	totals(void);
+static void	totals_line(const char *, const struct ckpt_state *,
+		    const struct ckpt_state *);
+static void	checkpoints(void);
+static void	integrity(void);
+static void	mergedb(void);
+static void	rawexport(void);
+static off_t	pairstart(int, const char *, off_t);
+static void	rawcopy(int, const char *, off_t, off_t);
+static void	collect(void);
+static int64_t	parsetime(const char *, const char *);
+static int64_t	parseduration(const char *, const char *);
+#ifndef HAVE_TIMEGM
+static time_t	timegm(struct tm *);
+#endif
+static void	version(void);
+static void	usage(void);
+static void	parseargs(int, char *[]);
+
+/* Command line arguments with their defaults */
+
+static long	cf_sleep = 0; /* adjust crash time according to sleep value */
+static char *	cf_downtimedbfile = PATH_DOWNTIMEDBFILE;
+static char **	cf_downtimedbfiles = &cf_downtimedbfile;
+static int	cf_ndowntimedbfiles = 1;
+static long	cf_n = -1;         /* number of downtime records to display */
+static char *	cf_timefmt = FMT_DATETIME;
+static int	cf_utc = 0;                  /* set to display times in UTC */
+static int	cf_follow = 0;        /* set to wait for new records forever */
+static int	cf_overlap = OVERLAP_NONE;  /* report overlapping downtime */
+static int	cf_stats = 0;       /* set to report duration percentiles */
+static int	cf_boots = 0;      /* set to report boot durations instead */
+static long	cf_topk = 0;    /* number of longest downtimes to report */
+static char *	cf_archive = NULL;     /* archive file to write, if any */
+static char *	cf_begin = NULL;         /* beginning of reporting period */
+static char *	cf_end = NULL;                 /* end of reporting period */
+static char *	cf_hbtable = NULL;     /* heartbeat table to display */
+static char *	cf_status = NULL;         /* status page to display */
+static int	cf_totals = 0;  /* set to report totals of reporting period */
+static char *	cf_ckpt = NULL;       /* checkpoint action: check, rebuild */
+static char *	cf_check = NULL;       /* database action: check, repair */
+static long	cf_jobs = 0;     /* threads, 0 for one per processor */
+static char *	cf_merge = NULL;     /* database to merge the files into */
+static long	cf_mergemem = 256;   /* megabytes of records to sort at once */
+static int	cf_what = 0;   /* mask of kinds of downtime to show, 0 all */
+static int64_t	cf_mindown = -1;       /* shortest downtime to show or -1 */
+static int64_t	cf_maxdown = -1;        /* longest downtime to show or -1 */
+static int64_t	cf_uptime = -1;      /* show downtime after shorter uptime */
+static char *	cf_raw = NULL;    /* time or +offset to export records from */
+static char *	cf_collect = NULL;   /* address to take pushed records at */
+
+/* Global variables */
+
+static int64_t	tbegin = INT64_MIN;	/* reporting period from cf_begin */
+static int64_t	tend = INT64_MAX;	/* reporting period from cf_end */
+
+static struct host **hosts;	/* all hosts of all sources */
+static int	nhosts;
+static int	tagwidth = 0;	/* width of host name tag, 0 if no tag */
+
+static struct heap ov_ends;	/* end times of tracked downtime periods */
+static int *	ov_active;	/* number of tracked periods per host */
+static int	ov_ndown;	/* number of hosts currently down */
+static int	ov_need;	/* number of hosts down to report */
+static int64_t	ov_start;	/* start of current overlapping period */
+static int64_t	ov_total;	/* total overlapping downtime */
+static long	ov_count;	/* number of overlapping periods */
+
+static struct heap top;		/* longest downtime periods seen so far */
+
+/*
+ * downtimes: display system downtime records made by downtimed(8)
+ */
+
+int
+main(int argc, char *argv[])
+{
+	struct source *src;
+	int i, nsrc;
+
+	/* parse command line arguments */
+	parseargs(argc, argv);
+
+	if (cf_hbtable != NULL) {
+		liveness();
+		exit(EX_OK);
+	}
+
+	if (cf_status != NULL) {
+		showstatus();
+		/* NOTREACHED */
+	}
+
+	if (cf_ckpt != NULL) {
+		checkpoints();
+		/* NOTREACHED */
+	}
+
+	if (cf_check != NULL) {
+		integrity();
+		/* NOTREACHED */
+	}
+
+	if (cf_merge != NULL) {
+		mergedb();
+		exit(EX_OK);
+	}
+
+	if (cf_raw != NULL) {
+		rawexport();
+		exit(EX_OK);
+	}
+
+	if (cf_collect != NULL) {
+		collect();
+		/* NOTREACHED */
+	}
+
+	if (cf_totals) {
+		totals();
+		exit(EX_OK);
+	}
+
+	nsrc = cf_ndowntimedbfiles;
+
+	if (cf_follow && nsrc > 1)
+		errx(EX_USAGE, "can not follow more than one database");
+
+	if ((src = calloc(nsrc, sizeof(struct source))) == NULL)
+		err(EX_OSERR, "calloc failed");
+
+	for (i = 0; i < nsrc; i++) {
+		source_open(&src[i], cf_downtimedbfiles[i], i);
+		source_scan(&src[i]);
+	}
+
+	if (cf_follow && src->ar != NULL)
+		errx(EX_USAGE, "can not follow an archive");
+
+	if (cf_archive != NULL) {
+		writearchive(src, nsrc);
+		exit(EX_OK);
+	}
+
+	for (i = 0; i < nhosts; i++) {
+		if (nhosts > 1 && strlen(hosts[i]->name) > tagwidth)
+			tagwidth = strlen(hosts[i]->name);
+		if (cf_boots) {
+			if ((hosts[i]->boots = calloc(1,
+			    sizeof(struct boots))) == NULL)
+				err(EX_OSERR, "calloc failed");
+			sketch_init(&hosts[i]->boots->start);
+			sketch_init(&hosts[i]->boots->stamp);
+			sketch_init(&hosts[i]->boots->total);
+			sketch_init(&hosts[i]->boots->earlier);
+		}
+		if (cf_stats) {
+			if ((hosts[i]->stats = malloc(sizeof(struct stats)))
+			    == NULL)
+				err(EX_OSERR, "malloc failed");
+			sketch_init(&hosts[i]->stats->down);
+			sketch_init(&hosts[i]->stats->up);
+			sketch_init(&hosts[i]->stats->stall);
+			sketch_init(&hosts[i]->stats->stop);
+		}
+	}
+
+	/* the line for all hosts combined is tagged "total" */
+	if ((cf_stats || cf_boots) && nhosts > 1 && tagwidth < 5)
+		tagwidth = 5;
+
+	if (cf_topk > 0 &&
+	    heap_init(&top, sizeof(struct longest), cf_topk, longest_cmp) < 0)
+		err(EX_OSERR, "malloc failed");
+
+	if (cf_follow) {
+		follow(src);
+		/* NOTREACHED */
+	}
+
+	merge(src, nsrc);
+
+	if (cf_stats)
+		summary();
+
+	if (cf_boots)
+		bootsummary();
+
+	if (cf_topk > 0)
+		longest();
+
+	for (i = 0; i < nsrc; i++) {
+		close(src[i].fd);
+		if (src[i].scan != NULL) {
+			dbscan_close(src[i].scan);
+			free(src[i].scan);
+		}
+		if (src[i].ar != NULL) {
+			archive_free(src[i].ar);
+			free(src[i].ar);
+		}
+	}
+	free(src);
+
+	exit(EX_OK);
+}
+
+/*
+ * Open a database file or an archive. A database file is positioned
+ * so that the cf_n latest downtime records are going to be read.
+ */
+
+static void
+source_open(struct source *s, const char *name, int idx)
+{
+	unsigned char magic[ARCHIVE_MAGICLEN];
+	struct stat sb;
+	off_t nrec, n, i, j;
+	ssize_t ret;
+
+	s->name = name;
+	s->idx = idx;
+
+	if ((s->fd = open(name, O_RDONLY)) < 0) {
+		fputs("Maybe the system has not been down yet?\n", stderr);
+		err(EX_NOINPUT, "can not open %s", name);
+	}
+
+	if (fstat(s->fd, &sb) < 0)
+		err(EX_NOINPUT, "can not stat %s", name);
+
+	if ((ret = read(s->fd, magic, sizeof(magic))) < 0 ||
+	    lseek(s->fd, 0, SEEK_SET) < 0)
+		err(EX_NOINPUT, "can not read %s", name);
+
+	if (archive_ismagic(magic, ret)) {
+		if ((s->ar = malloc(sizeof(struct archive))) == NULL)
+			err(EX_OSERR, "malloc failed");
+		if (archive_open(s->ar, s->fd) < 0)
+			err(EX_DATAERR, "can not open archive %s", name);
+		for (i = 0; i < s->ar->nhosts; i++)
+			source_addhost(s, s->ar->hosts[i]);
+		return;
+	}
+
+	source_addhost(s, name);
+
+	/*
+	 * When following, a record might be just being written. The
+	 * incomplete tail is picked up by follow() once it is complete.
+	 */
+	if (!cf_follow && sb.st_size % sizeof(struct downtimedb) != 0)
+		errx(EX_DATAERR, "%s is corrupted, see -C", name);
+
+	if (cf_n == -1 || cf_archive != NULL)
+		return;
+
+	/*
+	 * Each downtime consists of a down and an up record. Stall
+	 * records come alone and are not counted, so look for the start
+	 * of the cf_n latest downtimes backwards from the end.
+	 */
+	nrec = sb.st_size / sizeof(struct downtimedb);
+	for (n = cf_n * 2; nrec > 0 && n > 0; nrec -= i - j) {
+		i = SOURCE_BUFSIZE / sizeof(struct downtimedb);
+		if (i > nrec)
+			i = nrec;
+		if (pread(s->fd, s->buf, i * sizeof(struct downtimedb),
+		    (nrec - i) * sizeof(struct downtimedb)) !=
+		    i * sizeof(struct downtimedb))
+			err(EX_DATAERR, "error reading %s", name);
+		for (j = i; j > 0 && n > 0; j--)
+			if (s->buf[(j - 1) * sizeof(struct downtimedb)] !=
+			    DOWNTIMEDB_WHAT_STALL)
+				n--;
+	}
+
+	if (lseek(s->fd, nrec * sizeof(struct downtimedb), SEEK_SET) < 0)
+		err(EX_DATAERR, "can not seek %s", name);
+}
+
+/*
+ * Set up a database file to be decoded in parallel from the position
+ * left by source_open() on. Records which are read as they are written
+ * or copied into an archive one by one are read with source_record().
+ */
+
+static void
+source_scan(struct source *s)
+{
+	struct stat sb;
+	off_t pos;
+
+	if (s->ar != NULL || cf_follow || cf_archive != NULL)
+		return;
+
+	if (fstat(s->fd, &sb) < 0 || (pos = lseek(s->fd, 0, SEEK_CUR)) < 0)
+		err(EX_NOINPUT, "can not read %s", s->name);
+
+	/* the same as source_next() finds reading record by record */
+	if (sb.st_size % sizeof(struct downtimedb) != 0)
+		errx(EX_DATAERR, "error reading %s: incomplete record",
+		    s->name);
+
+	if ((s->scan = malloc(sizeof(struct dbscan))) == NULL)
+		err(EX_OSERR, "malloc failed");
+	if (dbscan_open(s->scan, s->fd, pos / sizeof(struct downtimedb),
+	    sb.st_size / sizeof(struct downtimedb), (int)cf_jobs,
+	    cf_sleep / 2) < 0)
+		err(EX_OSERR, "malloc failed");
+}
+
+/* Add a host to a source and to the list of all hosts */
+
+static struct host *
+source_addhost(struct source *s, const char *name)
+{
+	struct host *h;
+
+	/* hosts of a source are allocated once as the count is known */
+	if (s->hosts == NULL &&
+	    (s->hosts = calloc(s->ar != NULL ? s->ar->nhosts : 1,
+	    sizeof(struct host))) == NULL)
+		err(EX_OSERR, "calloc failed");
+
+	if ((hosts = realloc(hosts, (nhosts + 1) * sizeof(struct host *)))
+	    == NULL)
+		err(EX_OSERR, "realloc failed");
+
+	h = &s->hosts[s->nhosts++];
+	h->name = name;
+	h->idx = nhosts;
+	h->lastup = 0;
+	h->prevup = 0;
+	downtimedb_parse_init(&h->parser, cf_sleep / 2);
+
+	hosts[nhosts++] = h;
+
+	return (h);
+}
+
+/*
+ * Read the next record of a source and the host it belongs to.
+ * Return 1 if a record was read, 0 if there are no more records.
+ * Blocks of an archive outside of the reporting period are skipped.
+ */
+
+static int
+source_record(struct source *s, struct downtimedb *ent, struct host **hp)
+{
+	ssize_t ret;
+	int n;
+
+	if (s->aheadhost != NULL) {
+		*ent = s->ahead;
+		*hp = s->aheadhost;
+		s->aheadhost = NULL;
+		return (1);
+	}
+
+	if (s->ar != NULL) {
+		if (s->arpos == s->ar->nrec) {
+			if ((n = archive_read(s->ar, tbegin, tend)) < 0)
+				err(EX_DATAERR, "error reading %s", s->name);
+			s->arpos = 0;
+			if (n == 0)
+				return (0);
+		}
+		memset(ent, 0, sizeof(struct downtimedb));
+		ent->what = s->ar->what[s->arpos];
+		ent->when = s->ar->when[s->arpos];
+		ent->aux = s->ar->aux[s->arpos];
+		*hp = &s->hosts[s->ar->host[s->arpos]];
+		s->arpos++;
+		return (1);
+	}
+
+	if (s->len - s->pos < sizeof(struct downtimedb)) {
+		/* keep a partially written record for the next read */
+		memmove(s->buf, s->buf + s->pos, s->len - s->pos);
+		s->len -= s->pos;
+		s->pos = 0;
+
+		if ((ret = read(s->fd, s->buf + s->len,
+		    sizeof(s->buf) - s->len)) < 0)
+			err(EX_DATAERR, "error reading %s", s->name);
+		s->len += ret;
+
+		if (s->len < sizeof(struct downtimedb))
+			return (0);
+	}
+
+	downtimedb_decode(s->buf + s->pos, ent);
+	s->pos += sizeof(struct downtimedb);
+	*hp = s->hosts;
+
+	return (1);
+}
+
+/*
+ * Read records until the next downtime period is found and store it
+ * in s->dt. Return 1 if found, 0 at the end of the file. If flush is
+ * set, a down record without a matching up record is returned at the
+ * end; otherwise it stays pending in case the up record is yet to be
+ * written.
+ */
+
+static int
+source_next(struct source *s, int flush)
+{
+	struct downtimedb dbent;
+	struct host *h;
+	int ret;
+
+	if (s->scan != NULL) {
+		if ((ret = dbscan_next(s->scan, &s->hosts->parser, &s->dt)) < 0)
+			err(EX_DATAERR, "error reading %s", s->name);
+		if (ret) {
+			s->dthost = s->hosts;
+			return (1);
+		}
+	} else {
+		while (source_record(s, &dbent, &h)) {
+			if (downtimedb_parse(&h->parser, &dbent, &s->dt)) {
+				s->dthost = h;
+				return (1);
+			}
+		}
+	}
+
+	if (!flush)
+		return (0);
+
+	if (s->len != s->pos)
+		errx(EX_DATAERR, "error reading %s: incomplete record",
+		    s->name);
+
+	for (; s->flushed < s->nhosts; s->flushed++) {
+		h = &s->hosts[s->flushed];
+		if (downtimedb_parse_end(&h->parser, &s->dt)) {
+			s->dthost = h;
+			return (1);
+		}
+	}
+
+	return (0);
+}
+
+/*
+ * Read the next unit of records into s->unit: a down record together
+ * with the up record of the same host following it, or a single
+ * record. Return 0 if there are no more records.
+ */
+
+static int
+source_unit(struct source *s)
+{
+	struct unit *u = &s->unit;
+	struct host *h;
+
+	if (!source_record(s, &u->ent[0], &u->host))
+		return (0);
+	u->n = 1;
+
+	if ((u->ent[0].what == DOWNTIMEDB_WHAT_SHUTDOWN ||
+	    u->ent[0].what == DOWNTIMEDB_WHAT_CRASH ||
+	    u->ent[0].what == DOWNTIMEDB_WHAT_SUSPEND) &&
+	    source_record(s, &s->ahead, &h)) {
+		if (h == u->host && (s->ahead.what == DOWNTIMEDB_WHAT_UP ||
+		    s->ahead.what == DOWNTIMEDB_WHAT_RESUME))
+			u->ent[u->n++] = s->ahead;
+		else
+			s->aheadhost = h;
+	}
+
+	return (1);
+}
+
+/*
+ * Order sources by the time of their next downtime period. A period
+ * with unknown down time is ordered by its up time.
+ */
+
+static int
+source_cmp(const void *a, const void *b)
+{
+	const struct source *sa = *(struct source * const *)a;
+	const struct source *sb = *(struct source * const *)b;
+	int64_t ta, tb;
+
+	ta = sa->dt.down != 0 ? sa->dt.down : sa->dt.up;
+	tb = sb->dt.down != 0 ? sb->dt.down : sb->dt.up;
+
+	if (ta != tb)
+		return (ta < tb ? -1 : 1);
+
+	return (sa->idx - sb->idx);
+}
+
+/* Order sources by the time of the first record of their next unit */
+
+static int
+unit_cmp(const void *a, const void *b)
+{
+	const struct source *sa = *(struct source * const *)a;
+	const struct source *sb = *(struct source * const *)b;
+
+	if (sa->unit.ent[0].when != sb->unit.ent[0].when)
+		return (sa->unit.ent[0].when < sb->unit.ent[0].when ? -1 : 1);
+
+	return (sa->idx - sb->idx);
+}
+
+/*
+ * Output the downtime periods of all sources in time order. Each file
+ * is assumed to be in time order already, so a k-way merge using a
+ * heap holding the next period of each source is enough. Memory use
+ * is bounded by the number of sources, not by the size of the files.
+ */
+
+static void
+merge(struct source *src, int nsrc)
+{
+	struct heap h;
+	struct source *s;
+	int i;
+
+	if (heap_init(&h, sizeof(struct source *), nsrc, source_cmp) < 0)
+		err(EX_OSERR, "malloc failed");
+
+	for (i = 0; i < nsrc; i++) {
+		s = &src[i];
+		if (source_next(s, 1) && heap_push(&h, &s) < 0)
+			err(EX_OSERR, "malloc failed");
+	}
+
+	if (cf_overlap != OVERLAP_NONE) {
+		if (heap_init(&ov_ends, sizeof(struct overlapend), nhosts,
+		    overlapend_cmp) < 0 ||
+		    (ov_active = calloc(nhosts, sizeof(int))) == NULL)
+			err(EX_OSERR, "malloc failed");
+		ov_need = (cf_overlap == OVERLAP_ALL) ? nhosts : 1;
+	}
+
+	while (h.nmemb > 0) {
+		s = *(struct source **)heap_top(&h);
+
+		if (!match(s->dthost, &s->dt) || !inrange(&s->dt))
+			;
+		else if (cf_overlap != OVERLAP_NONE)
+			overlap(s);
+		else if (cf_boots)
+			boot(s);
+		else if (cf_stats || cf_topk > 0)
+			account(s);
+		else
+			report(s->dthost, &s->dt);
+
+		if (source_next(s, 1))
+			heap_fix_top(&h);
+		else
+			heap_pop(&h, NULL);
+	}
+	heap_free(&h);
+
+	if (cf_overlap != OVERLAP_NONE) {
+		overlap_advance(INT64_MAX);
+		printf("total %s (%"PRId64" s) in %ld periods\n",
+		    timestr_int((time_t)ov_total), ov_total, ov_count);
+		heap_free(&ov_ends);
+		free(ov_active);
+	}
+}
+
+/*
+ * Convert the records of all sources to a single archive. The units
+ * of records are merged in time order in the same way as merge()
+ * merges downtime periods.
+ */
+
+static void
+writearchive(struct source *src, int nsrc)
+{
+	struct archive ar;
+	struct heap h;
+	struct source *s;
+	char **names;
+	int fd, i;
+
+	if ((names = calloc(nhosts, sizeof(char *))) == NULL)
+		err(EX_OSERR, "calloc failed");
+	for (i = 0; i < nhosts; i++)
+		names[i] = (char *)hosts[i]->name;
+
+	if ((fd = open(cf_archive, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0)
+		err(EX_CANTCREAT, "can not create %s", cf_archive);
+
+	if (archive_create(&ar, fd, names, nhosts) < 0)
+		err(EX_IOERR, "can not write %s", cf_archive);
+
+	if (heap_init(&h, sizeof(struct source *), nsrc, unit_cmp) < 0)
+		err(EX_OSERR, "malloc failed");
+
+	for (i = 0; i < nsrc; i++) {
+		s = &src[i];
+		if (source_unit(s) && heap_push(&h, &s) < 0)
+			err(EX_OSERR, "malloc failed");
+	}
+
+	while (h.nmemb > 0) {
+		s = *(struct source **)heap_top(&h);
+
+		if (archive_add(&ar, s->unit.host->idx, s->unit.ent,
+		    s->unit.n) < 0)
+			err(EX_DATAERR, "can not archive %s", s->name);
+
+		if (source_unit(s))
+			heap_fix_top(&h);
+		else
+			heap_pop(&h, NULL);
+	}
+	heap_free(&h);
+
+	for (i = 0; i < nsrc; i++)
+		if (src[i].len != src[i].pos)
+			errx(EX_DATAERR, "error reading %s: incomplete record",
+			    src[i].name);
+
+	if (archive_finish(&ar) < 0 || close(fd) < 0)
+		err(EX_IOERR, "can not write %s", cf_archive);
+
+	free(names);
+}
+
+/*
+ * Wait for new records to be appended to the database and report
+ * them as they arrive. Only the newly written bytes are decoded; an
+ * incomplete record is kept in the buffer until the rest of it has
+ * been written and the parser state carries a down record over to
+ * the matching up record. Uses inotify(7) where available so that
+ * nothing at all is done while the database is idle, otherwise the
+ * file size is polled every FOLLOW_POLL seconds. Never returns.
+ */
+
+static void
+follow(struct source *s)
+{
+	struct stat sb;
+	off_t off;
+#ifdef HAVE_SYS_INOTIFY_H
+	int ifd, wd = -1, dwd = -1;
+	char *dir;
+	char evbuf[4096]
+	    __attribute__ ((aligned(__alignof__(struct inotify_event))));
+
+	if ((ifd = inotify_init()) >= 0 &&
+	    (wd = inotify_add_watch(ifd, s->name,
+	    IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF)) < 0) {
+		close(ifd);
+		ifd = -1;
+	}
+
+	/* the database may be removed and created again later */
+	if (ifd >= 0 && (dir = strdup(s->name)) != NULL) {
+		dwd = inotify_add_watch(ifd, dirname(dir),
+		    IN_CREATE | IN_MOVED_TO);
+		free(dir);
+	}
+#endif
+
+	for (;;) {
+		while (source_next(s, 0))
+			if (match(s->dthost, &s->dt) && inrange(&s->dt))
+				report(s->dthost, &s->dt);
+
+		fflush(stdout);
+
+		/* start over if the database was truncated or replaced */
+		if ((off = lseek(s->fd, 0, SEEK_CUR)) < 0 ||
+		    fstat(s->fd, &sb) < 0)
+			err(EX_IOERR, "can not stat %s", s->name);
+
+		if (sb.st_size < off || reopen(s)) {
+			if (lseek(s->fd, 0, SEEK_SET) < 0)
+				err(EX_IOERR, "can not seek %s", s->name);
+			s->len = s->pos = 0;
+			s->hosts->prevup = 0;
+			downtimedb_parse_init(&s->hosts->parser, cf_sleep / 2);
+#ifdef HAVE_SYS_INOTIFY_H
+			if (ifd >= 0) {
+				inotify_rm_watch(ifd, wd);
+				wd = inotify_add_watch(ifd, s->name,
+				    IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF |
+				    IN_DELETE_SELF);
+			}
+#endif
+			continue;
+		}
+
+#ifdef HAVE_SYS_INOTIFY_H
+		/*
+		 * Block until something happens to the file or a file is
+		 * created in its directory. The events themselves are not
+		 * interesting, we just re-read from the current offset
+		 * whatever the event was. If the file is gone and the
+		 * directory can not be watched, poll for it to reappear.
+		 */
+		if (ifd >= 0 && wd >= 0 &&
+		    (dwd >= 0 || stat(s->name, &sb) == 0)) {
+			if (read(ifd, evbuf, sizeof(evbuf)) < 0 &&
+			    errno != EINTR)
+				err(EX_IOERR, "inotify read failed");
+			continue;
+		}
+#endif
+		sleep(FOLLOW_POLL);
+	}
+}
+
+/*
+ * Check if the database file has been replaced by another one, for
+ * example restored from a backup. If so, open the new one in place of
+ * the old one and return 1. Return 0 if the file is still the same or
+ * if the new file does not exist yet.
+ */
+
+static int
+reopen(struct source *s)
+{
+	struct stat sb, sb2;
+	int fd;
+
+	if (stat(s->name, &sb) < 0 || fstat(s->fd, &sb2) < 0)
+		return (0);
+
+	if (sb.st_dev == sb2.st_dev && sb.st_ino == sb2.st_ino)
+		return (0);
+
+	if ((fd = open(s->name, O_RDONLY)) < 0)
+		return (0);
+
+	close(s->fd);
+	s->fd = fd;
+
+	return (1);
+}
+
+/*
+ * Return 1 if the downtime period is at least partially within the
+ * reporting period given with -b and -e.
+ */
+
+static int
+inrange(const struct downtime *dt)
+{
+
+	return (dt->down <= tend && (dt->up == 0 || dt->up >= tbegin));
+}
+
+/*
+ * Check whether a downtime period passes the -w, -l, -L and -U filters.
+ * Only the decoded times are compared, so periods which are filtered
+ * out are never formatted. This must be called for every period of a
+ * host in order, as the uptime before each period is tracked here.
+ */
+
+static int
+match(struct host *h, const struct downtime *dt)
+{
+	int64_t uptime = -1;
+
+	/* stalls do not end the uptime, like with -S */
+	if (dt->what != DOWNTIMEDB_WHAT_STALL) {
+		if (h->prevup != 0 && dt->down != 0 && dt->down >= h->prevup)
+			uptime = dt->down - h->prevup;
+		h->prevup = dt->up;
+	}
+
+	if (cf_what != 0 && (cf_what & (1 << dt->what)) == 0)
+		return (0);
+
+	/* periods of unknown length are only shown without -l and -L */
+	if (cf_mindown >= 0 || cf_maxdown >= 0) {
+		if (dt->down == 0 || dt->up == 0 || dt->up < dt->down)
+			return (0);
+		if (cf_mindown >= 0 && dt->up - dt->down < cf_mindown)
+			return (0);
+		if (cf_maxdown >= 0 && dt->up - dt->down > cf_maxdown)
+			return (0);
+	}
+
+	if (cf_uptime >= 0 && (uptime < 0 || uptime >= cf_uptime))
+		return (0);
+
+	return (1);
+}
+
+/*
+ * Track the downtime periods of all hosts in time order and output
+ * the periods during which at least ov_need hosts were down at the
+ * same time. Periods with unknown start or end are ignored.
+ */
+
+static void
+overlap(const struct source *s)
+{
+	struct overlapend oe;
+
+	if (s->dt.down == 0 || s->dt.up == 0 || s->dt.up <= s->dt.down ||
+	    s->dt.what == DOWNTIMEDB_WHAT_STALL)
+		return;
+
+	overlap_advance(s->dt.down);
+
+	if (ov_active[s->dthost->idx]++ == 0 && ++ov_ndown == ov_need)
+		ov_start = s->dt.down;
+
+	oe.when = s->dt.up;
+	oe.idx = s->dthost->idx;
+	if (heap_push(&ov_ends, &oe) < 0)
+		err(EX_OSERR, "malloc failed");
+}
+
+/* Retire the tracked periods which have ended by time t */
+
+static void
+overlap_advance(int64_t t)
+{
+	struct overlapend *oe;
+
+	while ((oe = heap_top(&ov_ends)) != NULL && oe->when <= t) {
+		if (--ov_active[oe->idx] == 0 && ov_ndown-- == ov_need) {
+			period(cf_overlap == OVERLAP_ALL ? "all  " : "any  ",
+			    ov_start, oe->when);
+			ov_total += oe->when - ov_start;
+			ov_count++;
+		}
+		heap_pop(&ov_ends, NULL);
+	}
+}
+
+static int
+overlapend_cmp(const void *a, const void *b)
+{
+	const struct overlapend *oa = a, *ob = b;
+
+	if (oa->when != ob->when)
+		return (oa->when < ob->when ? -1 : 1);
+
+	return (0);
+}
+
+/*
+ * Collect duration statistics of one downtime period: add the downtime
+ * and the uptime preceding it to the sketches of the host and keep
+ * the period if it is one of the cf_topk longest seen so far. Stalls
+ * are counted separately as the system was not really down. So is the
+ * time shutdowns took, if it was recorded.
+ */
+
+static void
+account(const struct source *s)
+{
+	struct longest lo, *lp;
+	const struct downtime *dt = &s->dt;
+	struct host *h = s->dthost;
+
+	if (dt->what == DOWNTIMEDB_WHAT_STALL) {
+		if (cf_stats)
+			sketch_add(&h->stats->stall, dt->up - dt->down);
+		return;
+	}
+
+	if (cf_stats && dt->what == DOWNTIMEDB_WHAT_SHUTDOWN &&
+	    (dt->stop & DOWNTIMEDB_STOP_KNOWN))
+		sketch_add(&h->stats->stop, DOWNTIMEDB_STOP_SECS(dt->stop));
+
+	if (dt->down != 0 && dt->up != 0 && dt->up >= dt->down) {
+		lo.duration = dt->up - dt->down;
+		lo.dt = *dt;
+		lo.host = h;
+
+		if (cf_stats)
+			sketch_add(&h->stats->down, lo.duration);
+
+		if (cf_topk > 0) {
+			if (top.nmemb < cf_topk) {
+				if (heap_push(&top, &lo) < 0)
+					err(EX_OSERR, "malloc failed");
+			} else if (lo.duration >
+			    (lp = heap_top(&top))->duration) {
+				*lp = lo;
+				heap_fix_top(&top);
+			}
+		}
+	}
+
+	if (cf_stats && h->lastup != 0 && dt->down != 0 &&
+	    dt->down >= h->lastup)
+		sketch_add(&h->stats->up, dt->down - h->lastup);
+
+	h->lastup = dt->up;
+}
+
+static int
+longest_cmp(const void *a, const void *b)
+{
+	const struct longest *la = a, *lb = b;
+
+	if (la->duration != lb->duration)
+		return (la->duration < lb->duration ? -1 : 1);
+
+	/* among equally long ones prefer to keep the most recent */
+	if (la->dt.down != lb->dt.down)
+		return (la->dt.down < lb->dt.down ? -1 : 1);
+
+	return (0);
+}
+
+/*
+ * Output downtime, uptime, stall and shutdown percentiles of each host
+ * and, when there are several, of all of them combined.
+ */
+
+static void
+summary(void)
+{
+	struct stats *all;
+	int i;
+
+	if (tagwidth > 0)
+		printf("%-*s ", tagwidth, "");
+	printf("%-8s %8s %11s %11s %11s %11s\n",
+	    "", "count", "p50", "p90", "p99", "max");
+
+	for (i = 0; i < nhosts; i++) {
+		summary_line(hosts[i]->name, "downtime",
+		    &hosts[i]->stats->down);
+		summary_line(hosts[i]->name, "uptime", &hosts[i]->stats->up);
+		summary_line(hosts[i]->name, "stall", &hosts[i]->stats->stall);
+		summary_line(hosts[i]->name, "stop", &hosts[i]->stats->stop);
+	}
+
+	if (nhosts < 2)
+		return;
+
+	if ((all = malloc(sizeof(struct stats))) == NULL)
+		err(EX_OSERR, "malloc failed");
+
+	sketch_init(&all->down);
+	sketch_init(&all->up);
+	sketch_init(&all->stall);
+	sketch_init(&all->stop);
+	for (i = 0; i < nhosts; i++) {
+		sketch_merge(&all->down, &hosts[i]->stats->down);
+		sketch_merge(&all->up, &hosts[i]->stats->up);
+		sketch_merge(&all->stall, &hosts[i]->stats->stall);
+		sketch_merge(&all->stop, &hosts[i]->stats->stop);
+	}
+
+	summary_line("total", "downtime", &all->down);
+	summary_line("total", "uptime", &all->up);
+	summary_line("total", "stall", &all->stall);
+	summary_line("total", "stop", &all->stop);
+
+	free(all);
+}
+
+static void
+summary_line(const char *tag, const char *label, const struct sketch *sk)
+{
+	static const double q[] = { 0.50, 0.90, 0.99 };
+	int i;
+
+	if (tagwidth > 0)
+		printf("%-*s ", tagwidth, tag);
+	printf("%-8s %8"PRIu64, label, sk->count);
+
+	/* one at a time because timestr_int() uses a static buffer */
+	for (i = 0; i < sizeof(q) / sizeof(q[0]); i++)
+		printf(" %11s", timestr_int((time_t)sketch_quantile(sk, q[i])));
+	printf(" %11s\n", timestr_int((time_t)sk->max));
+}
+
+/*
+ * Account the boot duration carried by the up record of a downtime
+ * period and output it. Periods ending in a resume are not boots.
+ */
+
+static void
+boot(const struct source *s)
+{
+	const struct downtime *dt = &s->dt;
+	struct boots *b = s->dthost->boots;
+	int64_t start, stamp, total;
+	double x, y;
+
+	if (dt->up == 0 || dt->what == DOWNTIMEDB_WHAT_STALL ||
+	    dt->what == DOWNTIMEDB_WHAT_SUSPEND)
+		return;
+
+	if (tagwidth > 0)
+		printf("%-*s ", tagwidth, s->dthost->name);
+	printf("boot  %s ", timestr_abs((time_t)dt->up, cf_timefmt, cf_utc));
+
+	if (!(dt->boot & DOWNTIMEDB_BOOT_KNOWN)) {
+		printf("= %11s\n", "unknown");
+		b->unknown++;
+		return;
+	}
+
+	start = DOWNTIMEDB_BOOT_START(dt->boot);
+	stamp = DOWNTIMEDB_BOOT_STAMP(dt->boot);
+	total = start * 1000 + stamp;
+	printf("start %5"PRId64" s + stamp %5"PRId64" ms = %9.3f s\n",
+	    start, stamp, total / 1000.0);
+
+	sketch_add(&b->start, start * 1000);
+	sketch_add(&b->stamp, stamp);
+	sketch_add(&b->total, total);
+
+	/* the oldest of the recent boots becomes an earlier one */
+	if (b->n >= BOOT_RECENT)
+		sketch_add(&b->earlier, b->recent[b->n % BOOT_RECENT]);
+	b->recent[b->n % BOOT_RECENT] = total;
+
+	/* least squares fit of the total in seconds over days */
+	if (b->n == 0)
+		b->first = dt->up;
+	x = (dt->up - b->first) / 86400.0;
+	y = total / 1000.0;
+	b->sx += x;
+	b->sy += y;
+	b->sxx += x * x;
+	b->sxy += x * y;
+	b->n++;
+}
+
+/*
+ * Output the percentiles of the boot durations of each host, and the
+ * trend of the total: how much it grows in 30 days and whether the
+ * latest boots are clearly slower than the earlier ones.
+ */
+
+static void
+bootsummary(void)
+{
+	struct boots *b, *all;
+	int64_t recent[BOOT_RECENT], median;
+	double d;
+	int i, n;
+
+	if (tagwidth > 0)
+		printf("%-*s ", tagwidth, "");
+	printf("%-8s %8s %11s %11s %11s %11s\n",
+	    "", "count", "p50", "p90", "p99", "max");
+
+	for (i = 0; i < nhosts; i++) {
+		b = hosts[i]->boots;
+		bootsummary_line(hosts[i]->name, "start", &b->start);
+		bootsummary_line(hosts[i]->name, "stamp", &b->stamp);
+		bootsummary_line(hosts[i]->name, "total", &b->total);
+		if (b->unknown > 0) {
+			if (tagwidth > 0)
+				printf("%-*s ", tagwidth, hosts[i]->name);
+			printf("%-8s %8ld\n", "unknown", b->unknown);
+		}
+	}
+
+	for (i = 0; i < nhosts; i++) {
+		b = hosts[i]->boots;
+
+		d = b->n * b->sxx - b->sx * b->sx;
+		if (b->n >= 2 && d > 0) {
+			if (tagwidth > 0)
+				printf("%-*s ", tagwidth, hosts[i]->name);
+			printf("trend    %+.3f s per 30 days over %ld boots\n",
+			    (b->n * b->sxy - b->sx * b->sy) / d * 30, b->n);
+		}
+
+		if (b->earlier.count < BOOT_RECENT)
+			continue;
+		n = BOOT_RECENT;
+		memcpy(recent, b->recent, sizeof(recent));
+		qsort(recent, n, sizeof(int64_t), int64_cmp);
+		median = recent[n / 2];
+		if (median > BOOT_SLOWER * sketch_quantile(&b->earlier, 0.5)) {
+			if (tagwidth > 0)
+				printf("%-*s ", tagwidth, hosts[i]->name);
+			printf("slower   median of the last %d boots %.3f s, "
+			    "earlier %.3f s\n", n, median / 1000.0,
+			    sketch_quantile(&b->earlier, 0.5) / 1000.0);
+		}
+	}
+
+	if (nhosts < 2)
+		return;
+
+	if ((all = calloc(1, sizeof(struct boots))) == NULL)
+		err(EX_OSERR, "calloc failed");
+
+	sketch_init(&all->start);
+	sketch_init(&all->stamp);
+	sketch_init(&all->total);
+	for (i = 0; i < nhosts; i++) {
+		sketch_merge(&all->start, &hosts[i]->boots->start);
+		sketch_merge(&all->stamp, &hosts[i]->boots->stamp);
+		sketch_merge(&all->total, &hosts[i]->boots->total);
+	}
+
+	bootsummary_line("total", "start", &all->start);
+	bootsummary_line("total", "stamp", &all->stamp);
+	bootsummary_line("total", "total", &all->total);
+
+	free(all);
+}
+
+/* Output the percentiles of boot durations in milliseconds as seconds */
+
+static void
+bootsummary_line(const char *tag, const char *label, const struct sketch *sk)
+{
+	static const double q[] = { 0.50, 0.90, 0.99 };
+	int i;
+
+	if (tagwidth > 0)
+		printf("%-*s ", tagwidth, tag);
+	printf("%-8s %8"PRIu64, label, sk->count);
+
+	for (i = 0; i < sizeof(q) / sizeof(q[0]); i++)
+		printf(" %11.3f", sketch_quantile(sk, q[i]) / 1000.0);
+	printf(" %11.3f\n", sk->count > 0 ? sk->max / 1000.0 : 0.0);
+}
+
+static int
+int64_cmp(const void *a, const void *b)
+{
+	int64_t ia = *(const int64_t *)a;
+	int64_t ib = *(const int64_t *)b;
+
+	if (ia != ib)
+		return (ia < ib ? -1 : 1);
+
+	return (0);
+}
+
+/* Output the longest downtime periods, the longest first */
+
+static void
+longest(void)
+{
+	struct longest *lo;
+	size_t i, n;
+
+	n = top.nmemb;
+	if ((lo = calloc(n, sizeof(struct longest))) == NULL)
+		err(EX_OSERR, "calloc failed");
+
+	for (i = n; i > 0; i--)
+		heap_pop(&top, &lo[i - 1]);
+
+	for (i = 0; i < n; i++)
+		report(lo[i].host, &lo[i].dt);
+
+	free(lo);
+	heap_free(&top);
+}
+
+/* Output one line of downtime report */
+
+static void
+report(const struct host *h, const struct downtime *dt)
+{
+	const char *label;
+
+	if (tagwidth > 0)
+		printf("%-*s ", tagwidth, h->name);
+
+	switch (dt->what) {
+	case DOWNTIMEDB_WHAT_CRASH:
+		label = "crash";
+		break;
+	case DOWNTIMEDB_WHAT_STALL:
+		label = "stall";
+		break;
+	case DOWNTIMEDB_WHAT_SUSPEND:
+		label = "sleep";
+		break;
+	default:
+		label = "down ";
+		break;
+	}
+
+	period(label, dt->down, dt->up);
+}
+
+/* Output a time period with the given label */
+
+static void
+period(const char *label, int64_t td, int64_t tu)
+{
+
+	printf("%s %s -> ", label,
+	    timestr_abs((time_t) td, cf_timefmt, cf_utc));
+
+	/* Note that the printf() above and below is intentionally split
+	   into two parts because timestr_abs() clobbers the returned
+	   static string on each call. */
+
+	printf("up %s ", timestr_abs((time_t) tu, cf_timefmt, cf_utc));
+
+	/* timestr_int() returns string representing a relative time (time
+	   period) such as 21+06:11:38 or 06:11:38 */
+
+	if (tu != 0 && td != 0)
+		printf("= %11s (%"PRIu64" s)\n",
+		    timestr_int((time_t)(tu - td)), tu - td);
+	else
+		printf("= %11s (? s)\n", "unknown");
+}
+
+/*
+ * Display the state of each host in a heartbeat table maintained by
+ * downtimed(8) running with -H. The whole table is read at once.
+ */
 
-#include <err.h>
-#include <errno.h>
-#include <fcntl.h>
-#include <inttypes.h>
+static void
+liveness()
+{
+	struct hbslot sl;
+	unsigned char *buf;
+	uint32_t i, nslots;
+	int64_t now, limit, seen;
+	size_t len;
+	ssize_t ret;
+	int fd, valid;
 
-#ifdef HAVE_PATHS_H
-#include <paths.h>
-#endif
+	if ((fd = hbtable_open(cf_hbtable, 0, &nslots)) < 0)
+		err(EX_NOINPUT, "can not open heartbeat table %s", cf_hbtable);
 
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <sysexits.h>
-#include <time.h>
-#include <unistd.h>
+	len = (size_t)(nslots + 1) * HBTABLE_SLOTSIZE;
+	if ((buf = malloc(len)) == NULL)
+		err(EX_OSERR, "malloc failed");
+	if ((ret = pread(fd, buf, len, 0)) < 0)
+		err(EX_IOERR, "can not read %s", cf_hbtable);
+	close(fd);
 
-#include "downtimedb.h"
+	/* a table truncated by someone has no more slots */
+	nslots = ret < len ? ret / HBTABLE_SLOTSIZE - 1 : nslots;
 
-/* Some global defines */
+	now = time((time_t *)NULL);
+	limit = LIVENESS_FACTOR * (cf_sleep > 0 ? cf_sleep : LIVENESS_DEFSLEEP);
 
-#define	PROGNAME "downtimes"
+	for (i = 0; i < nslots; i++) {
+		valid = hbtable_decode(buf + (i + 1) * HBTABLE_SLOTSIZE, &sl);
+		if (valid == 0)
+			continue;
+		if (valid < 0) {
+			printf("%4lu %-16s corrupt\n", (unsigned long)i, "?");
+			continue;
+		}
 
-/* PACKAGE_VERSION is defined by autoconf, if used. */
-#ifdef PACKAGE_VERSION
-#define	PROGVERSION PACKAGE_VERSION
-#else
-#define	PROGVERSION "0.0undef"
-#endif
+		printf("%4lu %-16s ", (unsigned long)i, sl.name);
 
-/* Function prototypes */
+		if (sl.shutdown != 0)
+			printf("%-8s", "shutdown");
+		else if (now - sl.stamp > limit)
+			printf("%-8s", "silent");
+		else
+			printf("%-8s", "up");
 
-int		main(int, char *[]);
-static void	report(int64_t, int, int64_t);
-static void	version(void);
-static void	usage(void);
-static void	parseargs(int, char *[]);
+		printf(" boot %s", timestr_abs((time_t)sl.boot, cf_timefmt,
+		    cf_utc));
+		/* the heartbeat stops when the shutdown begins */
+		seen = sl.shutdown > sl.stamp ? sl.shutdown : sl.stamp;
+		printf(" seen %s", timestr_abs((time_t)seen, cf_timefmt,
+		    cf_utc));
+		printf(" = %11s ago\n", now >= seen ?
+		    timestr_int((time_t)(now - seen)) : "0");
+	}
 
-/* Command line arguments with their defaults */
+	free(buf);
+}
 
-static long	cf_sleep = 0; /* adjust crash time according to sleep value */
-static char *	cf_downtimedbfile = PATH_DOWNTIMEDBFILE;
-static long	cf_n = -1;         /* number of downtime records to display */
-static char *	cf_timefmt = FMT_DATETIME;
-static int	cf_utc = 0;                  /* set to display times in UTC */
+/*
+ * Display the status page of downtimed(8) on this host & exit. The
+ * exit status tells if it is running and has ticked recently enough,
+ * by the same rule as liveness().
+ */
+
+static void
+showstatus()
+{
+	const struct status_page *p;
+	struct status st;
+	const char *state;
+	int64_t ago, limit;
+
+	if ((p = status_open(cf_status)) == NULL && errno == EILSEQ)
+		errx(EX_DATAERR, "%s is not a status page", cf_status);
+	if (p == NULL)
+		err(EX_NOINPUT, "can not open status page %s", cf_status);
+	if (status_read(p, &st) < 0)
+		err(EX_TEMPFAIL, "can not read status page %s", cf_status);
+
+	ago = (status_clock() - st.tick_mono) / 1000000;
+	limit = LIVENESS_FACTOR * (cf_sleep > 0 ? cf_sleep : LIVENESS_DEFSLEEP);
+
+	state = status_statestr(st.state);
+	if (st.state == STATUS_RUNNING && ago > limit)
+		state = "silent";
+
+	printf("%-8s pid %lld boot %s", state, (long long)st.pid,
+	    timestr_abs((time_t)st.boottime, cf_timefmt, cf_utc));
+	if (st.ticks > 0)
+		printf(" seen %s = %11s ago, %llu ticks",
+		    timestr_abs((time_t)(st.tick_real / 1000000), cf_timefmt,
+		    cf_utc), ago > 0 ? timestr_int((time_t)ago) : "0",
+		    (unsigned long long)st.ticks);
+	putchar('\n');
+
+	exit(st.state == STATUS_RUNNING && ago <= limit ?
+	    EX_OK : EX_UNAVAILABLE);
+}
 
 /*
- * downtimes: display system downtime records made by downtimed(8)
+ * Output the total downtime and the number of crashes, shutdowns and
+ * suspends within the reporting period of each database file. Using
+ * the checkpoint file maintained by downtimed(8), this takes two
+ * lookups and reading a few records regardless of the database size.
  */
 
-int
-main(int argc, char *argv[])
+static void
+totals()
 {
-	struct downtimedb dbent;
+	struct ckpt_state before, after, all[2];
+	char *path;
+	int i, dbfd, ckfd, ret, width;
+
+	width = 0;
+	for (i = 0; i < cf_ndowntimedbfiles && cf_ndowntimedbfiles > 1; i++)
+		if (strlen(cf_downtimedbfiles[i]) > width)
+			width = strlen(cf_downtimedbfiles[i]);
+	tagwidth = width > 0 && width < 5 ? 5 : width;
+
+	ckpt_init(&all[0], 0);
+	ckpt_init(&all[1], 0);
+
+	for (i = 0; i < cf_ndowntimedbfiles; i++) {
+		if ((dbfd = open(cf_downtimedbfiles[i], O_RDONLY)) < 0)
+			err(EX_NOINPUT, "can not open %s",
+			    cf_downtimedbfiles[i]);
+
+		if ((path = ckpt_path(cf_downtimedbfiles[i])) == NULL)
+			err(EX_OSERR, "malloc failed");
+		ckfd = open(path, O_RDONLY);
+
+		if ((ret = ckpt_before(dbfd, ckfd, tbegin, cf_sleep / 2,
+		    &before)) >= 0)
+			ret |= ckpt_before(dbfd, ckfd, tend == INT64_MAX ?
+			    INT64_MAX : tend + 1, cf_sleep / 2, &after);
+		if (ret < 0)
+			err(EX_DATAERR, "error reading %s",
+			    cf_downtimedbfiles[i]);
+		if (ret > 0)
+			warnx("%s does not match the database, rebuild it "
+			    "with -c rebuild", path);
+
+		totals_line(cf_downtimedbfiles[i], &before, &after);
+
+		all[0].down += before.down;
+		all[0].crashes += before.crashes;
+		all[0].shutdowns += before.shutdowns;
+		all[0].suspends += before.suspends;
+		all[1].down += after.down;
+		all[1].crashes += after.crashes;
+		all[1].shutdowns += after.shutdowns;
+		all[1].suspends += after.suspends;
+
+		if (ckfd >= 0)
+			close(ckfd);
+		close(dbfd);
+		free(path);
+	}
+
+	if (cf_ndowntimedbfiles > 1)
+		totals_line("total", &all[0], &all[1]);
+}
+
+/* Output the difference of two totals computed by ckpt_before() */
+
+static void
+totals_line(const char *tag, const struct ckpt_state *a,
+    const struct ckpt_state *b)
+{
+	int64_t down;
+
+	if (tagwidth > 0)
+		printf("%-*s ", tagwidth, tag);
+
+	down = b->down - a->down;
+	printf("down  %11s (%"PRId64" s) %u crashes, %u shutdowns, "
+	    "%u suspends\n", timestr_int((time_t)down), down,
+	    b->crashes - a->crashes, b->shutdowns - a->shutdowns,
+	    b->suspends - a->suspends);
+}
+
+/* Check or rebuild the checkpoint files of the database files & exit */
+
+static void
+checkpoints()
+{
+	int i, ret, bad = 0;
+
+	for (i = 0; i < cf_ndowntimedbfiles; i++) {
+		if (strcmp(cf_ckpt, "rebuild") == 0) {
+			if (ckpt_update(cf_downtimedbfiles[i], 1) < 0)
+				err(EX_CANTCREAT, "can not rebuild checkpoint "
+				    "of %s", cf_downtimedbfiles[i]);
+			continue;
+		}
+
+		if ((ret = ckpt_verify(cf_downtimedbfiles[i])) < 0)
+			err(EX_DATAERR, "can not check checkpoint of %s",
+			    cf_downtimedbfiles[i]);
+		printf("%s: checkpoint is %s\n", cf_downtimedbfiles[i],
+		    ret == 0 ? "up to date" : "out of date");
+		if (ret > 0)
+			bad = 1;
+	}
+
+	exit(bad ? EX_DATAERR : EX_OK);
+}
+
+/*
+ * Check or repair the database files & exit. Damaged regions are
+ * listed by byte offset; repairing removes them from the file and
+ * brings an existing checkpoint file up to date.
+ */
+
+static void
+integrity()
+{
+	struct dbcheck chk;
+	unsigned char magic[ARCHIVE_MAGICLEN];
+	const char *fn;
+	char *ck;
+	size_t j;
+	ssize_t ret;
+	int i, fd, repair, bad = 0;
+
+	repair = strcmp(cf_check, "repair") == 0;
+
+	for (i = 0; i < cf_ndowntimedbfiles; i++) {
+		fn = cf_downtimedbfiles[i];
+
+		if ((fd = open(fn, repair ? O_RDWR : O_RDONLY)) < 0)
+			err(EX_NOINPUT, "can not open %s", fn);
+		if ((ret = pread(fd, magic, sizeof(magic), 0)) < 0)
+			err(EX_NOINPUT, "can not read %s", fn);
+		if (archive_ismagic(magic, ret))
+			errx(EX_USAGE, "%s is an archive, not a database", fn);
+
+		if (dbcheck_run(fd, (int)cf_jobs, &chk) < 0)
+			err(EX_IOERR, "can not check %s", fn);
+
+		for (j = 0; j < chk.nbad; j++) {
+			if (chk.bad[j].reason == DBCHECK_PARTIAL)
+				printf("%s: offset %lld, %lld bytes: %s\n", fn,
+				    (long long)(chk.bad[j].start *
+				    sizeof(struct downtimedb)),
+				    (long long)(chk.size %
+				    sizeof(struct downtimedb)),
+				    dbcheck_reason(chk.bad[j].reason));
+			else
+				printf("%s: offset %lld, %lld records: %s\n",
+				    fn, (long long)(chk.bad[j].start *
+				    sizeof(struct downtimedb)),
+				    (long long)(chk.bad[j].end -
+				    chk.bad[j].start),
+				    dbcheck_reason(chk.bad[j].reason));
+		}
+		if (chk.nback > 0)
+			printf("%s: offset %lld: time goes backwards, "
+			    "%lld times in all\n", fn,
+			    (long long)(chk.firstback *
+			    sizeof(struct downtimedb)), (long long)chk.nback);
+		printf("%s: %lld records, %lld damaged in %lu regions\n", fn,
+		    (long long)chk.nrec, (long long)chk.ndamaged,
+		    (unsigned long)chk.nbad);
+
+		if (chk.nbad > 0 && repair) {
+			if (dbcheck_repair(fn, fd, &chk) < 0)
+				err(EX_CANTCREAT, "can not repair %s", fn);
+			printf("%s: damaged regions removed\n", fn);
+
+			if ((ck = ckpt_path(fn)) == NULL)
+				err(EX_OSERR, "malloc failed");
+			if (access(ck, F_OK) == 0 && ckpt_update(fn, 1) < 0)
+				err(EX_CANTCREAT, "can not rebuild checkpoint "
+				    "of %s", fn);
+			free(ck);
+		} else if (chk.nbad > 0)
+			bad = 1;
+
+		dbcheck_free(&chk);
+		close(fd);
+	}
+
+	exit(bad ? EX_DATAERR : EX_OK);
+}
+
+/*
+ * Merge the database files into one, sorting the records by time and
+ * removing the duplicates, see dbmerge.h.
+ */
+
+static void
+mergedb()
+{
+	struct dbmerge m;
+	unsigned char magic[ARCHIVE_MAGICLEN];
+	char *ck;
+	ssize_t ret;
+	int i, fd;
+
+	for (i = 0; i < cf_ndowntimedbfiles; i++) {
+		if ((fd = open(cf_downtimedbfiles[i], O_RDONLY)) < 0)
+			err(EX_NOINPUT, "can not open %s",
+			    cf_downtimedbfiles[i]);
+		if ((ret = read(fd, magic, sizeof(magic))) < 0)
+			err(EX_NOINPUT, "can not read %s",
+			    cf_downtimedbfiles[i]);
+		if (archive_ismagic(magic, ret))
+			errx(EX_USAGE, "%s is an archive, not a database",
+			    cf_downtimedbfiles[i]);
+		close(fd);
+	}
+
+	if (dbmerge_run(cf_downtimedbfiles, cf_ndowntimedbfiles, cf_merge,
+	    (size_t)cf_mergemem * 1024 * 1024, &m) < 0) {
+		if (errno == EILSEQ)
+			errx(EX_DATAERR, "%s is corrupted, see -C", m.errname);
+		err(strcmp(m.errname, cf_merge) == 0 ? EX_CANTCREAT :
+		    EX_NOINPUT, "can not merge %s", m.errname);
+	}
+
+	printf("%s: %lld records read, %lld written, %lld duplicates "
+	    "and %lld overlapping removed\n", cf_merge, (long long)m.nin,
+	    (long long)m.nout, (long long)m.ndup, (long long)m.noverlap);
+	if (m.nruns > 0)
+		printf("%s: sorted in %d runs of %ld megabytes\n", cf_merge,
+		    m.nruns, cf_mergemem);
+
+	/* the checkpoint of an existing database is out of date now */
+	if ((ck = ckpt_path(cf_merge)) == NULL)
+		err(EX_OSERR, "malloc failed");
+	if (access(ck, F_OK) == 0 && ckpt_update(cf_merge, 1) < 0)
+		err(EX_CANTCREAT, "can not rebuild checkpoint of %s",
+		    cf_merge);
+	free(ck);
+}
+
+/*
+ * Write the records of a database from the time or offset given with
+ * -r to stdout as they are, then the offset to continue from next time
+ * to stderr. Only complete records are written; one still being written
+ * is left for the next time.
+ */
+
+static void
+rawexport()
+{
+	unsigned char magic[ARCHIVE_MAGICLEN];
 	struct stat sb;
-	int64_t tdown, tadjust;
-	int fd, ret, crashed;
+	const char *fn;
+	char *path, *p;
+	off_t start, end, rec;
+	long long v;
+	ssize_t ret;
+	int fd, ckfd;
 
-	/* parse command line arguments */
-	parseargs(argc, argv);
+	fn = cf_downtimedbfiles[0];
 
-	if ((fd = open(cf_downtimedbfile, O_RDONLY)) < 0) {
-		fputs("Maybe the system has not been down yet?\n", stderr);
-		err(EX_NOINPUT, "can not open %s", cf_downtimedbfile);
+	if ((fd = open(fn, O_RDONLY)) < 0)
+		err(EX_NOINPUT, "can not open %s", fn);
+	if ((ret = pread(fd, magic, sizeof(magic), 0)) < 0 ||
+	    fstat(fd, &sb) < 0)
+		err(EX_NOINPUT, "can not read %s", fn);
+	if (archive_ismagic(magic, ret))
+		errx(EX_USAGE, "%s is an archive, not a database", fn);
+
+	end = sb.st_size - sb.st_size % sizeof(struct downtimedb);
+
+	if (cf_raw[0] == '+') {
+		p = NULL;
+		errno = 0;
+		v = strtoll(cf_raw + 1, &p, 10);
+		if (p == cf_raw + 1 || *p != '\0' || errno != 0 || v < 0)
+			errx(EX_USAGE, "-r argument is not a valid offset");
+		/* the start of the record the offset falls in */
+		start = v - v % sizeof(struct downtimedb);
+		if (start > end)
+			errx(EX_DATAERR, "offset %lld is past the end of %s, "
+			    "was it truncated or replaced?", v, fn);
+	} else {
+		if ((path = ckpt_path(fn)) == NULL)
+			err(EX_OSERR, "malloc failed");
+		ckfd = open(path, O_RDONLY);
+		if ((ret = ckpt_find(fd, ckfd, parsetime(cf_raw, "-r"),
+		    &rec)) < 0)
+			err(EX_DATAERR, "error reading %s", fn);
+		if (ret > 0)
+			warnx("%s does not match the database, rebuild it "
+			    "with -c rebuild", path);
+		if (ckfd >= 0)
+			close(ckfd);
+		free(path);
+
+		start = pairstart(fd, fn, rec) * sizeof(struct downtimedb);
+		if (start > end)
+			start = end;
 	}
 
-	if (fstat(fd, &sb) < 0)
-		err(EX_NOINPUT, "can not stat %s", cf_downtimedbfile);
+	rawcopy(fd, fn, start, end);
+	close(fd);
 
-	if (sb.st_size % sizeof(struct downtimedb) != 0)
-		errx(EX_DATAERR, "%s is corrupted", cf_downtimedbfile);
-
-	if ((cf_n == -1)
-	    || (cf_n > sb.st_size / sizeof(struct downtimedb) / 2))
-		cf_n = sb.st_size / sizeof(struct downtimedb) / 2;
-
-	if (lseek(fd, sb.st_size - (cf_n * sizeof(struct downtimedb) * 2),
-	    SEEK_SET) < 0)
-		err(EX_DATAERR, "can not seek %s", cf_downtimedbfile);
-
-	tdown = 0;
-	tadjust = cf_sleep / 2;
-
-	while ((ret = downtimedb_read(fd, &dbent)) > 0) {
-		switch (dbent.what) {
-		case DOWNTIMEDB_WHAT_SHUTDOWN:
-			if (tdown != 0)
-				report(dbent.when, 0, 0);
-			tdown = dbent.when;
-			crashed = 0;
-			break;
-		case DOWNTIMEDB_WHAT_CRASH:
-			if (tdown != 0)
-				report(dbent.when + tadjust, 1, 0);
-			tdown = dbent.when;
-			crashed = 1;
-			break;
-		case DOWNTIMEDB_WHAT_UP:
-			report(crashed ? tdown + tadjust : tdown,
-			    crashed, dbent.when);
-			tdown = 0;
-			break;
-		case DOWNTIMEDB_WHAT_NONE:
-		default:
+	fprintf(stderr, "+%lld\n", (long long)end);
+}
+
+/*
+ * Return the index of the record to start exporting from so that the
+ * record rec is included without splitting a downtime: if the first
+ * record from rec on which is not a stall is an up or resume record,
+ * this is the down record before it, skipping any stall records.
+ */
+
+static off_t
+pairstart(int fd, const char *fn, off_t rec)
+{
+	unsigned char buf[sizeof(struct downtimedb)];
+	struct downtimedb ent;
+	off_t i;
+
+	for (i = rec; ; i++) {
+		if (pread(fd, buf, sizeof(buf), i * sizeof(buf)) !=
+		    sizeof(buf))
+			return (rec);
+		downtimedb_decode(buf, &ent);
+		if (ent.what != DOWNTIMEDB_WHAT_STALL)
 			break;
+	}
+	if (ent.what != DOWNTIMEDB_WHAT_UP &&
+	    ent.what != DOWNTIMEDB_WHAT_RESUME)
+		return (rec);
+
+	for (i = rec; i > 0; i--) {
+		if (pread(fd, buf, sizeof(buf), (i - 1) * sizeof(buf)) !=
+		    sizeof(buf))
+			err(EX_DATAERR, "error reading %s", fn);
+		downtimedb_decode(buf, &ent);
+		if (ent.what == DOWNTIMEDB_WHAT_STALL)
+			continue;
+		if (ent.what == DOWNTIMEDB_WHAT_SHUTDOWN ||
+		    ent.what == DOWNTIMEDB_WHAT_CRASH ||
+		    ent.what == DOWNTIMEDB_WHAT_SUSPEND)
+			return (i - 1);
+		break;
+	}
+
+	return (rec);
+}
+
+/*
+ * Copy bytes [start, end) of the file fd to stdout. The data goes from
+ * the page cache to stdout without passing through this process with
+ * sendfile(2) if it can be used for the output, otherwise it is copied
+ * in large blocks.
+ */
+
+static void
+rawcopy(int fd, const char *fn, off_t start, off_t end)
+{
+	char *buf;
+	ssize_t n, m, w;
+
+#if defined(HAVE_SYS_SENDFILE_H) && defined(__linux__)
+	while (start < end) {
+		if ((n = sendfile(STDOUT_FILENO, fd, &start,
+		    end - start > RAW_COPYSIZE * 64 ?
+		    RAW_COPYSIZE * 64 : end - start)) < 0) {
+			if (errno == EINTR)
+				continue;
+			/* not supported between these kinds of files */
+			if (errno == EINVAL || errno == ENOSYS)
+				break;
+			err(EX_IOERR, "can not write records");
 		}
+		if (n == 0)
+			errx(EX_DATAERR, "%s was truncated while reading it",
+			    fn);
 	}
+	if (start == end)
+		return;
+#endif
 
-	if (tdown != 0)
-		report(tdown, crashed, 0);
+	if ((buf = malloc(RAW_COPYSIZE)) == NULL)
+		err(EX_OSERR, "malloc failed");
 
-	if (ret < 0)
-		err(EX_DATAERR, "error reading %s", cf_downtimedbfile);
+	while (start < end) {
+		n = end - start > RAW_COPYSIZE ? RAW_COPYSIZE : end - start;
+		if ((n = pread(fd, buf, n, start)) < 0) {
+			if (errno == EINTR)
+				continue;
+			err(EX_IOERR, "can not read %s", fn);
+		}
+		if (n == 0)
+			errx(EX_DATAERR, "%s was truncated while reading it",
+			    fn);
+		for (m = 0; m < n; m += w)
+			if ((w = write(STDOUT_FILENO, buf + m, n - m)) < 0) {
+				if (errno == EINTR) {
+					w = 0;
+					continue;
+				}
+				err(EX_IOERR, "can not write records");
+			}
+		start += n;
+	}
 
-	close(fd);
-	exit(EX_OK);
+	free(buf);
 }
 
-/* Output one line of downtime report */
+/*
+ * Stand in for the collector downtimed(8) pushes records to with -R:
+ * append the records pushed to cf_collect to the database given with
+ * -d, reporting each connection, until killed.
+ */
 
 static void
-report(int64_t td, int crashed, int64_t tu)
+collect()
 {
-	printf("%s %s -> ", crashed ? "crash" : "down ", 
-	    timestr_abs((time_t) td, cf_timefmt, cf_utc));
+	char name[256];
+	int lfd, fd, n;
 
-	/* Note that the printf() above and below is intentionally split
-	   into two parts because timestr_abs() clobbers the returned
-	   static string on each call. */
+	if ((fd = open(cf_downtimedbfiles[0], O_WRONLY | O_CREAT | O_APPEND,
+	    0666)) < 0)
+		err(EX_CANTCREAT, "can not open %s", cf_downtimedbfiles[0]);
+	if ((lfd = push_listen(cf_collect)) < 0)
+		err(EX_UNAVAILABLE, "can not listen at %s", cf_collect);
 
-	printf("up %s ", timestr_abs((time_t) tu, cf_timefmt, cf_utc));
+	/* a sender going away must not take us with it */
+	signal(SIGPIPE, SIG_IGN);
 
-	/* timestr_int() returns string representing a relative time (time
-	   period) such as 21+06:11:38 or 06:11:38 */
+	for (;;) {
+		if ((n = push_serve(lfd, fd, name, sizeof(name))) < 0)
+			warn("can not take records from %s",
+			    name[0] != '\0' ? name : "a sender");
+		else
+			printf("%d records from %s\n", n,
+			    name[0] != '\0' ? name : "a sender");
+		fflush(stdout);
+	}
+}
 
-	if (tu != 0 && td != 0)
-		printf("= %11s (%"PRIu64" s)\n",
-		    timestr_int((time_t)(tu - td)), tu - td);
-	else
-		printf("= %11s (? s)\n", "unknown");
+/*
+ * Parse a time given on the command line. It may be given as UNIX
+ * time, in the output time format or as a date in "%F" format. The
+ * time is local time unless -u was given.
+ */
+
+static int64_t
+parsetime(const char *str, const char *opt)
+{
+	struct tm tm;
+	char *p;
+	long long v;
+
+	p = NULL;
+	errno = 0;
+	v = strtoll(str, &p, 10);
+	if (p != str && *p == '\0' && errno == 0)
+		return ((int64_t)v);
+
+	memset(&tm, 0, sizeof(tm));
+	if ((p = strptime(str, cf_timefmt, &tm)) == NULL || *p != '\0') {
+		memset(&tm, 0, sizeof(tm));
+		if ((p = strptime(str, "%F", &tm)) == NULL || *p != '\0')
+			errx(EX_USAGE, "%s argument is not a valid time", opt);
+	}
+	tm.tm_isdst = -1;
+
+	return ((int64_t)(cf_utc ? timegm(&tm) : mktime(&tm)));
+}
+
+/*
+ * Parse a duration given as seconds or with one of the suffixes s, m,
+ * h and d for seconds, minutes, hours and days.
+ */
+
+static int64_t
+parseduration(const char *str, const char *opt)
+{
+	char *p;
+	long long v;
+
+	p = NULL;
+	errno = 0;
+	v = strtoll(str, &p, 10);
+	if (p == str || errno != 0 || v < 0 || v > INT32_MAX)
+		errx(EX_USAGE, "%s argument is not a valid duration", opt);
+
+	switch (*p) {
+	case 'd':
+		v *= 24;
+		/* FALLTHROUGH */
+	case 'h':
+		v *= 60;
+		/* FALLTHROUGH */
+	case 'm':
+		v *= 60;
+		/* FALLTHROUGH */
+	case 's':
+		p++;
+		break;
+	}
+	if (*p != '\0')
+		errx(EX_USAGE, "%s argument is not a valid duration", opt);
+
+	return ((int64_t)v);
+}
+
+#ifndef HAVE_TIMEGM
+/* Compatibility timegm() for systems which lack it */
+
+static time_t
+timegm(struct tm *tm)
+{
+	int64_t y, m, days;
+
+	y = tm->tm_year + 1900;
+	m = tm->tm_mon + 1;
+	if (m <= 2) {
+		y--;
+		m += 12;
+	}
+
+	/* days since 1970-01-01 in the proleptic Gregorian calendar */
+	days = 365 * y + y / 4 - y / 100 + y / 400 + (153 * (m - 3) + 2) / 5 +
+	    tm->tm_mday - 719469;
+
+	return ((time_t)(days * 86400 + tm->tm_hour * 3600 +
+	    tm->tm_min * 60 + tm->tm_sec));
 }
+#endif /* !HAVE_TIMEGM */
 
 /* Usage help & exit */
 
@@ -188,8 +2120,27 @@ static void
 usage()
 {
 
-	fputs("usage: " PROGNAME " [-v] [-d downtimedbfile] [-f timefmt] "
-	    "[-n num] [-s sleep] [-u]\n", stderr);
+	fputs("usage: " PROGNAME " [-FSuv] [-b begin] [-d downtimedbfile ...] "
+	    "[-e end]\n\t[-f timefmt] [-j threads] [-k num] [-L longest] "
+	    "[-l shortest]\n\t[-n num] [-o any|all] [-s sleep] [-U uptime] "
+	    "[-w what ...]\n"
+	    "       " PROGNAME " -a archive [-d downtimedbfile ...]\n"
+	    "       " PROGNAME " -r since [-u] [-d downtimedbfile] "
+	    "[-f timefmt]\n"
+	    "       " PROGNAME " -R collector -d downtimedbfile\n"
+	    "       " PROGNAME " -B [-u] [-b begin] [-d downtimedbfile ...] "
+	    "[-e end]\n\t[-f timefmt] [-j threads] [-L longest] [-l shortest] "
+	    "[-n num]\n\t[-U uptime] [-w what ...]\n"
+	    "       " PROGNAME " -t [-b begin] [-d downtimedbfile ...] "
+	    "[-e end] [-s sleep]\n"
+	    "       " PROGNAME " -c check|rebuild [-d downtimedbfile ...]\n"
+	    "       " PROGNAME " -C check|repair [-d downtimedbfile ...] "
+	    "[-j threads]\n"
+	    "       " PROGNAME " -m downtimedbfile [-d downtimedbfile ...] "
+	    "[-M megabytes]\n"
+	    "       " PROGNAME " -H table [-u] [-f timefmt] [-s sleep]\n"
+	    "       " PROGNAME " -P statusfile [-u] [-f timefmt] [-s sleep]\n",
+	    stderr);
 	exit(EX_USAGE);
 }
 
@@ -215,6 +2166,10 @@ version()
 	printf("  sleep = %ld\n", cf_sleep);
 	printf("  timefmt = %s\n", cf_timefmt);
 	printf("  utc = %d\n", cf_utc);
+	printf("  follow = %d\n", cf_follow);
+	printf("  stats = %d\n", cf_stats);
+	printf("  boots = %d\n", cf_boots);
+	printf("  longest = %ld\n", cf_topk);
 
 #ifdef PACKAGE_URL
 	puts("\nSee the following web site for more information and updates:");
@@ -228,26 +2183,118 @@ version()
 static void
 parseargs(int argc, char *argv[])
 {
-	int c;
+	int c, nfiles = 0, mflag = 0, nflag = 0;
 	char *p;
 
-	if (strlen(argv[0]) > 0 && argv[0][strlen(argv[0])-1] != 's')
-		cf_n = 1;
-
-	while ((c = getopt(argc, argv, "d:f:n:s:uvh?")) != -1) {
+	while ((c = getopt(argc, argv,
+	    "a:Bb:C:c:d:e:Ff:H:j:k:L:l:M:m:n:o:P:R:r:Ss:tU:uvw:h?")) != -1) {
 		switch (c) {
+		case 'a':
+			cf_archive = optarg;
+			break;
+		case 'B':
+			cf_boots = 1;
+			break;
+		case 'b':
+			cf_begin = optarg;
+			break;
+		case 'C':
+			if (strcmp(optarg, "check") != 0 &&
+			    strcmp(optarg, "repair") != 0)
+				errx(EX_USAGE,
+				    "-C argument is not check or repair");
+			cf_check = optarg;
+			break;
+		case 'c':
+			if (strcmp(optarg, "check") != 0 &&
+			    strcmp(optarg, "rebuild") != 0)
+				errx(EX_USAGE,
+				    "-c argument is not check or rebuild");
+			cf_ckpt = optarg;
+			break;
+		case 'e':
+			cf_end = optarg;
+			break;
+		case 'F':
+			cf_follow = 1;
+			break;
 		case 'd':
-			cf_downtimedbfile = optarg;
+			/* may be given many times to merge several files */
+			if (nfiles++ == 0)
+				cf_downtimedbfiles = NULL;
+			if ((cf_downtimedbfiles = realloc(cf_downtimedbfiles,
+			    nfiles * sizeof(char *))) == NULL)
+				err(EX_OSERR, "realloc failed");
+			cf_downtimedbfiles[nfiles - 1] = optarg;
+			cf_ndowntimedbfiles = nfiles;
 			break;
 		case 'f':
 			cf_timefmt = optarg;
 			break;
+		case 'H':
+			cf_hbtable = optarg;
+			break;
+		case 'j':
+			p = NULL;
+			errno = 0;
+			cf_jobs = strtol(optarg, &p, 10);
+			if ((p != NULL && *p != '\0') || errno != 0 ||
+			    cf_jobs < 1)
+				errx(EX_USAGE, "-j argument is not a number");
+			break;
+		case 'k':
+			p = NULL;
+			errno = 0;
+			cf_topk = strtol(optarg, &p, 10);
+			if ((p != NULL && *p != '\0') || errno != 0 ||
+			    cf_topk < 0)
+				errx(EX_USAGE, "-k argument is not a number");
+			break;
+		case 'L':
+			cf_maxdown = parseduration(optarg, "-L");
+			break;
+		case 'l':
+			cf_mindown = parseduration(optarg, "-l");
+			break;
+		case 'M':
+			p = NULL;
+			errno = 0;
+			cf_mergemem = strtol(optarg, &p, 10);
+			if ((p != NULL && *p != '\0') || errno != 0 ||
+			    cf_mergemem < 1)
+				errx(EX_USAGE, "-M argument is not a number");
+			mflag = 1;
+			break;
+		case 'm':
+			cf_merge = optarg;
+			break;
 		case 'n':
 			p = NULL;
 			errno = 0;
 			cf_n = strtol(optarg, &p, 10);
 			if ((p != NULL && *p != '\0') || errno != 0)
 				errx(EX_USAGE, "-n argument is not a number");
+			nflag = 1;
+			break;
+		case 'o':
+			if (strcmp(optarg, "any") == 0)
+				cf_overlap = OVERLAP_ANY;
+			else if (strcmp(optarg, "all") == 0)
+				cf_overlap = OVERLAP_ALL;
+			else
+				errx(EX_USAGE, "-o argument is not any or all");
+			break;
+		case 'P':
+			cf_status = optarg;
+			break;
+		case 'R':
+			cf_collect = optarg;
+			break;
+		case 'r':
+			cf_raw = optarg;
+			break;
+		case 'S':
+			cf_stats = 1;
 			break;
 		case 's':
 			p = NULL;
@@ -256,6 +2303,12 @@ parseargs(int argc, char *argv[])
 			if ((p != NULL && *p != '\0') || errno != 0)
 				errx(EX_USAGE, "-s argument is not a number");
 			break;
+		case 't':
+			cf_totals = 1;
+			break;
+		case 'U':
+			cf_uptime = parseduration(optarg, "-U");
+			break;
 		case 'u':
 			cf_utc = 1;
 			break;
@@ -263,6 +2316,20 @@ parseargs(int argc, char *argv[])
 			version();
 			/* NOTREACHED */
 			break;
+		case 'w':
+			/* may be given many times to show several kinds */
+			if (strcmp(optarg, "crash") == 0)
+				cf_what |= 1 << DOWNTIMEDB_WHAT_CRASH;
+			else if (strcmp(optarg, "down") == 0)
+				cf_what |= 1 << DOWNTIMEDB_WHAT_SHUTDOWN;
+			else if (strcmp(optarg, "sleep") == 0)
+				cf_what |= 1 << DOWNTIMEDB_WHAT_SUSPEND;
+			else if (strcmp(optarg, "stall") == 0)
+				cf_what |= 1 << DOWNTIMEDB_WHAT_STALL;
+			else
+				errx(EX_USAGE, "-w argument is not crash, down, "
+				    "sleep or stall");
+			break;
 		case 'h':
 		case '?':
 		default:
@@ -273,6 +2340,110 @@ parseargs(int argc, char *argv[])
 	}
 	if (argc != optind)
 		usage();
+
+	/* parsed last as they depend on -f and -u */
+	if (cf_begin != NULL)
+		tbegin = parsetime(cf_begin, "-b");
+	if (cf_end != NULL)
+		tend = parsetime(cf_end, "-e");
+
+	if (cf_archive != NULL && (cf_begin != NULL || cf_end != NULL ||
+	    cf_follow || cf_overlap != OVERLAP_NONE || cf_stats || cf_topk ||
+	    cf_n != -1))
+		errx(EX_USAGE, "-a can not be used with reporting options");
+
+	if (cf_hbtable != NULL && (nfiles > 0 || cf_archive != NULL ||
+	    cf_check != NULL || cf_begin != NULL || cf_end != NULL ||
+	    cf_follow || cf_overlap != OVERLAP_NONE || cf_stats || cf_topk ||
+	    cf_n != -1))
+		errx(EX_USAGE, "-H can only be used with -f, -s and -u");
+
+	if (cf_status != NULL && (nfiles > 0 || cf_archive != NULL ||
+	    cf_check != NULL || cf_hbtable != NULL || cf_begin != NULL ||
+	    cf_end != NULL || cf_follow || cf_overlap != OVERLAP_NONE ||
+	    cf_stats || cf_topk || cf_n != -1))
+		errx(EX_USAGE, "-P can only be used with -f, -s and -u");
+
+	if (cf_ckpt != NULL && (cf_archive != NULL || cf_begin != NULL ||
+	    cf_end != NULL || cf_follow || cf_overlap != OVERLAP_NONE ||
+	    cf_stats || cf_topk || cf_n != -1 || cf_totals))
+		errx(EX_USAGE, "-c can only be used with -d");
+
+	if (cf_check != NULL && (cf_ckpt != NULL || cf_archive != NULL ||
+	    cf_begin != NULL || cf_end != NULL || cf_follow ||
+	    cf_overlap != OVERLAP_NONE || cf_stats || cf_topk || cf_n != -1 ||
+	    cf_totals))
+		errx(EX_USAGE, "-C can only be used with -d and -j");
+
+	if (cf_jobs != 0 && (cf_archive != NULL || cf_ckpt != NULL ||
+	    cf_merge != NULL || cf_hbtable != NULL || cf_status != NULL ||
+	    cf_follow || cf_totals))
+		errx(EX_USAGE, "-j can not be used with -a, -c, -F, -H, -m, "
+		    "-P or -t");
+
+	if (cf_merge != NULL && (cf_ckpt != NULL || cf_check != NULL ||
+	    cf_archive != NULL || cf_hbtable != NULL || cf_status != NULL ||
+	    cf_begin != NULL || cf_end != NULL || cf_follow ||
+	    cf_overlap != OVERLAP_NONE || cf_stats || cf_topk || cf_n != -1 ||
+	    cf_totals))
+		errx(EX_USAGE, "-m can only be used with -d and -M");
+
+	if (mflag && cf_merge == NULL)
+		errx(EX_USAGE, "-M can only be used with -m");
+
+	if (cf_follow && (cf_overlap != OVERLAP_NONE || cf_stats ||
+	    cf_topk))
+		errx(EX_USAGE, "-F can not be used with -k, -o or -S");
+
+	if (cf_boots && (cf_archive != NULL || cf_ckpt != NULL ||
+	    cf_check != NULL || cf_merge != NULL || cf_hbtable != NULL ||
+	    cf_status != NULL || cf_follow || cf_overlap != OVERLAP_NONE ||
+	    cf_stats || cf_topk || cf_totals))
+		errx(EX_USAGE,
+		    "-B can only be used with -b, -d, -e, -f, -j, -L, -l, -n, "
+		    "-U, -u and -w");
+
+	if (cf_raw != NULL && (nfiles > 1 || cf_archive != NULL ||
+	    cf_ckpt != NULL || cf_check != NULL || cf_merge != NULL ||
+	    cf_hbtable != NULL || cf_status != NULL || cf_begin != NULL ||
+	    cf_end != NULL || cf_follow || cf_overlap != OVERLAP_NONE ||
+	    cf_stats || cf_topk || cf_boots || cf_n != -1 || cf_totals ||
+	    cf_jobs != 0))
+		errx(EX_USAGE, "-r can only be used with a single -d, -f "
+		    "and -u");
+
+	if (cf_collect != NULL && (nfiles != 1 || cf_archive != NULL ||
+	    cf_ckpt != NULL || cf_check != NULL || cf_merge != NULL ||
+	    cf_hbtable != NULL || cf_status != NULL || cf_raw != NULL ||
+	    cf_begin != NULL || cf_end != NULL || cf_follow ||
+	    cf_overlap != OVERLAP_NONE || cf_stats || cf_topk || cf_boots ||
+	    cf_n != -1 || cf_totals || cf_jobs != 0))
+		errx(EX_USAGE, "-R must be used with a single -d only");
+
+	if ((cf_what != 0 || cf_mindown >= 0 || cf_maxdown >= 0 ||
+	    cf_uptime >= 0) && (cf_archive != NULL || cf_ckpt != NULL ||
+	    cf_check != NULL || cf_merge != NULL || cf_hbtable != NULL ||
+	    cf_status != NULL || cf_raw != NULL || cf_collect != NULL ||
+	    cf_totals))
+		errx(EX_USAGE, "-l, -L, -U and -w can only be used when "
+		    "displaying downtime");
+
+	if (cf_totals && (cf_archive != NULL || cf_follow ||
+	    cf_overlap != OVERLAP_NONE || cf_stats || cf_topk || cf_n != -1))
+		errx(EX_USAGE, "-t can only be used with -b, -d, -e and -s");
+
+	/*
+	 * When run as "downtime", display only the latest downtime by
+	 * default. This does not apply to the modes which do not list
+	 * downtime, the archive conversion in particular has to keep
+	 * all of the history.
+	 */
+	if (!nflag && strlen(argv[0]) > 0 &&
+	    argv[0][strlen(argv[0])-1] != 's' && cf_archive == NULL &&
+	    cf_ckpt == NULL && cf_check == NULL && cf_merge == NULL &&
+	    cf_hbtable == NULL && cf_status == NULL && cf_raw == NULL &&
+	    cf_collect == NULL && !cf_totals)
+		cf_n = 1;
 }
 
 /* eof */
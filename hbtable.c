@@ -0,0 +1,276 @@
+/*-
+ * Copyright (c) 2009-2016 Janne Snabb. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *
+ * Software web site:
+ *   https://dist.epipe.com/downtimed/
+ *
+ */
+
+/* Include config.h in case we use autoconf. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "downtimedb.h"
+#include "hbtable.h"
+
+/* from <sys/stat.h> */
+
+#ifndef DEFFILEMODE
+#define	DEFFILEMODE 0666
+#endif
+
+/* offsets of the fields of an encoded slot */
+
+#define	OFF_BOOT	HBTABLE_NAMELEN
+#define	OFF_STAMP	(OFF_BOOT + 8)
+#define	OFF_SHUTDOWN	(OFF_STAMP + 8)
+#define	OFF_SEQ		(OFF_SHUTDOWN + 8)
+#define	OFF_CRC		(OFF_SEQ + 4)
+
+static int	mktable(const char *);
+static void	put32(unsigned char *, uint32_t);
+static void	put64(unsigned char *, uint64_t);
+static uint32_t	get32(const unsigned char *);
+static uint64_t	get64(const unsigned char *);
+
+/*
+ * Open a heartbeat table and return the file descriptor, or -1 with
+ * errno set on error. If create is set, a missing table is created
+ * with HBTABLE_DEFSLOTS slots, see mktable().
+ */
+
+int
+hbtable_open(const char *fn, int create, uint32_t *nslots)
+{
+	unsigned char hdr[HBTABLE_SLOTSIZE];
+	ssize_t ret;
+	int fd;
+
+	if ((fd = open(fn, create ? O_RDWR : O_RDONLY)) < 0) {
+		if (errno != ENOENT || !create || mktable(fn) < 0 ||
+		    (fd = open(fn, O_RDWR)) < 0)
+			return (-1);
+	}
+
+	if ((ret = pread(fd, hdr, sizeof(hdr), 0)) < 0)
+		goto err;
+
+	if (ret != sizeof(hdr) ||
+	    memcmp(hdr, HBTABLE_MAGIC, HBTABLE_MAGICLEN) != 0 ||
+	    get32(hdr + 8) != HBTABLE_SLOTSIZE) {
+		errno = EILSEQ;
+		goto err;
+	}
+
+	*nslots = get32(hdr + 12);
+
+	return (fd);
+
+err:
+	ret = errno;
+	close(fd);
+	errno = ret;
+	return (-1);
+}
+
+/* Encode a slot into HBTABLE_SLOTSIZE bytes for writing */
+
+void
+hbtable_encode(const struct hbslot *sl, unsigned char *buf)
+{
+
+	memset(buf, 0, HBTABLE_SLOTSIZE);
+	memcpy(buf, sl->name, HBTABLE_NAMELEN);
+	put64(buf + OFF_BOOT, (uint64_t)sl->boot);
+	put64(buf + OFF_STAMP, (uint64_t)sl->stamp);
+	put64(buf + OFF_SHUTDOWN, (uint64_t)sl->shutdown);
+	put32(buf + OFF_SEQ, sl->seq);
+	put32(buf + OFF_CRC, downtimedb_crc32(buf, OFF_CRC));
+}
+
+/*
+ * Decode a slot. Return 1 if it is valid, 0 if it has never been
+ * written and -1 if the checksum does not match.
+ */
+
+int
+hbtable_decode(const unsigned char *buf, struct hbslot *sl)
+{
+	int i;
+
+	memset(sl, 0, sizeof(struct hbslot));
+
+	for (i = 0; i < HBTABLE_SLOTSIZE && buf[i] == 0; i++)
+		;
+	if (i == HBTABLE_SLOTSIZE)
+		return (0);
+
+	if (get32(buf + OFF_CRC) != downtimedb_crc32(buf, OFF_CRC))
+		return (-1);
+
+	memcpy(sl->name, buf, HBTABLE_NAMELEN);
+	sl->name[HBTABLE_NAMELEN - 1] = '\0';
+	sl->boot = (int64_t)get64(buf + OFF_BOOT);
+	sl->stamp = (int64_t)get64(buf + OFF_STAMP);
+	sl->shutdown = (int64_t)get64(buf + OFF_SHUTDOWN);
+	sl->seq = get32(buf + OFF_SEQ);
+
+	return (1);
+}
+
+/* Read and decode a slot, return as hbtable_decode() or -2 on error */
+
+int
+hbtable_read(int fd, uint32_t idx, struct hbslot *sl)
+{
+	unsigned char buf[HBTABLE_SLOTSIZE];
+
+	if (pread(fd, buf, sizeof(buf),
+	    (off_t)(idx + 1) * HBTABLE_SLOTSIZE) != sizeof(buf))
+		return (-2);
+
+	return (hbtable_decode(buf, sl));
+}
+
+/* Write a slot with a single pwrite(2), return -1 on error */
+
+int
+hbtable_write(int fd, uint32_t idx, const struct hbslot *sl)
+{
+	unsigned char buf[HBTABLE_SLOTSIZE];
+
+	hbtable_encode(sl, buf);
+
+	if (pwrite(fd, buf, sizeof(buf),
+	    (off_t)(idx + 1) * HBTABLE_SLOTSIZE) != sizeof(buf))
+		return (-1);
+
+	return (0);
+}
+
+/*
+ * Create a heartbeat table. Several hosts may try this at the same
+ * time, so the table is written in full under a temporary name and
+ * then linked into place, which fails if another host has already
+ * done so. Readers thus never see a table being written, and none is
+ * replaced while it is in use. Return 0 if the table exists now, -1
+ * with errno set on error.
+ */
+
+static int
+mktable(const char *fn)
+{
+	unsigned char hdr[HBTABLE_SLOTSIZE];
+	char *tmp;
+	mode_t mask;
+	int fd, error;
+
+	if ((tmp = malloc(strlen(fn) + sizeof(".XXXXXX"))) == NULL)
+		return (-1);
+	strcpy(tmp, fn);
+	strcat(tmp, ".XXXXXX");
+
+	if ((fd = mkstemp(tmp)) < 0) {
+		free(tmp);
+		return (-1);
+	}
+
+	/* mkstemp() leaves out the permissions given by the umask */
+	mask = umask(0);
+	umask(mask);
+
+	memset(hdr, 0, sizeof(hdr));
+	memcpy(hdr, HBTABLE_MAGIC, HBTABLE_MAGICLEN);
+	put32(hdr + 8, HBTABLE_SLOTSIZE);
+	put32(hdr + 12, HBTABLE_DEFSLOTS);
+
+	if (fchmod(fd, DEFFILEMODE & ~mask) < 0 ||
+	    ftruncate(fd, (off_t)(HBTABLE_DEFSLOTS + 1) *
+	    HBTABLE_SLOTSIZE) < 0 ||
+	    pwrite(fd, hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+	    fsync(fd) < 0 ||
+	    (link(tmp, fn) < 0 && errno != EEXIST)) {
+		error = errno;
+		close(fd);
+		unlink(tmp);
+		free(tmp);
+		errno = error;
+		return (-1);
+	}
+
+	close(fd);
+	unlink(tmp);
+	free(tmp);
+
+	return (0);
+}
+
+static void
+put32(unsigned char *p, uint32_t v)
+{
+
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static void
+put64(unsigned char *p, uint64_t v)
+{
+
+	put32(p, (uint32_t)(v >> 32));
+	put32(p + 4, (uint32_t)v);
+}
+
+static uint32_t
+get32(const unsigned char *p)
+{
+
+	return ((uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+	    (uint32_t)p[2] << 8 | p[3]);
+}
+
+static uint64_t
+get64(const unsigned char *p)
+{
+
+	return ((uint64_t)get32(p) << 32 | get32(p + 4));
+}
+
+/* eof */
@@ -0,0 +1,74 @@
+/*-
+ * Copyright (c) 2009-2016 Janne Snabb. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *
+ * Software web site:
+ *   https://dist.epipe.com/downtimed/
+ *
+ */
+
+/*
+ * A heartbeat table shared by many hosts, typically on a file system
+ * served over the network. Instead of three time stamp files, each
+ * host owns a fixed slot in a single preallocated file and updates it
+ * with one pwrite(2). The slots are the size of a cache line and
+ * aligned to it, so that an update never straddles two slots, and each
+ * slot carries a checksum so that a torn write is detected by readers.
+ * All of the table can be read in one sequential read.
+ *
+ * The file begins with a header of the size of a slot:
+ *
+ *	magic		8 bytes, HBTABLE_MAGIC
+ *	slot size	uint32, HBTABLE_SLOTSIZE
+ *	slot count	uint32
+ *	reserved	zero
+ *
+ * followed by the slots. All numbers are big-endian. A slot which has
+ * never been written is all zero.
+ */
+
+#define	HBTABLE_MAGIC		"DTHBTAB1"
+#define	HBTABLE_MAGICLEN	8
+#define	HBTABLE_SLOTSIZE	64
+#define	HBTABLE_NAMELEN		32
+#define	HBTABLE_DEFSLOTS	256	/* slots in a newly created table */
+
+struct hbslot {
+	char	 name[HBTABLE_NAMELEN];	/* host name, NUL padded */
+	int64_t	 boot;		/* boot time of the host */
+	int64_t	 stamp;		/* last heartbeat */
+	int64_t	 shutdown;	/* shutdown time, 0 while running */
+	uint32_t seq;		/* incremented on each update */
+				/* followed by CRC-32 of the above */
+};
+
+/* Function prototypes */
+
+int	hbtable_open(const char *, int, uint32_t *);
+void	hbtable_encode(const struct hbslot *, unsigned char *);
+int	hbtable_decode(const unsigned char *, struct hbslot *);
+int	hbtable_read(int, uint32_t, struct hbslot *);
+int	hbtable_write(int, uint32_t, const struct hbslot *);
+
+/* eof */
@@ -0,0 +1,193 @@
+/*-
+ * Copyright (c) 2009-2016 Janne Snabb. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *
+ * Software web site:
+ *   https://dist.epipe.com/downtimed/
+ *
+ */
+
+/* Include config.h in case we use autoconf. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "heap.h"
+
+#define	ITEM(h, i)	((h)->base + (i) * (h)->size)
+#define	TEMP(h)		ITEM(h, (h)->cap)
+
+static void	heap_swap(struct heap *, size_t, size_t);
+static void	heap_up(struct heap *, size_t);
+static void	heap_down(struct heap *, size_t);
+
+/*
+ * Initialize an empty heap with room for cap elements of the given
+ * size. The heap grows automatically when needed. Return -1 and set
+ * errno if memory allocation fails.
+ */
+
+int
+heap_init(struct heap *h, size_t size, size_t cap,
+    int (*cmp)(const void *, const void *))
+{
+
+	if (cap == 0)
+		cap = 16;
+
+	if ((h->base = malloc((cap + 1) * size)) == NULL)
+		return (-1);
+
+	h->size = size;
+	h->nmemb = 0;
+	h->cap = cap;
+	h->cmp = cmp;
+
+	return (0);
+}
+
+void
+heap_free(struct heap *h)
+{
+
+	free(h->base);
+	h->base = NULL;
+	h->nmemb = h->cap = 0;
+}
+
+/* Add an element, return -1 and set errno if out of memory */
+
+int
+heap_push(struct heap *h, const void *elem)
+{
+	char *p;
+
+	if (h->nmemb == h->cap) {
+		if ((p = realloc(h->base, (h->cap * 2 + 1) * h->size)) == NULL)
+			return (-1);
+		h->base = p;
+		h->cap *= 2;
+	}
+
+	memcpy(ITEM(h, h->nmemb), elem, h->size);
+	heap_up(h, h->nmemb++);
+
+	return (0);
+}
+
+/* Remove the smallest element, copying it to elem unless it is NULL */
+
+void
+heap_pop(struct heap *h, void *elem)
+{
+
+	if (h->nmemb == 0)
+		return;
+
+	if (elem != NULL)
+		memcpy(elem, ITEM(h, 0), h->size);
+
+	if (--h->nmemb > 0) {
+		memcpy(ITEM(h, 0), ITEM(h, h->nmemb), h->size);
+		heap_down(h, 0);
+	}
+}
+
+/*
+ * Restore the heap order after the caller has modified the smallest
+ * element in place. This is cheaper than a pop followed by a push.
+ */
+
+void
+heap_fix_top(struct heap *h)
+{
+
+	if (h->nmemb > 0)
+		heap_down(h, 0);
+}
+
+/* Return pointer to the smallest element or NULL if the heap is empty */
+
+void *
+heap_top(struct heap *h)
+{
+
+	return (h->nmemb > 0 ? ITEM(h, 0) : NULL);
+}
+
+/* Return pointer to the element at index i, in no particular order */
+
+void *
+heap_item(struct heap *h, size_t i)
+{
+
+	return (i < h->nmemb ? ITEM(h, i) : NULL);
+}
+
+static void
+heap_swap(struct heap *h, size_t a, size_t b)
+{
+
+	memcpy(TEMP(h), ITEM(h, a), h->size);
+	memcpy(ITEM(h, a), ITEM(h, b), h->size);
+	memcpy(ITEM(h, b), TEMP(h), h->size);
+}
+
+static void
+heap_up(struct heap *h, size_t i)
+{
+	size_t parent;
+
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (h->cmp(ITEM(h, i), ITEM(h, parent)) >= 0)
+			break;
+		heap_swap(h, i, parent);
+		i = parent;
+	}
+}
+
+static void
+heap_down(struct heap *h, size_t i)
+{
+	size_t child;
+
+	while ((child = 2 * i + 1) < h->nmemb) {
+		if (child + 1 < h->nmemb &&
+		    h->cmp(ITEM(h, child + 1), ITEM(h, child)) < 0)
+			child++;
+		if (h->cmp(ITEM(h, i), ITEM(h, child)) <= 0)
+			break;
+		heap_swap(h, i, child);
+		i = child;
+	}
+}
+
+/* eof */
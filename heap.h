@@ -0,0 +1,56 @@
+/*-
+ * Copyright (c) 2009-2016 Janne Snabb. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *
+ * Software web site:
+ *   https://dist.epipe.com/downtimed/
+ *
+ */
+
+/*
+ * A simple binary min-heap of fixed size elements. The ordering is
+ * defined by a qsort(3) style comparison function. Used for merging
+ * sorted streams of records and for keeping the largest items seen.
+ */
+
+struct heap {
+	char	*base;		/* element storage, one extra for swapping */
+	size_t	 size;		/* size of one element */
+	size_t	 nmemb;		/* number of elements in the heap */
+	size_t	 cap;		/* number of elements allocated */
+	int	(*cmp)(const void *, const void *);
+};
+
+/* Function prototypes */
+
+int	heap_init(struct heap *, size_t, size_t,
+	    int (*)(const void *, const void *));
+void	heap_free(struct heap *);
+int	heap_push(struct heap *, const void *);
+void	heap_pop(struct heap *, void *);
+void	heap_fix_top(struct heap *);
+void *	heap_top(struct heap *);
+void *	heap_item(struct heap *, size_t);
+
+/* eof */
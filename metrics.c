@@ -0,0 +1,250 @@
+/*-
+ * Copyright (c) 2009-2016 Janne Snabb. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *
+ * Software web site:
+ *   https://dist.epipe.com/downtimed/
+ *
+ */
+
+/* Include config.h in case we use autoconf. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "metrics.h"
+
+/* from <sys/stat.h> */
+
+#ifndef DEFFILEMODE
+#define	DEFFILEMODE 0666
+#endif
+
+#define	TMP_SUFFIX	".tmp"
+
+static int	append(struct metrics *, const char *, size_t);
+static int	appendlabel(struct metrics *, const char *);
+
+/* Initialize an empty metrics buffer */
+
+void
+metrics_init(struct metrics *m)
+{
+
+	memset(m, 0, sizeof(struct metrics));
+}
+
+/* Start a metric family with the given name, type and help text */
+
+int
+metrics_family(struct metrics *m, const char *name, const char *type,
+    const char *help)
+{
+
+	if (append(m, "# HELP ", 7) < 0 ||
+	    append(m, name, strlen(name)) < 0 ||
+	    append(m, " ", 1) < 0 ||
+	    append(m, help, strlen(help)) < 0 ||
+	    append(m, "\n# TYPE ", 8) < 0 ||
+	    append(m, name, strlen(name)) < 0 ||
+	    append(m, " ", 1) < 0 ||
+	    append(m, type, strlen(type)) < 0 ||
+	    append(m, "\n", 1) < 0)
+		return (-1);
+
+	return (0);
+}
+
+/*
+ * Add a sample of the current family, with one label if label is not
+ * NULL. Return the field of its value for metrics_set(), or -1 if out
+ * of memory. The value is zero until set.
+ */
+
+long
+metrics_sample(struct metrics *m, const char *name, const char *label,
+    const char *value)
+{
+	char zero[METRICS_WIDTH];
+	long field;
+
+	if (append(m, name, strlen(name)) < 0)
+		return (-1);
+
+	if (label != NULL &&
+	    (append(m, "{", 1) < 0 ||
+	    append(m, label, strlen(label)) < 0 ||
+	    append(m, "=\"", 2) < 0 ||
+	    appendlabel(m, value) < 0 ||
+	    append(m, "\"}", 2) < 0))
+		return (-1);
+
+	if (append(m, " ", 1) < 0)
+		return (-1);
+
+	field = (long)m->len;
+	memset(zero, '0', sizeof(zero));
+	if (append(m, zero, sizeof(zero)) < 0 || append(m, "\n", 1) < 0)
+		return (-1);
+
+	return (field);
+}
+
+/* End the text. No families can be added after this. */
+
+int
+metrics_finish(struct metrics *m)
+{
+
+	return (append(m, "# EOF\n", 6));
+}
+
+/*
+ * Set the value of a field with the given number of decimals. A value
+ * too large for the field is shown as the largest one which fits.
+ */
+
+void
+metrics_set(struct metrics *m, long field, double v, int decimals)
+{
+	char tmp[64];
+	int n;
+
+	if (field < 0)
+		return;
+
+	n = snprintf(tmp, sizeof(tmp), "%0*.*f", METRICS_WIDTH, decimals, v);
+	if (n < 0 || n > METRICS_WIDTH) {
+		memset(tmp, '9', METRICS_WIDTH);
+		if (decimals > 0)
+			tmp[METRICS_WIDTH - decimals - 1] = '.';
+	}
+
+	memcpy(m->buf + field, tmp, METRICS_WIDTH);
+}
+
+/*
+ * Write the metrics to a file. They are written to a temporary file
+ * first, which is then renamed over the file, so that a reader never
+ * sees a partly written file. Return 0 on success, -1 on error.
+ */
+
+int
+metrics_publish(const struct metrics *m, const char *fn)
+{
+	char *tmp;
+	ssize_t n;
+	int fd, error;
+
+	if ((tmp = malloc(strlen(fn) + sizeof(TMP_SUFFIX))) == NULL)
+		return (-1);
+	strcpy(tmp, fn);
+	strcat(tmp, TMP_SUFFIX);
+
+	if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, DEFFILEMODE)) < 0) {
+		free(tmp);
+		return (-1);
+	}
+
+	if ((n = write(fd, m->buf, m->len)) != (ssize_t)m->len) {
+		if (n >= 0)
+			errno = ENOSPC;
+		goto fail;
+	}
+	if (close(fd) < 0) {
+		fd = -1;
+		goto fail;
+	}
+	fd = -1;
+	if (rename(tmp, fn) < 0)
+		goto fail;
+
+	free(tmp);
+	return (0);
+
+fail:
+	error = errno;
+	if (fd >= 0)
+		close(fd);
+	unlink(tmp);
+	free(tmp);
+	errno = error;
+	return (-1);
+}
+
+/* Append text to the buffer */
+
+static int
+append(struct metrics *m, const char *s, size_t len)
+{
+	char *p;
+	size_t size;
+
+	if (m->len + len > m->size) {
+		for (size = m->size ? m->size : 1024; size < m->len + len; )
+			size *= 2;
+		if ((p = realloc(m->buf, size)) == NULL)
+			return (-1);
+		m->buf = p;
+		m->size = size;
+	}
+
+	memcpy(m->buf + m->len, s, len);
+	m->len += len;
+
+	return (0);
+}
+
+/* Append a label value, escaping it as the format requires */
+
+static int
+appendlabel(struct metrics *m, const char *s)
+{
+	int ret = 0;
+
+	for (; *s != '\0' && ret == 0; s++) {
+		if (*s == '\\')
+			ret = append(m, "\\\\", 2);
+		else if (*s == '"')
+			ret = append(m, "\\\"", 2);
+		else if (*s == '\n')
+			ret = append(m, "\\n", 2);
+		else
+			ret = append(m, s, 1);
+	}
+
+	return (ret);
+}
+
+/* eof */
@@ -0,0 +1,58 @@
+/*-
+ * Copyright (c) 2009-2016 Janne Snabb. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *
+ * Software web site:
+ *   https://dist.epipe.com/downtimed/
+ *
+ */
+
+/*
+ * Metrics in the OpenMetrics text format, kept in a buffer which is
+ * laid out once and then updated in place: every value is a field of
+ * METRICS_WIDTH characters, zero-padded, so that setting a value never
+ * moves the rest of the text. Publishing is then just writing out the
+ * buffer as it is.
+ */
+
+#define	METRICS_WIDTH	20
+
+struct metrics {
+	char	*buf;
+	size_t	 len;		/* length of the text */
+	size_t	 size;		/* allocated size of buf */
+};
+
+/* Function prototypes */
+
+void	metrics_init(struct metrics *);
+int	metrics_family(struct metrics *, const char *, const char *,
+	    const char *);
+long	metrics_sample(struct metrics *, const char *, const char *,
+	    const char *);
+int	metrics_finish(struct metrics *);
+void	metrics_set(struct metrics *, long, double, int);
+int	metrics_publish(const struct metrics *, const char *);
+
+/* eof */
@@ -0,0 +1,340 @@
+/*-
+ * Copyright (c) 2009-2016 Janne Snabb. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *
+ * Software web site:
+ *   https://dist.epipe.com/downtimed/
+ *
+ */
+
+/* Include config.h in case we use autoconf. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "downtimedb.h"
+#include "pressure.h"
+
+/* The source files in the order of pressure_sources.fd */
+
+static const char *paths[PRESSURE_NFILES] = {
+	"/proc/pressure/cpu",
+	"/proc/pressure/memory",
+	"/proc/pressure/io",
+	"/proc/loadavg",
+	"/proc/stat",
+};
+
+#define	SRC_CPU		0
+#define	SRC_MEM		1
+#define	SRC_IO		2
+#define	SRC_LOAD	3
+#define	SRC_STAT	4
+
+/* Enough for the PSI files and the first line of /proc/stat */
+
+#define	READSIZE	512
+
+static int	readsrc(int, char *);
+static int	psiavg(const char *, const char *, double *);
+static void	setvalue(struct pressure_sample *, int, double);
+static int	sample_cmp(const void *, const void *);
+static void	put16(unsigned char *, uint16_t);
+static void	put32(unsigned char *, uint32_t);
+static void	put64(unsigned char *, uint64_t);
+static uint16_t	get16(const unsigned char *);
+static uint32_t	get32(const unsigned char *);
+static uint64_t	get64(const unsigned char *);
+
+/*
+ * Open the source files which exist on this system. Return the number
+ * of them, zero if there is nothing to sample.
+ */
+
+int
+pressure_open(struct pressure_sources *src)
+{
+	int i, n = 0;
+
+	memset(src, 0, sizeof(struct pressure_sources));
+
+	for (i = 0; i < PRESSURE_NFILES; i++) {
+		if ((src->fd[i] = open(paths[i], O_RDONLY)) < 0)
+			continue;
+		fcntl(src->fd[i], F_SETFD, FD_CLOEXEC);
+		n++;
+	}
+
+	return (n);
+}
+
+/* Close the source files */
+
+void
+pressure_close(struct pressure_sources *src)
+{
+	int i;
+
+	for (i = 0; i < PRESSURE_NFILES; i++) {
+		if (src->fd[i] >= 0)
+			close(src->fd[i]);
+		src->fd[i] = -1;
+	}
+}
+
+/* Take a sample. The seq field is left for the caller to fill in. */
+
+void
+pressure_take(struct pressure_sources *src, struct pressure_sample *s)
+{
+	char buf[READSIZE];
+	unsigned long long v[8];
+	uint64_t steal, total;
+	double d;
+	int i;
+
+	memset(s, 0, sizeof(struct pressure_sample));
+	s->when = time((time_t *)NULL);
+
+	if (readsrc(src->fd[SRC_CPU], buf) == 0 &&
+	    psiavg(buf, "some", &d) == 0)
+		setvalue(s, PRESSURE_CPU, d);
+
+	if (readsrc(src->fd[SRC_MEM], buf) == 0) {
+		if (psiavg(buf, "some", &d) == 0)
+			setvalue(s, PRESSURE_MEM, d);
+		if (psiavg(buf, "full", &d) == 0)
+			setvalue(s, PRESSURE_MEMFULL, d);
+	}
+
+	if (readsrc(src->fd[SRC_IO], buf) == 0) {
+		if (psiavg(buf, "some", &d) == 0)
+			setvalue(s, PRESSURE_IO, d);
+		if (psiavg(buf, "full", &d) == 0)
+			setvalue(s, PRESSURE_IOFULL, d);
+	}
+
+	if (readsrc(src->fd[SRC_LOAD], buf) == 0 &&
+	    sscanf(buf, "%lf", &d) == 1)
+		setvalue(s, PRESSURE_LOAD, d);
+
+	/* user nice system idle iowait irq softirq steal */
+	if (readsrc(src->fd[SRC_STAT], buf) == 0 &&
+	    sscanf(buf, "cpu %llu %llu %llu %llu %llu %llu %llu %llu",
+	    &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]) == 8) {
+		for (total = 0, i = 0; i < 8; i++)
+			total += v[i];
+		steal = v[7];
+
+		/* the share since the previous sample */
+		if (src->total != 0 && total > src->total)
+			setvalue(s, PRESSURE_STEAL, (double)(steal -
+			    src->steal) * 100 / (total - src->total));
+		src->steal = steal;
+		src->total = total;
+	}
+}
+
+/* Store a sample in its slot of the ring file. Return -1 on error. */
+
+int
+pressure_write(int fd, const struct pressure_sample *s)
+{
+	unsigned char buf[PRESSURE_SLOTSIZE];
+	int i;
+
+	put64(buf, (uint64_t)s->when);
+	for (i = 0; i < PRESSURE_NVALUES; i++)
+		put16(buf + 8 + 2 * i, s->value[i]);
+	put16(buf + 22, s->valid);
+	put32(buf + 24, s->seq);
+	put32(buf + 28, downtimedb_crc32(buf, 28));
+
+	errno = 0;
+	if (pwrite(fd, buf, sizeof(buf), (off_t)(s->seq % PRESSURE_SLOTS) *
+	    PRESSURE_SLOTSIZE) != sizeof(buf)) {
+		if (errno == 0)
+			errno = ENOSPC;
+		return (-1);
+	}
+
+	return (0);
+}
+
+/*
+ * Read the intact samples of a ring file into s, which must have room
+ * for PRESSURE_SLOTS samples, in the order they were taken. Return the
+ * number of samples or -1 on error.
+ */
+
+int
+pressure_read(int fd, struct pressure_sample *s)
+{
+	unsigned char buf[PRESSURE_SLOTS * PRESSURE_SLOTSIZE], *p;
+	ssize_t len;
+	int i, j, n = 0;
+
+	if ((len = pread(fd, buf, sizeof(buf), 0)) < 0)
+		return (-1);
+
+	for (i = 0; (i + 1) * PRESSURE_SLOTSIZE <= len; i++) {
+		p = buf + i * PRESSURE_SLOTSIZE;
+		if (get32(p + 28) != downtimedb_crc32(p, 28))
+			continue;
+
+		s[n].when = (int64_t)get64(p);
+		for (j = 0; j < PRESSURE_NVALUES; j++)
+			s[n].value[j] = get16(p + 8 + 2 * j);
+		s[n].valid = get16(p + 22);
+		s[n].seq = get32(p + 24);
+		n++;
+	}
+
+	qsort(s, n, sizeof(struct pressure_sample), sample_cmp);
+
+	return (n);
+}
+
+/* Read a source file from the start, return -1 if not available */
+
+static int
+readsrc(int fd, char *buf)
+{
+	ssize_t len;
+
+	if (fd < 0 || (len = pread(fd, buf, READSIZE - 1, 0)) <= 0)
+		return (-1);
+	buf[len] = '\0';
+
+	return (0);
+}
+
+/*
+ * Find the 10 second average of a line of a PSI file, which looks like
+ * "some avg10=0.12 avg60=0.05 avg300=0.01 total=12345".
+ */
+
+static int
+psiavg(const char *buf, const char *kind, double *d)
+{
+	const char *p;
+	size_t len = strlen(kind);
+
+	for (p = buf; p != NULL; p = strchr(p, '\n')) {
+		if (*p == '\n')
+			p++;
+		if (strncmp(p, kind, len) == 0 &&
+		    strncmp(p + len, " avg10=", 7) == 0)
+			return (sscanf(p + len + 7, "%lf", d) == 1 ? 0 : -1);
+	}
+
+	return (-1);
+}
+
+/* Store a value in hundredths, as much of it as fits */
+
+static void
+setvalue(struct pressure_sample *s, int i, double d)
+{
+
+	d = d * 100 + 0.5;
+	s->value[i] = d < 0 ? 0 : d > UINT16_MAX ? UINT16_MAX : (uint16_t)d;
+	s->valid |= 1 << i;
+}
+
+/* Order samples by sequence number */
+
+static int
+sample_cmp(const void *a, const void *b)
+{
+	const struct pressure_sample *sa = a;
+	const struct pressure_sample *sb = b;
+
+	if (sa->seq != sb->seq)
+		return (sa->seq < sb->seq ? -1 : 1);
+
+	return (0);
+}
+
+static void
+put16(unsigned char *p, uint16_t v)
+{
+
+	p[0] = v >> 8;
+	p[1] = v;
+}
+
+static void
+put32(unsigned char *p, uint32_t v)
+{
+
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static void
+put64(unsigned char *p, uint64_t v)
+{
+
+	put32(p, (uint32_t)(v >> 32));
+	put32(p + 4, (uint32_t)v);
+}
+
+static uint16_t
+get16(const unsigned char *p)
+{
+
+	return ((uint16_t)(p[0] << 8 | p[1]));
+}
+
+static uint32_t
+get32(const unsigned char *p)
+{
+
+	return ((uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+	    (uint32_t)p[2] << 8 | p[3]);
+}
+
+static uint64_t
+get64(const unsigned char *p)
+{
+
+	return ((uint64_t)get32(p) << 32 | get32(p + 4));
+}
+
+/* eof */
@@ -0,0 +1,94 @@
+/*-
+ * Copyright (c) 2009-2016 Janne Snabb. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *
+ * Software web site:
+ *   https://dist.epipe.com/downtimed/
+ *
+ */
+
+/*
+ * Samples of how loaded the system is, taken on each tick and kept in
+ * a small ring file in the data directory, so that after a crash the
+ * next run can tell what the system looked like just before it. This
+ * helps to tell a crash caused by load apart from a hardware fault.
+ *
+ * A sample holds the "some" 10 second averages of the Linux pressure
+ * stall information (PSI) for cpu, memory and io, the "full" averages
+ * for memory and io, the 1 minute load average and the share of CPU
+ * time stolen by the hypervisor since the previous sample. The source
+ * files are kept open and re-read with pread(2). Values which are not
+ * available on the system are left out.
+ *
+ * Sample number seq is stored in slot seq % PRESSURE_SLOTS of the ring
+ * file. A slot consists of:
+ *
+ *	when		int64, time of the sample
+ *	values		PRESSURE_NVALUES uint16, percent or load times 100
+ *	valid		uint16, bit i set if values[i] is known
+ *	seq		uint32
+ *	crc		uint32, CRC-32 of the above
+ *
+ * All numbers are big-endian. A slot which has never been written or
+ * was torn by a crash fails the checksum and is ignored.
+ */
+
+#define	PRESSURE_SLOTS		256
+#define	PRESSURE_SLOTSIZE	32
+
+#define	PRESSURE_CPU		0	/* values of a sample */
+#define	PRESSURE_MEM		1
+#define	PRESSURE_MEMFULL	2
+#define	PRESSURE_IO		3
+#define	PRESSURE_IOFULL		4
+#define	PRESSURE_LOAD		5
+#define	PRESSURE_STEAL		6
+#define	PRESSURE_NVALUES	7
+
+struct pressure_sample {
+	int64_t	 when;
+	uint16_t value[PRESSURE_NVALUES];
+	uint16_t valid;
+	uint32_t seq;
+};
+
+/* The open source files and what is needed to compute the steal time */
+
+#define	PRESSURE_NFILES		5
+
+struct pressure_sources {
+	int	 fd[PRESSURE_NFILES];
+	uint64_t steal;		/* from /proc/stat at the previous sample */
+	uint64_t total;
+};
+
+/* Function prototypes */
+
+int	pressure_open(struct pressure_sources *);
+void	pressure_close(struct pressure_sources *);
+void	pressure_take(struct pressure_sources *, struct pressure_sample *);
+int	pressure_write(int, const struct pressure_sample *);
+int	pressure_read(int, struct pressure_sample *);
+
+/* eof */
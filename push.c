@@ -0,0 +1,662 @@
+/*-
+ * Copyright (c) 2009-2016 Janne Snabb. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *
+ * Software web site:
+ *   https://dist.epipe.com/downtimed/
+ *
+ */
+
+/* Include config.h in case we use autoconf. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include <netinet/in.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "downtimedb.h"
+#include "push.h"
+
+/* from <sys/stat.h> */
+
+#ifndef DEFFILEMODE
+#define	DEFFILEMODE 0666
+#endif
+
+#define	RECSIZE		sizeof(struct downtimedb)
+#define	TMP_SUFFIX	".tmp"
+
+static int	pushconnect(const char *);
+static int	unixaddr(const char *, struct sockaddr_un *);
+static int	resolve(const char *, int, struct addrinfo **);
+static int	connectfd(int, const struct sockaddr *, socklen_t);
+static int	sendall(int, const void *, size_t);
+static int	recvall(int, void *, size_t);
+static int	dropfront(const char *, int, off_t, off_t);
+static void	put32(unsigned char *, uint32_t);
+static uint32_t	get32(const unsigned char *);
+
+/* Append records to a spool file. Return -1 on error. */
+
+int
+push_spool(const char *spool, const struct downtimedb *ents, int n)
+{
+	struct downtimedb ent;
+	int fd, i, error;
+
+	if ((fd = open(spool, O_WRONLY | O_CREAT | O_APPEND,
+	    DEFFILEMODE)) < 0)
+		return (-1);
+
+	/* downtimedb_write() converts the record in place */
+	for (i = 0; i < n; i++) {
+		ent = ents[i];
+		if (downtimedb_write(fd, &ent) < 0) {
+			error = errno;
+			close(fd);
+			errno = error;
+			return (-1);
+		}
+	}
+
+	return (close(fd));
+}
+
+/* Return the number of records in a spool file, or -1 on error */
+
+int
+push_pending(const char *spool)
+{
+	struct stat sb;
+
+	if (stat(spool, &sb) < 0)
+		return (errno == ENOENT ? 0 : -1);
+
+	return ((int)(sb.st_size / RECSIZE));
+}
+
+/*
+ * Send the records of a spool file to the collector at addr, which is
+ * either a path name of a UNIX domain socket or host:port, on behalf
+ * of the host called name. The spool is not changed; the number of
+ * records acknowledged, which push_drop() should remove, is stored in
+ * acked even if sending the rest failed. Return the number of records
+ * left, or -1 on error with errno set.
+ */
+
+int
+push_send(const char *spool, const char *addr, const char *name,
+    off_t *acked)
+{
+	unsigned char *buf, ack[4];
+	struct stat sb;
+	off_t nrec, pos = 0;
+	uint32_t n, taken, namelen;
+	int fd, sock = -1, error = 0;
+
+	*acked = 0;
+	if ((fd = open(spool, O_RDONLY)) < 0)
+		return (errno == ENOENT ? 0 : -1);
+	if (fstat(fd, &sb) < 0) {
+		error = errno;
+		close(fd);
+		errno = error;
+		return (-1);
+	}
+	if ((nrec = sb.st_size / RECSIZE) == 0) {
+		close(fd);
+		return (0);
+	}
+
+	namelen = strlen(name);
+	if ((buf = malloc(PUSH_HDRSIZE + namelen + PUSH_BATCH * RECSIZE))
+	    == NULL) {
+		close(fd);
+		return (-1);
+	}
+	memcpy(buf, PUSH_MAGIC, PUSH_MAGICLEN);
+	put32(buf + 8, namelen);
+	memcpy(buf + PUSH_HDRSIZE, name, namelen);
+
+	if ((sock = pushconnect(addr)) < 0)
+		error = errno;
+
+	for (; error == 0 && pos < nrec; pos += taken) {
+		n = nrec - pos > PUSH_BATCH ? PUSH_BATCH : nrec - pos;
+		put32(buf + 12, n);
+
+		if (pread(fd, buf + PUSH_HDRSIZE + namelen, n * RECSIZE,
+		    pos * RECSIZE) != n * RECSIZE) {
+			error = errno != 0 ? errno : EIO;
+			break;
+		}
+		if (sendall(sock, buf, PUSH_HDRSIZE + namelen + n * RECSIZE)
+		    < 0 || recvall(sock, ack, sizeof(ack)) < 0) {
+			error = errno;
+			break;
+		}
+
+		/* the collector may take fewer records, but not more */
+		if ((taken = get32(ack)) > n) {
+			error = EPROTO;
+			break;
+		}
+		if (taken == 0)
+			break;
+	}
+
+	if (sock >= 0)
+		close(sock);
+	free(buf);
+	close(fd);
+
+	*acked = pos;
+	if (error != 0) {
+		errno = error;
+		return (-1);
+	}
+
+	return ((int)(nrec - pos));
+}
+
+/*
+ * Remove the first n records of a spool file, keeping any added after
+ * they were sent. Return -1 on error.
+ */
+
+int
+push_drop(const char *spool, off_t n)
+{
+	struct stat sb;
+	off_t nrec;
+	int fd, ret, error;
+
+	if (n == 0)
+		return (0);
+	if ((fd = open(spool, O_RDWR)) < 0)
+		return (-1);
+	if (fstat(fd, &sb) < 0) {
+		error = errno;
+		close(fd);
+		errno = error;
+		return (-1);
+	}
+
+	if ((nrec = sb.st_size / RECSIZE) <= n)
+		ret = ftruncate(fd, 0);
+	else
+		ret = dropfront(spool, fd, n, nrec);
+
+	error = errno;
+	if (close(fd) < 0 && ret == 0)
+		return (-1);
+	errno = error;
+	return (ret);
+}
+
+/*
+ * Listen for pushed records at addr, given as for push_send(). An
+ * empty host in host:port means any address, for which an IPv6 socket
+ * also taking IPv4 is preferred. Return the listening socket, or -1 on
+ * error with errno set.
+ */
+
+int
+push_listen(const char *addr)
+{
+	struct sockaddr_un sun;
+	struct addrinfo *res, *ai;
+	int fd = -1, on = 1, off = 0, pass, error;
+
+	if (strchr(addr, '/') != NULL) {
+		if (unixaddr(addr, &sun) < 0)
+			return (-1);
+		if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+			return (-1);
+		if (bind(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0 ||
+		    listen(fd, 5) < 0) {
+			error = errno;
+			close(fd);
+			errno = error;
+			return (-1);
+		}
+		return (fd);
+	}
+
+	if (resolve(addr, AI_PASSIVE, &res) < 0)
+		return (-1);
+
+	error = EADDRNOTAVAIL;
+	for (pass = 0; fd < 0 && pass < 2; pass++)
+		for (ai = res; ai != NULL; ai = ai->ai_next) {
+			if ((ai->ai_family == AF_INET6) != (pass == 0))
+				continue;
+			if ((fd = socket(ai->ai_family, ai->ai_socktype,
+			    ai->ai_protocol)) < 0) {
+				error = errno;
+				continue;
+			}
+			setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on,
+			    sizeof(on));
+			if (ai->ai_family == AF_INET6)
+				setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY,
+				    &off, sizeof(off));
+			if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 &&
+			    listen(fd, 5) == 0)
+				break;
+			error = errno;
+			close(fd);
+			fd = -1;
+		}
+	freeaddrinfo(res);
+
+	if (fd < 0)
+		errno = error;
+	return (fd);
+}
+
+/*
+ * Accept one connection on the listening socket lfd and append all
+ * the records pushed through it to the downtime database open in dbfd,
+ * acknowledging each batch once written. The name of the host which
+ * pushed them is stored in name. Return the number of records stored,
+ * or -1 on error with errno set.
+ */
+
+int
+push_serve(int lfd, int dbfd, char *name, size_t size)
+{
+	unsigned char hdr[PUSH_HDRSIZE], ack[4], *buf = NULL;
+	struct timeval tv;
+	uint32_t n, namelen;
+	int fd, total = 0, error = 0;
+
+	name[0] = '\0';
+	if ((fd = accept(lfd, NULL, NULL)) < 0)
+		return (-1);
+
+	tv.tv_sec = PUSH_TIMEOUT;
+	tv.tv_usec = 0;
+	if (setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) < 0 ||
+	    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0)
+		error = errno;
+
+	if (error == 0 &&
+	    (buf = malloc(PUSH_BATCH * RECSIZE)) == NULL)
+		error = errno;
+
+	while (error == 0) {
+		/* the sender closes the connection between batches */
+		if (recvall(fd, hdr, sizeof(hdr)) < 0) {
+			if (errno != ECONNRESET)
+				error = errno;
+			break;
+		}
+
+		namelen = get32(hdr + 8);
+		n = get32(hdr + 12);
+		if (memcmp(hdr, PUSH_MAGIC, PUSH_MAGICLEN) != 0 ||
+		    namelen >= size || n > PUSH_BATCH) {
+			error = EPROTO;
+			break;
+		}
+
+		if (recvall(fd, name, namelen) < 0 ||
+		    recvall(fd, buf, n * RECSIZE) < 0) {
+			error = errno;
+			break;
+		}
+		name[namelen] = '\0';
+
+		/* records are pushed as stored, so they are copied as is */
+		if (write(dbfd, buf, n * RECSIZE) != n * RECSIZE) {
+			error = errno != 0 ? errno : ENOSPC;
+			break;
+		}
+		if (fsync(dbfd) < 0) {
+			error = errno;
+			break;
+		}
+
+		put32(ack, n);
+		if (sendall(fd, ack, sizeof(ack)) < 0) {
+			error = errno;
+			break;
+		}
+		total += n;
+	}
+
+	free(buf);
+	close(fd);
+	if (error != 0) {
+		errno = error;
+		return (-1);
+	}
+
+	return (total);
+}
+
+/* Connect to the collector, return the socket or -1 on error */
+
+static int
+pushconnect(const char *addr)
+{
+	struct sockaddr_un sun;
+	struct addrinfo *res, *ai;
+	int fd = -1, error;
+
+	if (strchr(addr, '/') != NULL) {
+		if (unixaddr(addr, &sun) < 0)
+			return (-1);
+		if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+			return (-1);
+		if (connectfd(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0) {
+			error = errno;
+			close(fd);
+			errno = error;
+			return (-1);
+		}
+		return (fd);
+	}
+
+	if (resolve(addr, 0, &res) < 0)
+		return (-1);
+
+	error = EHOSTUNREACH;
+	for (ai = res; ai != NULL; ai = ai->ai_next) {
+		if ((fd = socket(ai->ai_family, ai->ai_socktype,
+		    ai->ai_protocol)) < 0) {
+			error = errno;
+			continue;
+		}
+		if (connectfd(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+			break;
+		error = errno;
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+
+	if (fd < 0)
+		errno = error;
+	return (fd);
+}
+
+/* Fill in the address of a UNIX domain socket, return -1 on error */
+
+static int
+unixaddr(const char *path, struct sockaddr_un *sun)
+{
+
+	memset(sun, 0, sizeof(*sun));
+	sun->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(sun->sun_path)) {
+		errno = ENAMETOOLONG;
+		return (-1);
+	}
+	strcpy(sun->sun_path, path);
+
+	return (0);
+}
+
+/*
+ * Look up the addresses of host:port, where an IPv6 address is given
+ * in brackets. With flags AI_PASSIVE, an empty host means any address.
+ * Return -1 on error with errno set.
+ */
+
+static int
+resolve(const char *addr, int flags, struct addrinfo **res)
+{
+	struct addrinfo hints;
+	char *host, *port;
+	int ret;
+
+	if ((host = strdup(addr)) == NULL)
+		return (-1);
+	if ((port = strrchr(host, ':')) == NULL) {
+		free(host);
+		errno = EINVAL;
+		return (-1);
+	}
+	*port++ = '\0';
+
+	if (host[0] == '[' && host[strlen(host) - 1] == ']') {
+		host[strlen(host) - 1] = '\0';
+		memmove(host, host + 1, strlen(host));
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = flags;
+	ret = getaddrinfo(host[0] != '\0' ? host : NULL, port, &hints, res);
+	free(host);
+	if (ret != 0) {
+		errno = ret == EAI_SYSTEM ? errno : EHOSTUNREACH;
+		return (-1);
+	}
+
+	return (0);
+}
+
+/*
+ * Connect a socket, waiting at most PUSH_TIMEOUT seconds, and set the
+ * same timeout for sending and receiving. Return -1 on error.
+ */
+
+static int
+connectfd(int fd, const struct sockaddr *sa, socklen_t len)
+{
+	struct pollfd pfd;
+	struct timeval tv;
+	socklen_t errlen;
+	int flags, error;
+
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+	if ((flags = fcntl(fd, F_GETFL)) < 0 ||
+	    fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+		return (-1);
+
+	if (connect(fd, sa, len) < 0) {
+		if (errno != EINPROGRESS)
+			return (-1);
+
+		pfd.fd = fd;
+		pfd.events = POLLOUT;
+		switch (poll(&pfd, 1, PUSH_TIMEOUT * 1000)) {
+		case -1:
+			return (-1);
+		case 0:
+			errno = ETIMEDOUT;
+			return (-1);
+		}
+
+		errlen = sizeof(error);
+		if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &errlen) < 0)
+			return (-1);
+		if (error != 0) {
+			errno = error;
+			return (-1);
+		}
+	}
+
+	if (fcntl(fd, F_SETFL, flags) < 0)
+		return (-1);
+
+	tv.tv_sec = PUSH_TIMEOUT;
+	tv.tv_usec = 0;
+	if (setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) < 0 ||
+	    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0)
+		return (-1);
+
+	return (0);
+}
+
+/* Send all of a buffer, return -1 on error */
+
+static int
+sendall(int fd, const void *buf, size_t len)
+{
+	const unsigned char *p = buf;
+	ssize_t n;
+
+	while (len > 0) {
+		if ((n = write(fd, p, len)) < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				errno = ETIMEDOUT;
+			return (-1);
+		}
+		p += n;
+		len -= n;
+	}
+
+	return (0);
+}
+
+/* Receive all of a buffer, return -1 on error */
+
+static int
+recvall(int fd, void *buf, size_t len)
+{
+	unsigned char *p = buf;
+	ssize_t n;
+
+	while (len > 0) {
+		if ((n = read(fd, p, len)) < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				errno = ETIMEDOUT;
+			return (-1);
+		}
+		if (n == 0) {
+			errno = ECONNRESET;
+			return (-1);
+		}
+		p += n;
+		len -= n;
+	}
+
+	return (0);
+}
+
+/*
+ * Remove the first pos records of the spool open in fd, by writing the
+ * rest to a new file which then replaces the spool.
+ */
+
+static int
+dropfront(const char *spool, int fd, off_t pos, off_t nrec)
+{
+	unsigned char *buf;
+	char *tmp;
+	size_t len;
+	int out, error;
+
+	len = (nrec - pos) * RECSIZE;
+	if ((buf = malloc(len)) == NULL)
+		return (-1);
+	if (pread(fd, buf, len, pos * RECSIZE) != len) {
+		error = errno != 0 ? errno : EIO;
+		free(buf);
+		errno = error;
+		return (-1);
+	}
+
+	if ((tmp = malloc(strlen(spool) + sizeof(TMP_SUFFIX))) == NULL) {
+		free(buf);
+		return (-1);
+	}
+	strcpy(tmp, spool);
+	strcat(tmp, TMP_SUFFIX);
+
+	error = 0;
+	if ((out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, DEFFILEMODE)) < 0)
+		error = errno;
+	else {
+		if (write(out, buf, len) != len)
+			error = errno != 0 ? errno : ENOSPC;
+		if (close(out) < 0 && error == 0)
+			error = errno;
+		if (error == 0 && rename(tmp, spool) < 0)
+			error = errno;
+		if (error != 0)
+			unlink(tmp);
+	}
+
+	free(tmp);
+	free(buf);
+	if (error != 0) {
+		errno = error;
+		return (-1);
+	}
+
+	return (0);
+}
+
+/* Store a 32 bit number in big-endian order */
+
+static void
+put32(unsigned char *p, uint32_t v)
+{
+
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+/* Fetch a 32 bit number stored in big-endian order */
+
+static uint32_t
+get32(const unsigned char *p)
+{
+
+	return ((uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+	    (uint32_t)p[2] << 8 | p[3]);
+}
+
+/* eof */
@@ -0,0 +1,68 @@
+/*-
+ * Copyright (c) 2009-2016 Janne Snabb. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *
+ * Software web site:
+ *   https://dist.epipe.com/downtimed/
+ *
+ */
+
+/*
+ * Pushing downtime records to a remote collector, so that the history
+ * of a host is not lost with the host. New records are appended to a
+ * spool file, which has the format of a downtime database, and sent
+ * from there in batches. The collector acknowledges each batch; the
+ * records acknowledged are removed from the spool. A record may be sent
+ * again if the daemon dies before removing it, so the collector should
+ * ignore duplicates.
+ *
+ * A batch consists of:
+ *
+ *	magic		8 bytes, PUSH_MAGIC
+ *	namelen		uint32, length of the name
+ *	count		uint32, number of records
+ *	name		namelen bytes, the host the records belong to
+ *	records		count * 16 bytes, as in a downtime database
+ *
+ * to which the collector replies with a uint32 giving the number of
+ * records it has stored, the first ones of the batch. A reply of 0 asks
+ * the daemon to try again later. All numbers are big-endian.
+ */
+
+#define	PUSH_MAGIC	"DTPUSH01"
+#define	PUSH_MAGICLEN	8
+#define	PUSH_HDRSIZE	16
+#define	PUSH_BATCH	512	/* records per batch at most */
+#define	PUSH_TIMEOUT	5	/* seconds to wait for the collector */
+
+/* Function prototypes */
+
+int	push_spool(const char *, const struct downtimedb *, int);
+int	push_pending(const char *);
+int	push_send(const char *, const char *, const char *, off_t *);
+int	push_drop(const char *, off_t);
+int	push_listen(const char *);
+int	push_serve(int, int, char *, size_t);
+
+/* eof */
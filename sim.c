@@ -0,0 +1,408 @@
+/*-
+ * Copyright (c) 2009-2016 Janne Snabb. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *
+ * Software web site:
+ *   https://dist.epipe.com/downtimed/
+ *
+ */
+
+/* Include config.h in case we use autoconf. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+
+/* Only while loading: the repeats are expanded before the replay */
+
+#define	SIM_REPEAT	100
+#define	SIM_END		101
+
+static const struct {
+	const char *name;
+	int	what;
+} keywords[] = {
+	{ "boot",	SIM_BOOT },
+	{ "run",	SIM_RUN },
+	{ "freeze",	SIM_FREEZE },
+	{ "suspend",	SIM_SUSPEND },
+	{ "step",	SIM_STEP },
+	{ "crash",	SIM_CRASH },
+	{ "shutdown",	SIM_SHUTDOWN },
+	{ "torn",	SIM_TORN },
+	{ "repeat",	SIM_REPEAT },
+	{ "end",	SIM_END },
+};
+
+static int	parseline(char *, struct sim_event *, const char **);
+static int	duration(const char *, int, int64_t *);
+static int	expand(struct sim_scenario *, const struct sim_event *,
+		    const size_t *, size_t, size_t);
+static int	append(struct sim_scenario *, const struct sim_event *);
+static int	validate(struct sim_scenario *);
+static int	fail(struct sim_scenario *, int, const char *);
+
+/*
+ * Load a scenario. Return -1 with errno set if the file can not be
+ * read, or with errline and errmsg set if it is not valid.
+ */
+
+int
+sim_load(const char *fn, struct sim_scenario *sc)
+{
+	char str[1024];
+	struct sim_event *raw = NULL, *p;
+	size_t *match = NULL, *stack = NULL, *q, nraw = 0, size = 0;
+	size_t depth = 0;
+	const char *msg;
+	FILE *fp;
+	int ret = -1, line = 0, error;
+
+	memset(sc, 0, sizeof(struct sim_scenario));
+
+	if ((fp = fopen(fn, "r")) == NULL)
+		return (-1);
+
+	while (fgets(str, sizeof(str), fp) != NULL) {
+		line++;
+		if (nraw == size) {
+			size = size == 0 ? 64 : size * 2;
+			if ((p = realloc(raw, size * sizeof(*raw))) == NULL)
+				goto out;
+			raw = p;
+			if ((q = realloc(match, size * sizeof(*match))) == NULL)
+				goto out;
+			match = q;
+			if ((q = realloc(stack, size * sizeof(*stack))) == NULL)
+				goto out;
+			stack = q;
+		}
+
+		switch (parseline(str, &raw[nraw], &msg)) {
+		case -1:
+			fail(sc, line, msg);
+			goto out;
+		case 0:
+			continue;
+		}
+		raw[nraw].line = line;
+
+		/* pair each end with its repeat */
+		if (raw[nraw].what == SIM_REPEAT)
+			stack[depth++] = nraw;
+		if (raw[nraw].what == SIM_END) {
+			if (depth == 0) {
+				fail(sc, line, "end without repeat");
+				goto out;
+			}
+			match[stack[--depth]] = nraw;
+		}
+		nraw++;
+	}
+	if (ferror(fp))
+		goto out;
+	if (depth > 0) {
+		fail(sc, raw[stack[depth - 1]].line, "repeat without end");
+		goto out;
+	}
+
+	if (expand(sc, raw, match, 0, nraw) == 0 && validate(sc) == 0)
+		ret = 0;
+
+out:
+	error = errno;
+	fclose(fp);
+	free(raw);
+	free(match);
+	free(stack);
+	if (ret < 0) {
+		free(sc->ev);
+		sc->ev = NULL;
+		sc->n = 0;
+		errno = sc->errline > 0 ? EINVAL : error;
+	}
+
+	return (ret);
+}
+
+void
+sim_free(struct sim_scenario *sc)
+{
+
+	free(sc->ev);
+	sc->ev = NULL;
+	sc->n = 0;
+}
+
+/*
+ * Parse a line of a scenario. Return 1 if it has an event, 0 if it is
+ * empty, or -1 with msg set if it is not valid.
+ */
+
+static int
+parseline(char *str, struct sim_event *e, const char **msg)
+{
+	char *kw, *arg, *p;
+	long long count;
+	size_t i;
+
+	if ((p = strchr(str, '#')) != NULL)
+		*p = '\0';
+
+	if ((kw = strtok(str, " \t\n")) == NULL)
+		return (0);
+	arg = strtok(NULL, " \t\n");
+	if (strtok(NULL, " \t\n") != NULL) {
+		*msg = "too many arguments";
+		return (-1);
+	}
+
+	for (i = 0; i < sizeof(keywords) / sizeof(keywords[0]); i++)
+		if (strcmp(kw, keywords[i].name) == 0)
+			break;
+	if (i == sizeof(keywords) / sizeof(keywords[0])) {
+		*msg = "unknown event";
+		return (-1);
+	}
+	e->what = keywords[i].what;
+	e->arg = 0;
+
+	switch (e->what) {
+	case SIM_BOOT:
+		if (arg == NULL)
+			return (1);
+		if (arg[0] == '+')
+			break;
+		/* a time since the epoch */
+		errno = 0;
+		count = strtoll(arg, &p, 10);
+		if (p == arg || *p != '\0' || errno != 0 || count <= 0 ||
+		    count > INT64_MAX / 1000000) {
+			*msg = "boot time is not valid";
+			return (-1);
+		}
+		e->what = SIM_BOOTAT;
+		e->arg = (int64_t)count * 1000000;
+		return (1);
+	case SIM_SHUTDOWN:
+		if (arg == NULL)
+			return (1);
+		break;
+	case SIM_RUN:
+	case SIM_FREEZE:
+	case SIM_SUSPEND:
+	case SIM_STEP:
+		if (arg == NULL) {
+			*msg = "duration missing";
+			return (-1);
+		}
+		break;
+	case SIM_REPEAT:
+		if (arg == NULL) {
+			*msg = "repeat count missing";
+			return (-1);
+		}
+		errno = 0;
+		count = strtoll(arg, &p, 10);
+		if (p == arg || *p != '\0' || errno != 0 || count < 0) {
+			*msg = "repeat count is not valid";
+			return (-1);
+		}
+		e->arg = count;
+		return (1);
+	default:
+		if (arg != NULL) {
+			*msg = "too many arguments";
+			return (-1);
+		}
+		return (1);
+	}
+
+	if (duration(arg, e->what == SIM_STEP, &e->arg) < 0) {
+		*msg = "duration is not valid";
+		return (-1);
+	}
+
+	return (1);
+}
+
+/*
+ * Parse a duration into microseconds. Return -1 if it is not valid, or
+ * if it is negative and neg is not set.
+ */
+
+static int
+duration(const char *str, int neg, int64_t *usec)
+{
+	long long v, mult;
+	char *p;
+
+	errno = 0;
+	v = strtoll(str, &p, 10);
+	if (p == str || errno != 0 || (v < 0 && !neg))
+		return (-1);
+
+	switch (*p) {
+	case '\0':
+	case 's':
+		mult = 1;
+		break;
+	case 'm':
+		mult = 60;
+		break;
+	case 'h':
+		mult = 3600;
+		break;
+	case 'd':
+		mult = 86400;
+		break;
+	case 'w':
+		mult = 7 * 86400;
+		break;
+	case 'y':
+		mult = 365 * 86400;
+		break;
+	default:
+		return (-1);
+	}
+	if (*p != '\0' && p[1] != '\0')
+		return (-1);
+
+	if (v > INT64_MAX / 1000000 / mult ||
+	    v < -(INT64_MAX / 1000000 / mult))
+		return (-1);
+	*usec = (int64_t)v * mult * 1000000;
+
+	return (0);
+}
+
+/* Append the events from raw[from] to raw[to - 1], repeats expanded */
+
+static int
+expand(struct sim_scenario *sc, const struct sim_event *raw,
+    const size_t *match, size_t from, size_t to)
+{
+	int64_t k;
+	size_t i;
+
+	for (i = from; i < to; i++) {
+		if (raw[i].what != SIM_REPEAT) {
+			if (append(sc, &raw[i]) < 0)
+				return (-1);
+			continue;
+		}
+
+		/* an empty body would only keep us busy */
+		if (match[i] > i + 1)
+			for (k = 0; k < raw[i].arg; k++)
+				if (expand(sc, raw, match, i + 1,
+				    match[i]) < 0)
+					return (-1);
+		i = match[i];
+	}
+
+	return (0);
+}
+
+static int
+append(struct sim_scenario *sc, const struct sim_event *e)
+{
+	struct sim_event *p;
+	size_t size;
+
+	if (sc->n >= SIM_MAXEVENTS)
+		return (fail(sc, e->line, "too many events"));
+
+	/* the array is doubled whenever it is full */
+	if (sc->n == 0 || (sc->n >= 64 && (sc->n & (sc->n - 1)) == 0)) {
+		size = sc->n == 0 ? 64 : sc->n * 2;
+		if ((p = realloc(sc->ev, size * sizeof(*p))) == NULL)
+			return (-1);
+		sc->ev = p;
+	}
+	sc->ev[sc->n++] = *e;
+
+	return (0);
+}
+
+/* Check that each event can happen in the state the system is in */
+
+static int
+validate(struct sim_scenario *sc)
+{
+	const struct sim_event *e;
+	size_t i;
+	int up = 0;
+
+	for (i = 0; i < sc->n; i++) {
+		e = &sc->ev[i];
+		switch (e->what) {
+		case SIM_BOOT:
+		case SIM_BOOTAT:
+			if (up)
+				return (fail(sc, e->line,
+				    "boot while the system is up"));
+			up = 1;
+			break;
+		case SIM_TORN:
+			if (up)
+				return (fail(sc, e->line,
+				    "torn while the system is up"));
+			break;
+		case SIM_STEP:
+			break;
+		default:
+			if (!up)
+				return (fail(sc, e->line,
+				    "event while the system is down"));
+			if (e->what == SIM_CRASH || e->what == SIM_SHUTDOWN)
+				up = 0;
+			break;
+		}
+	}
+
+	return (0);
+}
+
+static int
+fail(struct sim_scenario *sc, int line, const char *msg)
+{
+
+	sc->errline = line;
+	sc->errmsg = msg;
+
+	return (-1);
+}
+
+/* eof */
@@ -0,0 +1,88 @@
+/*-
+ * Copyright (c) 2009-2016 Janne Snabb. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *
+ * Software web site:
+ *   https://dist.epipe.com/downtimed/
+ *
+ */
+
+/*
+ * Scenarios replayed by downtimed(8) on a virtual clock, for testing
+ * the detection of crashes and shutdowns without rebooting anything.
+ * A scenario is a text file with one event on each line:
+ *
+ *	boot [time|+duration]	the system boots, at the given time in
+ *				seconds since the epoch or the given time
+ *				after the previous event
+ *	run duration		downtimed runs, updating its time stamps
+ *	freeze duration		the system stops, then goes on (a stall)
+ *	suspend duration	the system is suspended
+ *	step [+|-]duration	the wall clock is set forward or back
+ *	crash			the system dies at once
+ *	shutdown [duration]	downtimed is signalled to stop, and the
+ *				system powers off after the duration
+ *	torn			half a record is left at the end of the
+ *				downtime databases, as a crash in the
+ *				middle of writing one would
+ *	repeat count		the events up to the matching end are
+ *	end			repeated count times
+ *
+ * Durations are given in seconds, or with one of the suffixes s, m, h,
+ * d, w or y (365 days). Everything after a # is a comment.
+ */
+
+#define	SIM_BOOT	1	/* arg: time since the previous event */
+#define	SIM_BOOTAT	2	/* arg: time since the epoch */
+#define	SIM_RUN		3
+#define	SIM_FREEZE	4
+#define	SIM_SUSPEND	5
+#define	SIM_STEP	6
+#define	SIM_CRASH	7
+#define	SIM_SHUTDOWN	8
+#define	SIM_TORN	9
+
+#define	SIM_MAXEVENTS	(1 << 24)	/* after expanding the repeats */
+
+struct sim_event {
+	int	what;
+	int	line;		/* in the scenario file */
+	int64_t	arg;		/* time or duration in microseconds */
+};
+
+/* A scenario loaded by sim_load() */
+
+struct sim_scenario {
+	struct sim_event *ev;
+	size_t	n;
+	int	errline;	/* line with an error if -1 returned, or 0 */
+	const char *errmsg;	/* what was wrong on it */
+};
+
+/* Function prototypes */
+
+int	sim_load(const char *, struct sim_scenario *);
+void	sim_free(struct sim_scenario *);
+
+/* eof */
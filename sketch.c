@@ -0,0 +1,167 @@
+/*-
+ * Copyright (c) 2009-2016 Janne Snabb. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *
+ * Software web site:
+ *   https://dist.epipe.com/downtimed/
+ *
+ */
+
+/* Include config.h in case we use autoconf. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+
+#include <inttypes.h>
+#include <string.h>
+
+#include "sketch.h"
+
+static int	sketch_index(int64_t);
+static int64_t	sketch_value(int);
+
+void
+sketch_init(struct sketch *sk)
+{
+
+	memset(sk, 0, sizeof(struct sketch));
+}
+
+/* Add a value, negative values are counted as zero */
+
+void
+sketch_add(struct sketch *sk, int64_t v)
+{
+
+	if (v < 0)
+		v = 0;
+
+	if (sk->count == 0 || v < sk->min)
+		sk->min = v;
+	if (sk->count == 0 || v > sk->max)
+		sk->max = v;
+
+	sk->count++;
+	sk->sum += v;
+	sk->bucket[sketch_index(v)]++;
+}
+
+/* Add the values counted in src to dst */
+
+void
+sketch_merge(struct sketch *dst, const struct sketch *src)
+{
+	int i;
+
+	if (src->count == 0)
+		return;
+
+	if (dst->count == 0 || src->min < dst->min)
+		dst->min = src->min;
+	if (dst->count == 0 || src->max > dst->max)
+		dst->max = src->max;
+
+	dst->count += src->count;
+	dst->sum += src->sum;
+	for (i = 0; i < SKETCH_NBUCKETS; i++)
+		dst->bucket[i] += src->bucket[i];
+}
+
+/*
+ * Return the value at quantile q (0.0 - 1.0) using the nearest rank
+ * method, or 0 if the sketch is empty.
+ */
+
+int64_t
+sketch_quantile(const struct sketch *sk, double q)
+{
+	uint64_t rank, n;
+	int64_t v;
+	int i;
+
+	if (sk->count == 0)
+		return (0);
+
+	rank = (uint64_t)(q * sk->count);
+	if ((double)rank < q * sk->count)
+		rank++;
+	if (rank < 1)
+		rank = 1;
+	if (rank >= sk->count)
+		return (sk->max);
+
+	for (i = 0, n = 0; i < SKETCH_NBUCKETS; i++) {
+		n += sk->bucket[i];
+		if (n >= rank)
+			break;
+	}
+
+	v = sketch_value(i);
+	if (v < sk->min)
+		v = sk->min;
+	if (v > sk->max)
+		v = sk->max;
+
+	return (v);
+}
+
+/* Map a value to its bucket */
+
+static int
+sketch_index(int64_t v)
+{
+	int shift;
+
+	if (v < (2 << SKETCH_SUBBITS))
+		return ((int)v);
+
+	for (shift = 0; (v >> shift) >= (2 << SKETCH_SUBBITS); shift++)
+		;
+
+	return (((shift + 1) << SKETCH_SUBBITS) +
+	    (int)(v >> shift) - (1 << SKETCH_SUBBITS));
+}
+
+/* Map a bucket back to the midpoint of the values it holds */
+
+static int64_t
+sketch_value(int i)
+{
+	int shift;
+	int64_t lo;
+
+	if (i < (2 << SKETCH_SUBBITS))
+		return (i);
+
+	shift = (i >> SKETCH_SUBBITS) - 1;
+	lo = ((int64_t)((i & ((1 << SKETCH_SUBBITS) - 1)) +
+	    (1 << SKETCH_SUBBITS))) << shift;
+
+	return (lo + (((int64_t)1 << shift) - 1) / 2);
+}
+
+/* eof */
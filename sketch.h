@@ -0,0 +1,60 @@
+/*-
+ * Copyright (c) 2009-2016 Janne Snabb. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *
+ * Software web site:
+ *   https://dist.epipe.com/downtimed/
+ *
+ */
+
+/*
+ * A mergeable streaming quantile sketch for non-negative durations.
+ *
+ * Values are counted in log-linear buckets: values below 128 have a
+ * bucket of their own and above that each power of two is divided into
+ * 64 buckets. Quantiles are thus exact for values below 128 and within
+ * 1% otherwise, using a fixed amount of memory regardless of how many
+ * values are added. Two sketches are merged by adding up the bucket
+ * counts, so per-host sketches can be combined into a fleet-wide one.
+ */
+
+#define	SKETCH_SUBBITS	6
+#define	SKETCH_NBUCKETS	((64 - SKETCH_SUBBITS) << SKETCH_SUBBITS)
+
+struct sketch {
+	uint64_t	count;		/* number of values added */
+	int64_t		min;
+	int64_t		max;
+	int64_t		sum;
+	uint32_t	bucket[SKETCH_NBUCKETS];
+};
+
+/* Function prototypes */
+
+void	sketch_init(struct sketch *);
+void	sketch_add(struct sketch *, int64_t);
+void	sketch_merge(struct sketch *, const struct sketch *);
+int64_t	sketch_quantile(const struct sketch *, double);
+
+/* eof */
@@ -0,0 +1,263 @@
+/*-
+ * Copyright (c) 2009-2016 Janne Snabb. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *
+ * Software web site:
+ *   https://dist.epipe.com/downtimed/
+ *
+ */
+
+/* Include config.h in case we use autoconf. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "status.h"
+
+/* from <sys/stat.h> */
+
+#ifndef DEFFILEMODE
+#define	DEFFILEMODE 0666
+#endif
+
+/* How many times a reader retries while the page is being written */
+
+#define	STATUS_TRIES	1000
+
+/*
+ * Accesses to the shared page. The fields are accessed atomically one
+ * by one; the fences order them against the sequence number.
+ */
+
+#if defined(__GNUC__)
+#define	LOAD(p)		__atomic_load_n((p), __ATOMIC_RELAXED)
+#define	LOAD_ACQ(p)	__atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define	STORE(p, v)	__atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#define	STORE_REL(p, v)	__atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define	FENCE_ACQ()	__atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define	FENCE_REL()	__atomic_thread_fence(__ATOMIC_RELEASE)
+#else
+/* without the builtins, rely on the compiler keeping the order */
+#define	LOAD(p)		(*(p))
+#define	LOAD_ACQ(p)	(*(p))
+#define	STORE(p, v)	(*(p) = (v))
+#define	STORE_REL(p, v)	(*(p) = (v))
+#define	FENCE_ACQ()
+#define	FENCE_REL()
+#endif
+
+/*
+ * Create or reuse the status page file and map it for writing. An
+ * existing page is reused in place, so that readers which have it
+ * mapped keep working across restarts of the daemon. Return NULL on
+ * error with errno set.
+ */
+
+struct status_page *
+status_create(const char *fn)
+{
+	struct status_page *p;
+	struct stat sb;
+	uint32_t seq;
+	int fd, error;
+
+	if ((fd = open(fn, O_RDWR | O_CREAT, DEFFILEMODE)) < 0)
+		return (NULL);
+
+	if (fstat(fd, &sb) < 0 ||
+	    (sb.st_size != sizeof(struct status_page) &&
+	    ftruncate(fd, sizeof(struct status_page)) < 0) ||
+	    (p = mmap(NULL, sizeof(struct status_page),
+	    PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		error = errno;
+		close(fd);
+		errno = error;
+		return (NULL);
+	}
+	close(fd);
+
+	memcpy(p->magic, STATUS_MAGIC, STATUS_MAGICLEN);
+	p->version = STATUS_VERSION;
+	p->size = sizeof(struct status_page);
+
+	/* the previous writer may have died in the middle of an update */
+	if ((seq = LOAD(&p->seq)) & 1)
+		STORE_REL(&p->seq, seq + 1);
+
+	return (p);
+}
+
+/* Update the status page */
+
+void
+status_write(struct status_page *p, const struct status *st)
+{
+	uint32_t seq;
+
+	seq = LOAD(&p->seq);
+	STORE(&p->seq, seq + 1);
+	FENCE_REL();
+
+	STORE(&p->state, st->state);
+	STORE(&p->pid, st->pid);
+	STORE(&p->boottime, st->boottime);
+	STORE(&p->tick_real, st->tick_real);
+	STORE(&p->tick_mono, st->tick_mono);
+	STORE(&p->ticks, st->ticks);
+
+	STORE_REL(&p->seq, seq + 2);
+}
+
+/*
+ * Map a status page for reading. Return NULL on error with errno set,
+ * to EILSEQ if the file is not a status page.
+ */
+
+const struct status_page *
+status_open(const char *fn)
+{
+	struct status_page *p;
+	struct stat sb;
+	int fd, error;
+
+	if ((fd = open(fn, O_RDONLY)) < 0)
+		return (NULL);
+
+	if (fstat(fd, &sb) < 0) {
+		error = errno;
+		close(fd);
+		errno = error;
+		return (NULL);
+	}
+	if (sb.st_size < sizeof(struct status_page)) {
+		close(fd);
+		errno = EILSEQ;
+		return (NULL);
+	}
+
+	p = mmap(NULL, sizeof(struct status_page), PROT_READ, MAP_SHARED,
+	    fd, 0);
+	error = errno;
+	close(fd);
+	if (p == MAP_FAILED) {
+		errno = error;
+		return (NULL);
+	}
+
+	if (memcmp(p->magic, STATUS_MAGIC, STATUS_MAGICLEN) != 0 ||
+	    p->version != STATUS_VERSION ||
+	    p->size < sizeof(struct status_page)) {
+		munmap(p, sizeof(struct status_page));
+		errno = EILSEQ;
+		return (NULL);
+	}
+
+	return (p);
+}
+
+/*
+ * Take a consistent copy of a status page. No system calls are made.
+ * Return 0 on success, or -1 with errno set to EAGAIN if the page was
+ * being written all the time, as when its writer died in the middle.
+ */
+
+int
+status_read(const struct status_page *p, struct status *st)
+{
+	uint32_t seq;
+	int i;
+
+	for (i = 0; i < STATUS_TRIES; i++) {
+		if ((seq = LOAD_ACQ(&p->seq)) & 1)
+			continue;
+
+		st->state = LOAD(&p->state);
+		st->pid = LOAD(&p->pid);
+		st->boottime = LOAD(&p->boottime);
+		st->tick_real = LOAD(&p->tick_real);
+		st->tick_mono = LOAD(&p->tick_mono);
+		st->ticks = LOAD(&p->ticks);
+
+		FENCE_ACQ();
+		if (LOAD(&p->seq) == seq)
+			return (0);
+	}
+
+	errno = EAGAIN;
+	return (-1);
+}
+
+/*
+ * Return the time in microseconds on the clock of tick_mono, which
+ * does not jump when the system time is set.
+ */
+
+int64_t
+status_clock(void)
+{
+	struct timeval tv;
+#ifdef CLOCK_MONOTONIC
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+		return ((int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+#endif
+
+	gettimeofday(&tv, NULL);
+
+	return ((int64_t)tv.tv_sec * 1000000 + tv.tv_usec);
+}
+
+/* Return the name of a state */
+
+const char *
+status_statestr(uint32_t state)
+{
+
+	switch (state) {
+	case STATUS_STARTING:
+		return ("starting");
+	case STATUS_RUNNING:
+		return ("running");
+	case STATUS_STOPPED:
+		return ("stopped");
+	default:
+		return ("unknown");
+	}
+}
+
+/* eof */
@@ -0,0 +1,84 @@
+/*-
+ * Copyright (c) 2009-2016 Janne Snabb. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *
+ * Software web site:
+ *   https://dist.epipe.com/downtimed/
+ *
+ */
+
+/*
+ * A status page published by downtimed(8) in a small file which is
+ * meant to live in shared memory, such as /dev/shm on Linux. Readers
+ * map it once and can then check that the daemon is alive without any
+ * system calls. The page is in native byte order, since it is only
+ * shared between processes on the same host.
+ *
+ * The writer increments seq to an odd value, updates the fields and
+ * increments seq to an even value again. A reader copies the fields
+ * and retries if seq was odd or changed meanwhile, see status_read().
+ */
+
+#define	STATUS_MAGIC		"DTSTAT01"
+#define	STATUS_MAGICLEN		8
+#define	STATUS_VERSION		1
+
+#define	STATUS_STARTING		1	/* stamps not touched yet */
+#define	STATUS_RUNNING		2
+#define	STATUS_STOPPED		3
+
+struct status_page {
+	char		magic[STATUS_MAGICLEN];
+	uint32_t	version;
+	uint32_t	size;		/* size of the page in bytes */
+	uint32_t	seq;		/* odd while being written */
+	uint32_t	state;
+	int64_t		pid;
+	int64_t		boottime;	/* seconds since the epoch */
+	int64_t		tick_real;	/* last tick, us since the epoch */
+	int64_t		tick_mono;	/* last tick, us on status_clock() */
+	uint64_t	ticks;		/* number of ticks */
+};
+
+/* A consistent copy of the fields of a status page */
+
+struct status {
+	uint32_t	state;
+	int64_t		pid;
+	int64_t		boottime;
+	int64_t		tick_real;
+	int64_t		tick_mono;
+	uint64_t	ticks;
+};
+
+/* Function prototypes */
+
+struct status_page *status_create(const char *);
+void	status_write(struct status_page *, const struct status *);
+const struct status_page *status_open(const char *);
+int	status_read(const struct status_page *, struct status *);
+int64_t	status_clock(void);
+const char *status_statestr(uint32_t);
+
+/* eof */
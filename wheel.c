@@ -0,0 +1,142 @@
+/*-
+ * Copyright (c) 2009-2016 Janne Snabb. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *
+ * Software web site:
+ *   https://dist.epipe.com/downtimed/
+ *
+ */
+
+/* Include config.h in case we use autoconf. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+
+#include <inttypes.h>
+#include <string.h>
+
+#include "wheel.h"
+
+#define	WHEEL_MASK	(WHEEL_SLOTS - 1)
+
+/* Initialize an empty wheel at the given time */
+
+void
+wheel_init(struct wheel *w, int64_t now)
+{
+
+	memset(w, 0, sizeof(struct wheel));
+	w->now = now;
+}
+
+/*
+ * Add an entry to expire at the given time. An entry which would be
+ * expired already is set to expire on the next second instead.
+ */
+
+void
+wheel_add(struct wheel *w, struct wheel_entry *e, int64_t when)
+{
+	struct wheel_entry **slot;
+
+	if (when <= w->now)
+		when = w->now + 1;
+
+	slot = &w->slot[when & WHEEL_MASK];
+	e->when = when;
+	e->next = *slot;
+	*slot = e;
+	w->count++;
+}
+
+/*
+ * Return the time when the next entry expires, or -1 if the wheel is
+ * empty. Usually this finds an entry within one revolution; only if
+ * all of the entries are further away than that, all are looked at.
+ */
+
+int64_t
+wheel_next(const struct wheel *w)
+{
+	const struct wheel_entry *e;
+	int64_t t, min;
+	int i;
+
+	if (w->count == 0)
+		return (-1);
+
+	for (t = w->now + 1; t <= w->now + WHEEL_SLOTS; t++)
+		for (e = w->slot[t & WHEEL_MASK]; e != NULL; e = e->next)
+			if (e->when == t)
+				return (t);
+
+	min = -1;
+	for (i = 0; i < WHEEL_SLOTS; i++)
+		for (e = w->slot[i]; e != NULL; e = e->next)
+			if (min < 0 || e->when < min)
+				min = e->when;
+
+	return (min);
+}
+
+/*
+ * Advance the wheel to the given time. Remove the entries which have
+ * expired by then and return them as a list linked through next.
+ */
+
+struct wheel_entry *
+wheel_expire(struct wheel *w, int64_t now)
+{
+	struct wheel_entry *list = NULL, *e, **pp;
+	int64_t t, n;
+
+	if (now <= w->now)
+		return (NULL);
+
+	/* there is no need to visit a slot more than once */
+	if ((n = now - w->now) > WHEEL_SLOTS)
+		n = WHEEL_SLOTS;
+
+	for (t = w->now + 1; n > 0; t++, n--) {
+		pp = &w->slot[t & WHEEL_MASK];
+		while ((e = *pp) != NULL) {
+			if (e->when <= now) {
+				*pp = e->next;
+				e->next = list;
+				list = e;
+				w->count--;
+			} else
+				pp = &e->next;
+		}
+	}
+
+	w->now = now;
+
+	return (list);
+}
+
+/* eof */
@@ -0,0 +1,60 @@
+/*-
+ * Copyright (c) 2009-2016 Janne Snabb. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *
+ * Software web site:
+ *   https://dist.epipe.com/downtimed/
+ *
+ */
+
+/*
+ * A hashed timer wheel with a resolution of one second. Entries are
+ * kept in the slot of their expiry time modulo WHEEL_SLOTS, so adding
+ * and expiring an entry takes constant time regardless of how many
+ * entries there are. Entries further away than one revolution simply
+ * stay in their slot until their time comes.
+ */
+
+#define	WHEEL_SLOTS	256	/* must be a power of two */
+
+struct wheel_entry {
+	struct wheel_entry	*next;
+	int64_t			 when;	/* expiry time in seconds */
+	void			*data;	/* owner of the entry */
+};
+
+struct wheel {
+	struct wheel_entry	*slot[WHEEL_SLOTS];
+	int64_t			 now;	/* entries up to this have expired */
+	size_t			 count;	/* number of entries */
+};
+
+/* Function prototypes */
+
+void	wheel_init(struct wheel *, int64_t);
+void	wheel_add(struct wheel *, struct wheel_entry *, int64_t);
+int64_t	wheel_next(const struct wheel *);
+struct wheel_entry *wheel_expire(struct wheel *, int64_t);
+
+/* eof */